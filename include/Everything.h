@@ -45,6 +45,8 @@ extern "C" {
 #define EVERYTHING_ERROR_INVALIDCALL		7 // invalid call
 #define EVERYTHING_ERROR_INVALIDREQUEST		8 // invalid request data, request data first.
 #define EVERYTHING_ERROR_INVALIDPARAMETER	9 // bad parameter.
+#define EVERYTHING_ERROR_TIMEOUT			10 // the query did not complete before its timeout.
+#define EVERYTHING_ERROR_CANCELLED			11 // the query was cancelled with Everything_CancelQuery.
 
 #define EVERYTHING_SORT_NAME_ASCENDING						1
 #define EVERYTHING_SORT_NAME_DESCENDING						2
@@ -90,6 +92,9 @@ extern "C" {
 #define EVERYTHING_REQUEST_HIGHLIGHTED_PATH					0x00004000
 #define EVERYTHING_REQUEST_HIGHLIGHTED_FULL_PATH_AND_FILE_NAME	0x00008000
 
+#define EVERYTHING_RESULT_FOLDER							0x00000001
+#define EVERYTHING_RESULT_VOLUME							0x00000002
+
 #define EVERYTHING_TARGET_MACHINE_X86						1
 #define EVERYTHING_TARGET_MACHINE_X64						2
 #define EVERYTHING_TARGET_MACHINE_ARM						3
@@ -102,9 +107,121 @@ extern "C" {
 #define EVERYTHINGUSERAPI __declspec(dllimport)
 #endif
 
+// a result string in place.
+// ptr is null terminated and len is the number of characters, excluding the null terminator.
+// views are valid until the next query, sort or reset.
+typedef struct EVERYTHING_tagSTRINGVIEWW
+{
+	LPCWSTR ptr;
+	DWORD len;
+	
+}EVERYTHING_STRINGVIEWW;
+
+typedef struct EVERYTHING_tagSTRINGVIEWA
+{
+	LPCSTR ptr;
+	DWORD len;
+	
+}EVERYTHING_STRINGVIEWA;
+
+// a result filled by Everything_GetResultRecords.
+// request_flags has the EVERYTHING_REQUEST_* bits of the fields that were available, the other fields are zero.
+typedef struct EVERYTHING_tagRESULTRECORDW
+{
+	DWORD request_flags;
+	DWORD flags; // EVERYTHING_RESULT_*
+	EVERYTHING_STRINGVIEWW file_name;
+	EVERYTHING_STRINGVIEWW path;
+	LARGE_INTEGER size;
+	FILETIME date_created;
+	FILETIME date_modified;
+	DWORD attributes;
+	
+}EVERYTHING_RESULTRECORDW;
+
+typedef struct EVERYTHING_tagRESULTRECORDA
+{
+	DWORD request_flags;
+	DWORD flags; // EVERYTHING_RESULT_*
+	EVERYTHING_STRINGVIEWA file_name;
+	EVERYTHING_STRINGVIEWA path;
+	LARGE_INTEGER size;
+	FILETIME date_created;
+	FILETIME date_modified;
+	DWORD attributes;
+	
+}EVERYTHING_RESULTRECORDA;
+
+// an immutable, reference counted result list.
+// snapshots stay valid across later queries, sorts and resets until released, and can be read from any thread without locking.
+typedef struct EVERYTHING_tagSNAPSHOT *EVERYTHING_SNAPSHOT;
+
+// timings of the last query, filled by Everything_GetQueryStats.
+// set cbSize to sizeof(EVERYTHING_QUERYSTATS) before the call, fields past cbSize are not written.
+typedef struct EVERYTHING_tagQUERYSTATS
+{
+	DWORD cbSize;
+	DWORD dwQueryTime; // milliseconds from Everything_Query until it returned.
+	DWORD dwWaitForWindowTime; // milliseconds spent waiting for the Everything IPC window to be created.
+	DWORD dwWaitForDBTime; // milliseconds spent waiting for the database to be loaded and idle.
+	DWORD dwReadyPolls; // number of times the IPC window and database state were checked.
+	DWORD dwQueryVersion; // IPC query version that was sent, 1 or 2, 0 if the query was not sent.
+	DWORD dwLastError; // EVERYTHING_OK or the EVERYTHING_ERROR_* the query failed with.
+	BOOL bFromCache; // TRUE if the results came from the query cache without IPC.
+	
+}EVERYTHING_QUERYSTATS;
+
+// counters since the client was loaded, filled by Everything_GetQueryCounters.
+// set cbSize to sizeof(EVERYTHING_QUERYCOUNTERS) before the call, fields past cbSize are not written.
+typedef struct EVERYTHING_tagQUERYCOUNTERS
+{
+	DWORD cbSize;
+	DWORD dwQueries; // Everything_Query and Everything_QueryEx calls.
+	DWORD dwCoalesced; // Everything_QueryEx calls that shared the results of an identical query in progress.
+	DWORD dwSent; // queries sent to Everything, including query cache probes.
+	DWORD dwCacheHits; // queries answered from the query cache.
+	
+}EVERYTHING_QUERYCOUNTERS;
+
+// a query for Everything_QueryEx, set cbSize to sizeof(EVERYTHING_QUERYEX).
+typedef struct EVERYTHING_tagQUERYEXW
+{
+	DWORD cbSize;
+	LPCWSTR lpSearch;
+	BOOL bMatchPath;
+	BOOL bMatchCase;
+	BOOL bMatchWholeWord;
+	BOOL bRegex;
+	DWORD dwSort; // EVERYTHING_SORT_*
+	DWORD dwRequestFlags; // EVERYTHING_REQUEST_*
+	DWORD dwOffset;
+	DWORD dwMax; // EVERYTHING_IPC_ALLRESULTS for all results.
+	DWORD dwTimeout; // milliseconds or INFINITE.
+	HANDLE hCancelEvent; // optional, the query gives up with EVERYTHING_ERROR_CANCELLED once the event is set.
+	
+}EVERYTHING_QUERYEXW;
+
+typedef struct EVERYTHING_tagQUERYEXA
+{
+	DWORD cbSize;
+	LPCSTR lpSearch;
+	BOOL bMatchPath;
+	BOOL bMatchCase;
+	BOOL bMatchWholeWord;
+	BOOL bRegex;
+	DWORD dwSort; // EVERYTHING_SORT_*
+	DWORD dwRequestFlags; // EVERYTHING_REQUEST_*
+	DWORD dwOffset;
+	DWORD dwMax; // EVERYTHING_IPC_ALLRESULTS for all results.
+	DWORD dwTimeout; // milliseconds or INFINITE.
+	HANDLE hCancelEvent; // optional, the query gives up with EVERYTHING_ERROR_CANCELLED once the event is set.
+	
+}EVERYTHING_QUERYEXA;
+
 // write search state
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetSearchW(LPCWSTR lpString);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetSearchA(LPCSTR lpString);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetSearchUTF8(LPCSTR lpString);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetMatchPath(BOOL bEnable);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetMatchCase(BOOL bEnable);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetMatchWholeWord(BOOL bEnable);
@@ -115,6 +232,9 @@ EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetReplyWindow(HWND hWnd);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetReplyID(DWORD dwId);
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetSort(DWORD dwSort); // Everything 1.4.1
 EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetRequestFlags(DWORD dwRequestFlags); // Everything 1.4.1
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetTimeout(DWORD dwMilliseconds);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetWaitForReady(BOOL bEnable);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_SetQueryCache(DWORD dwMaxEntries,DWORD dwTTLMilliseconds);
 
 // read search state
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetMatchPath(void);
@@ -130,10 +250,18 @@ EVERYTHINGUSERAPI HWND EVERYTHINGAPI Everything_GetReplyWindow(void);
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetReplyID(void);
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetSort(void); // Everything 1.4.1
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetRequestFlags(void); // Everything 1.4.1
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetTimeout(void);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetWaitForReady(void);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetQueryStats(EVERYTHING_QUERYSTATS *lpStats);
 
 // execute query
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_QueryA(BOOL bWait);
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_QueryW(BOOL bWait);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_CancelQuery(void);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_FlushQueryCache(void);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_QueryExW(const EVERYTHING_QUERYEXW *lpQuery,EVERYTHING_SNAPSHOT *lphSnapshot);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_QueryExA(const EVERYTHING_QUERYEXA *lpQuery,EVERYTHING_SNAPSHOT *lphSnapshot);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetQueryCounters(EVERYTHING_QUERYCOUNTERS *lpCounters);
 
 // query reply
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_IsQueryReply(UINT message,WPARAM wParam,LPARAM lParam,DWORD dwId);
@@ -157,6 +285,34 @@ EVERYTHINGUSERAPI LPCWSTR EVERYTHINGAPI Everything_GetResultPathW(DWORD dwIndex)
 EVERYTHINGUSERAPI LPCSTR EVERYTHINGAPI Everything_GetResultPathA(DWORD dwIndex);
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultFullPathNameA(DWORD dwIndex,LPSTR buf,DWORD bufsize);
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultFullPathNameW(DWORD dwIndex,LPWSTR wbuf,DWORD wbuf_size_in_wchars);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultFileNameUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultPathUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultFullPathNameUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultFileNameViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultFileNameViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultPathViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultPathViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultFullPathNameViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetResultFullPathNameViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultRecordsW(DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDW *lpRecords);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultRecordsA(DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDA *lpRecords);
+
+// result snapshots
+EVERYTHINGUSERAPI EVERYTHING_SNAPSHOT EVERYTHINGAPI Everything_GetResultSnapshot(void);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_AddRefSnapshot(EVERYTHING_SNAPSHOT hSnapshot);
+EVERYTHINGUSERAPI void EVERYTHINGAPI Everything_ReleaseSnapshot(EVERYTHING_SNAPSHOT hSnapshot);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_IsSnapshotUnicode(EVERYTHING_SNAPSHOT hSnapshot);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetSnapshotNumResults(EVERYTHING_SNAPSHOT hSnapshot);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetSnapshotTotResults(EVERYTHING_SNAPSHOT hSnapshot);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotFileNameViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotFileNameViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotPathViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotPathViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotFullPathNameViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView);
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_GetSnapshotFullPathNameViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetSnapshotRecordsW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDW *lpRecords);
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetSnapshotRecordsA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDA *lpRecords);
+
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListSort(void); // Everything 1.4.1
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListRequestFlags(void); // Everything 1.4.1
 EVERYTHINGUSERAPI LPCWSTR EVERYTHINGAPI Everything_GetResultExtensionW(DWORD dwIndex); // Everything 1.4.1
@@ -196,6 +352,8 @@ EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_SaveDB(void); // Everything 1.4.
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_SaveRunHistory(void); // Everything 1.4.1
 EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_DeleteRunHistory(void); // Everything 1.4.1
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetTargetMachine(void); // Everything 1.4.1
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_IsFastSort(DWORD sortType); // Everything 1.4.1
+EVERYTHINGUSERAPI BOOL EVERYTHINGAPI Everything_IsFileInfoIndexed(DWORD fileInfoType); // Everything 1.4.1
 
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetRunCountFromFileNameW(LPCWSTR lpFileName); // Everything 1.4.1
 EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetRunCountFromFileNameA(LPCSTR lpFileName); // Everything 1.4.1
@@ -208,10 +366,22 @@ EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_IncRunCountFromFileNameA(LPCSTR
 #define Everything_SetSearch Everything_SetSearchW
 #define Everything_GetSearch Everything_GetSearchW
 #define Everything_Query Everything_QueryW
+#define EVERYTHING_QUERYEX EVERYTHING_QUERYEXW
+#define Everything_QueryEx Everything_QueryExW
 #define Everything_Query2 Everything_Query2W
 #define Everything_GetResultFileName Everything_GetResultFileNameW
 #define Everything_GetResultPath Everything_GetResultPathW
 #define Everything_GetResultFullPathName Everything_GetResultFullPathNameW
+#define EVERYTHING_STRINGVIEW EVERYTHING_STRINGVIEWW
+#define Everything_GetResultFileNameView Everything_GetResultFileNameViewW
+#define Everything_GetResultPathView Everything_GetResultPathViewW
+#define Everything_GetResultFullPathNameView Everything_GetResultFullPathNameViewW
+#define EVERYTHING_RESULTRECORD EVERYTHING_RESULTRECORDW
+#define Everything_GetResultRecords Everything_GetResultRecordsW
+#define Everything_GetSnapshotFileNameView Everything_GetSnapshotFileNameViewW
+#define Everything_GetSnapshotPathView Everything_GetSnapshotPathViewW
+#define Everything_GetSnapshotFullPathNameView Everything_GetSnapshotFullPathNameViewW
+#define Everything_GetSnapshotRecords Everything_GetSnapshotRecordsW
 #define Everything_GetResultExtension Everything_GetResultExtensionW
 #define Everything_GetResultFileListFileName Everything_GetResultFileListFileNameW
 #define Everything_GetResultHighlightedFileName Everything_GetResultHighlightedFileNameW
@@ -224,10 +394,22 @@ EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_IncRunCountFromFileNameA(LPCSTR
 #define Everything_SetSearch Everything_SetSearchA
 #define Everything_GetSearch Everything_GetSearchA
 #define Everything_Query Everything_QueryA
+#define EVERYTHING_QUERYEX EVERYTHING_QUERYEXA
+#define Everything_QueryEx Everything_QueryExA
 #define Everything_Query2 Everything_Query2A
 #define Everything_GetResultFileName Everything_GetResultFileNameA
 #define Everything_GetResultPath Everything_GetResultPathA
 #define Everything_GetResultFullPathName Everything_GetResultFullPathNameA
+#define EVERYTHING_STRINGVIEW EVERYTHING_STRINGVIEWA
+#define Everything_GetResultFileNameView Everything_GetResultFileNameViewA
+#define Everything_GetResultPathView Everything_GetResultPathViewA
+#define Everything_GetResultFullPathNameView Everything_GetResultFullPathNameViewA
+#define EVERYTHING_RESULTRECORD EVERYTHING_RESULTRECORDA
+#define Everything_GetResultRecords Everything_GetResultRecordsA
+#define Everything_GetSnapshotFileNameView Everything_GetSnapshotFileNameViewA
+#define Everything_GetSnapshotPathView Everything_GetSnapshotPathViewA
+#define Everything_GetSnapshotFullPathNameView Everything_GetSnapshotFullPathNameViewA
+#define Everything_GetSnapshotRecords Everything_GetSnapshotRecordsA
 #define Everything_GetResultExtension Everything_GetResultExtensionA
 #define Everything_GetResultFileListFileName Everything_GetResultFileListFileNameA
 #define Everything_GetResultHighlightedFileName Everything_GetResultHighlightedFileNameA
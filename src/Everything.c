@@ -36,6 +36,8 @@
 // include
 #include "../include/Everything.h"
 #include "../ipc/Everything_IPC.h"
+#include "strfold.h"
+#include "transcode.h"
 
 // return copydata code
 #define _EVERYTHING_COPYDATA_QUERYREPLY		0
@@ -48,6 +50,228 @@ typedef struct _EVERYTHING_tagCHANGEFILTERSTRUCT
 	DWORD ExtStatus;
 }_EVERYTHING_CHANGEFILTERSTRUCT, *_EVERYTHING_PCHANGEFILTERSTRUCT;
 
+// a result string in the query character set.
+typedef struct _EVERYTHING_tagSTRINGVIEW
+{
+	const void *ptr; // CHAR or WCHAR
+	DWORD len;
+	
+}_EVERYTHING_STRINGVIEW;
+
+// EVERYTHING_RESULTRECORDA or EVERYTHING_RESULTRECORDW
+typedef struct _EVERYTHING_tagRESULTRECORD
+{
+	DWORD request_flags;
+	DWORD flags;
+	_EVERYTHING_STRINGVIEW file_name;
+	_EVERYTHING_STRINGVIEW path;
+	LARGE_INTEGER size;
+	FILETIME date_created;
+	FILETIME date_modified;
+	DWORD attributes;
+	
+}_EVERYTHING_RESULTRECORD;
+
+// an immutable result list.
+// the current results are held by _Everything_Snapshot, callers can hold more references and read them without the lock.
+typedef struct EVERYTHING_tagSNAPSHOT
+{
+	volatile LONG ref_count;
+	BOOL is_unicode;
+	
+	// size in bytes of the list data.
+	DWORD size;
+	
+	// one of list or list2 is set.
+	void *list; // EVERYTHING_IPC_LISTW or EVERYTHING_IPC_LISTA
+	EVERYTHING_IPC_LIST2 *list2;
+	
+	// assembled full paths, followed by their text, built on demand.
+	_EVERYTHING_STRINGVIEW * volatile full_path_views;
+	
+}_EVERYTHING_SNAPSHOT;
+
+// a cached query result, keyed on everything that is sent with the query.
+typedef struct _EVERYTHING_tagQUERY_CACHE_ENTRY
+{
+	// most recently used first.
+	struct _EVERYTHING_tagQUERY_CACHE_ENTRY *next;
+	struct _EVERYTHING_tagQUERY_CACHE_ENTRY *prev;
+	
+	DWORD hash;
+	BOOL is_unicode;
+	DWORD search_flags;
+	DWORD sort;
+	DWORD request_flags;
+	DWORD offset;
+	DWORD max;
+	
+	// length in WCHARs of the search text that follows.
+	DWORD search_len;
+	
+	// when the results were received.
+	DWORD tick;
+	
+	_EVERYTHING_SNAPSHOT *snapshot;
+	
+}_EVERYTHING_QUERY_CACHE_ENTRY;
+
+// the most recently changed file and the number of indexed files.
+// if either changes the index has changed.
+typedef struct _EVERYTHING_tagINDEX_STAMP
+{
+	DWORD totitems;
+	FILETIME date_recently_changed;
+	
+}_EVERYTHING_INDEX_STAMP;
+
+// a query in progress that identical Everything_QueryEx calls wait for instead of sending their own.
+typedef struct _EVERYTHING_tagQUERY_FLIGHT
+{
+	struct _EVERYTHING_tagQUERY_FLIGHT *next;
+	_EVERYTHING_QUERY_CACHE_ENTRY *key;
+	
+	// the leader and its waiters, protected by _Everything_FlightCS.
+	LONG ref_count;
+	
+	// set when error and snapshot are filled.
+	HANDLE done_event;
+	DWORD error;
+	_EVERYTHING_SNAPSHOT *snapshot;
+	
+}_EVERYTHING_QUERY_FLIGHT;
+
+// EVERYTHING_QUERYEXA or EVERYTHING_QUERYEXW
+typedef struct _EVERYTHING_tagQUERYEX
+{
+	DWORD cbSize;
+	const void *search;
+	BOOL match_path;
+	BOOL match_case;
+	BOOL match_whole_word;
+	BOOL regex;
+	DWORD sort;
+	DWORD request_flags;
+	DWORD offset;
+	DWORD max;
+	DWORD timeout;
+	HANDLE cancel_event;
+	
+}_EVERYTHING_QUERYEX;
+
+// the size of EVERYTHING_QUERYEX before hCancelEvent was added.
+#define _EVERYTHING_QUERYEX_SIZE_V1			((DWORD)(DWORD_PTR)&((_EVERYTHING_QUERYEX *)0)->cancel_event)
+
+// an Everything_QueryEx query sent from its own worker thread and reply window.
+// it does not touch the search state, so any number of them can be waiting for Everything at once.
+typedef struct _EVERYTHING_tagQUERYEX_CALL
+{
+	const _EVERYTHING_QUERYEX *query;
+	BOOL is_unicode;
+	HWND everything_hwnd;
+	HANDLE cancel_event;
+	DWORD start_tick;
+	
+	// set by the reply window.
+	DWORD error;
+	_EVERYTHING_SNAPSHOT *snapshot;
+	
+}_EVERYTHING_QUERYEX_CALL;
+
+// the query settings and current results, put aside while an internal query runs.
+typedef struct _EVERYTHING_tagQUERY_STATE
+{
+	_EVERYTHING_SNAPSHOT *snapshot;
+	void *search;
+	BOOL is_unicode_search;
+	BOOL is_unicode_query;
+	BOOL match_path;
+	BOOL match_case;
+	BOOL match_whole_word;
+	BOOL regex;
+	DWORD max;
+	DWORD offset;
+	DWORD sort;
+	DWORD request_flags;
+	DWORD timeout;
+	DWORD query_version;
+	
+}_EVERYTHING_QUERY_STATE;
+
+// _EVERYTHING_CAPABILITIES query2
+#define _EVERYTHING_CAPABILITY_UNKNOWN			0
+#define _EVERYTHING_CAPABILITY_YES				1
+#define _EVERYTHING_CAPABILITY_NO				2
+
+// what the running Everything supports, read once per Everything window.
+typedef struct _EVERYTHING_tagCAPABILITIES
+{
+	// the window the capabilities were read from, they are read again if Everything restarts.
+	HWND everything_hwnd;
+	
+	BOOL got_version;
+	DWORD major_version;
+	DWORD minor_version;
+	DWORD revision;
+	
+	// version 2 queries, Everything 1.4.1 or later.
+	DWORD query2;
+	
+	// bit n is for EVERYTHING_SORT_* n and EVERYTHING_IPC_FILE_INFO_* n.
+	DWORD fast_sort_checked;
+	DWORD fast_sort;
+	DWORD file_info_checked;
+	DWORD file_info_indexed;
+	
+}_EVERYTHING_CAPABILITIES;
+
+// wait for ready tuning
+#define _EVERYTHING_WAIT_FOR_READY_TIMEOUT		60000 // bound on the wait when there is no query timeout.
+#define _EVERYTHING_READY_MIN_BACKOFF			10
+#define _EVERYTHING_READY_MAX_BACKOFF			500
+
+// sort tuning
+#define _EVERYTHING_SORT_RUN					16
+#define _EVERYTHING_SORT_PARALLEL_THRESHOLD		65536
+#define _EVERYTHING_SORT_MAX_THREADS			16
+
+typedef struct _EVERYTHING_tagSORT_KEY
+{
+	// the first folded characters, big endian so they compare as an integer.
+	ULONGLONG prefix;
+	
+	// offset in characters of the folded key text.
+	DWORD offset;
+	
+	// the original index of the item.
+	DWORD index;
+	
+}_EVERYTHING_SORT_KEY;
+
+typedef struct _EVERYTHING_tagSORT
+{
+	BOOL is_unicode;
+	DWORD numitems;
+	void *keybuf; // CHAR or WCHAR folded keys
+	_EVERYTHING_SORT_KEY *keys;
+	_EVERYTHING_SORT_KEY *tmp;
+	
+}_EVERYTHING_SORT;
+
+typedef struct _EVERYTHING_tagSORT_JOB
+{
+	_EVERYTHING_SORT *sort;
+	DWORD start;
+	DWORD count;
+	DWORD mid;
+	BOOL ok;
+	ULONGLONG key_chars;
+	ULONGLONG key_offset;
+	_EVERYTHING_SORT_KEY *src;
+	_EVERYTHING_SORT_KEY *dst;
+	
+}_EVERYTHING_SORT_JOB;
+
 static void *_Everything_Alloc(DWORD size);
 static void _Everything_Free(void *ptr);
 static void _Everything_Initialize(void);
@@ -59,9 +283,43 @@ static BOOL EVERYTHINGAPI _Everything_Query(void);
 static BOOL _Everything_ShouldUseVersion2(void);
 static BOOL _Everything_SendIPCQuery(void);
 static BOOL _Everything_SendIPCQuery2(HWND everything_hwnd);
+static _EVERYTHING_CAPABILITIES *_Everything_GetCapabilities(HWND everything_hwnd);
+static void _Everything_ReadVersion(_EVERYTHING_CAPABILITIES *capabilities);
+static BOOL _Everything_SendIPCCommand(HWND everything_hwnd,int command,LPARAM lParam,DWORD_PTR *result);
+static DWORD _Everything_GetRemainingTime(void);
+static BOOL _Everything_ExecuteQuery(BOOL bWait);
+static BOOL _Everything_IsDBReady(HWND everything_hwnd,DWORD timeout);
+static BOOL _Everything_WaitForReady(BOOL pump_messages);
+static BOOL _Everything_CachedQuery(void);
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_CreateQueryCacheEntry(void);
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_CreateQueryKey(const void *search,BOOL is_unicode_search,BOOL is_unicode,DWORD search_flags,DWORD sort,DWORD request_flags,DWORD offset,DWORD max);
+static BOOL _Everything_IsSameQueryCacheKey(const _EVERYTHING_QUERY_CACHE_ENTRY *a,const _EVERYTHING_QUERY_CACHE_ENTRY *b);
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_FindQueryCacheEntry(const _EVERYTHING_QUERY_CACHE_ENTRY *key);
+static void _Everything_RemoveQueryCacheEntry(_EVERYTHING_QUERY_CACHE_ENTRY *entry);
+static void _Everything_TrimQueryCache(DWORD max_entries);
+static BOOL _Everything_ProbeIndexStamp(_EVERYTHING_INDEX_STAMP *stamp);
+static void _Everything_SaveQueryState(_EVERYTHING_QUERY_STATE *state);
+static void _Everything_RestoreQueryState(const _EVERYTHING_QUERY_STATE *state);
+static DWORD _Everything_QueryEx(const _EVERYTHING_QUERYEX *query,BOOL is_unicode,EVERYTHING_SNAPSHOT *lphSnapshot);
+static BOOL _Everything_SendQueryEx(const _EVERYTHING_QUERYEX *query,BOOL is_unicode,HANDLE cancel_event,DWORD start_tick,DWORD *error,_EVERYTHING_SNAPSHOT **snapshot);
+static DWORD EVERYTHINGAPI _Everything_queryex_thread_proc(void *param);
+static BOOL _Everything_SendQueryExCopyData(_EVERYTHING_QUERYEX_CALL *call,HWND reply_hwnd);
+static DWORD _Everything_GetQueryExRemainingTime(const _EVERYTHING_QUERYEX_CALL *call);
+static LRESULT WINAPI _Everything_queryex_window_proc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam);
+static void _Everything_ReleaseQueryFlight(_EVERYTHING_QUERY_FLIGHT *flight);
 static void _Everything_FreeLists(void);
+static _EVERYTHING_SNAPSHOT *_Everything_CreateSnapshot(const void *data,DWORD size,BOOL is_list2,BOOL is_unicode);
+static DWORD _Everything_GetListStringSize(const void *data,DWORD size,DWORD offset,BOOL is_unicode);
+static BOOL _Everything_IsEqualMemory(const void *a,const void *b,DWORD size);
+static void *_Everything_InternListPaths(const void *data,DWORD size,BOOL is_unicode,DWORD *interned_size);
+static void _Everything_AddRefSnapshot(_EVERYTHING_SNAPSHOT *snapshot);
+static void _Everything_ReleaseSnapshot(_EVERYTHING_SNAPSHOT *snapshot);
+static void _Everything_SetCurrentSnapshot(_EVERYTHING_SNAPSHOT *snapshot);
+static BOOL _Everything_SetResultList(const void *data,DWORD size);
+static BOOL _Everything_UnshareSnapshot(void);
 static BOOL _Everything_IsValidResultIndex(DWORD dwIndex);
 static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType);
+static void *_Everything_GetListRequestData(EVERYTHING_IPC_LIST2 *list2,BOOL is_unicode,DWORD dwIndex,DWORD dwRequestType);
 static BOOL _Everything_IsSchemeNameW(LPCWSTR s);
 static BOOL _Everything_IsSchemeNameA(LPCSTR s);
 static void _Everything_ChangeWindowMessageFilter(HWND hwnd);
@@ -70,6 +328,7 @@ static LPCWSTR _Everything_GetResultRequestStringW(DWORD dwIndex,DWORD dwRequest
 static LPCSTR _Everything_GetResultRequestStringA(DWORD dwIndex,DWORD dwRequestType);
 static BOOL _Everything_SendAPIBoolCommand(int command,LPARAM lParam);
 static DWORD _Everything_SendAPIDwordCommand(int command,LPARAM lParam);
+static BOOL _Everything_IsIndexed(int command,DWORD type);
 static LRESULT _Everything_SendCopyData(int command,const void *data,int size);
 static LRESULT WINAPI _Everything_window_proc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam);
 
@@ -83,10 +342,32 @@ static DWORD _Everything_Max = EVERYTHING_IPC_ALLRESULTS;
 static DWORD _Everything_Offset = 0;
 static DWORD _Everything_Sort = EVERYTHING_SORT_NAME_ASCENDING;
 static DWORD _Everything_RequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+static DWORD _Everything_Timeout = INFINITE;
+static DWORD _Everything_QueryStartTick = 0; // the deadline of the query in progress is _Everything_QueryStartTick + _Everything_Timeout.
+static HANDLE _Everything_CancelEvent = NULL; // set by Everything_CancelQuery, reset at the start of each query.
+static BOOL _Everything_WaitForReadyEnabled = FALSE;
+static UINT _Everything_IPCCreatedMessage = 0; // registered EVERYTHING_IPC_CREATED message.
+static volatile BOOL _Everything_IPCCreated = FALSE; // set when Everything broadcasts EVERYTHING_IPC_CREATED.
+static EVERYTHING_QUERYSTATS _Everything_QueryStats = {sizeof(EVERYTHING_QUERYSTATS)};
+static DWORD _Everything_QueryCacheMax = 0; // 0 disables the query cache.
+static DWORD _Everything_QueryCacheTTL = 0;
+static DWORD _Everything_QueryCacheCount = 0;
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_QueryCacheHead = NULL;
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_QueryCacheTail = NULL;
+static BOOL _Everything_QueryCacheHasStamp = FALSE;
+static _EVERYTHING_INDEX_STAMP _Everything_QueryCacheStamp; // the index the cached results came from.
+static _EVERYTHING_CAPABILITIES _Everything_Capabilities = {0};
+static CRITICAL_SECTION _Everything_FlightCS; // protects the in flight list, never held while waiting for _Everything_cs.
+static _EVERYTHING_QUERY_FLIGHT *_Everything_FlightList = NULL;
+static volatile LONG _Everything_QueryCount = 0;
+static volatile LONG _Everything_CoalescedCount = 0;
+static volatile LONG _Everything_SentCount = 0;
+static volatile LONG _Everything_CacheHitCount = 0;
 static BOOL _Everything_IsUnicodeQuery = FALSE;
 static DWORD _Everything_QueryVersion = 0;
 static BOOL _Everything_IsUnicodeSearch = FALSE;
 static void *_Everything_Search = NULL; // wchar or char
+static _EVERYTHING_SNAPSHOT *_Everything_Snapshot = NULL; // the current results, _Everything_List or _Everything_List2 point into it.
 static EVERYTHING_IPC_LIST2 *_Everything_List2 = NULL;
 static void *_Everything_List = NULL; // EVERYTHING_IPC_LISTW or EVERYTHING_IPC_LISTA
 static volatile BOOL _Everything_Initialized = FALSE;
@@ -106,6 +387,9 @@ static void _Everything_Initialize(void)
 		{
 			// do the initialization..
 			InitializeCriticalSection(&_Everything_cs);
+			InitializeCriticalSection(&_Everything_FlightCS);
+			
+			_Everything_CancelEvent = CreateEvent(0,TRUE,FALSE,0);
 			
 			_Everything_Initialized = 1;
 		}
@@ -132,30 +416,12 @@ static void _Everything_Unlock(void)
 // avoid other libs
 static DWORD _Everything_StringLengthA(LPCSTR start)
 {
-	register LPCSTR s;
-	
-	s = start;
-	
-	while(*s)
-	{
-		s++;
-	}
-	
-	return (DWORD)(s-start);
+	return (DWORD)transcode_strlen(start);
 }
 
 static DWORD _Everything_StringLengthW(LPCWSTR start)
 {
-	register LPCWSTR s;
-	
-	s = start;
-	
-	while(*s)
-	{
-		s++;
-	}
-	
-	return (DWORD)(s-start);
+	return (DWORD)transcode_wcslen(start);
 }
 
 void EVERYTHINGAPI Everything_SetSearchW(LPCWSTR lpString)
@@ -214,6 +480,39 @@ void EVERYTHINGAPI Everything_SetSearchA(LPCSTR lpString)
 	_Everything_Unlock();
 }
 
+// the search is stored as unicode.
+void EVERYTHINGAPI Everything_SetSearchUTF8(LPCSTR lpString)
+{
+	DWORD size;
+	DWORD wlen;
+	
+	_Everything_Lock();
+	
+	if (_Everything_Search) 
+	{
+		_Everything_Free(_Everything_Search);
+	}
+	
+	size = _Everything_StringLengthA(lpString);
+	wlen = (DWORD)transcode_utf8_to_utf16(NULL,0,lpString,size);
+
+	_Everything_Search = _Everything_Alloc((wlen + 1) * sizeof(WCHAR));
+	if (_Everything_Search)
+	{
+		transcode_utf8_to_utf16(_Everything_Search,wlen,lpString,size);
+		
+		((LPWSTR)_Everything_Search)[wlen] = 0;
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+	}
+
+	_Everything_IsUnicodeSearch = 1;
+
+	_Everything_Unlock();
+}
+
 LPCSTR EVERYTHINGAPI Everything_GetSearchA(void)
 {
 	LPCSTR ret;
@@ -317,6 +616,51 @@ void EVERYTHINGAPI Everything_SetMax(DWORD dwMax)
 	_Everything_Unlock();
 }
 
+// INFINITE to wait for the reply forever.
+void EVERYTHINGAPI Everything_SetTimeout(DWORD dwMilliseconds)
+{
+	_Everything_Lock();
+
+	_Everything_Timeout = dwMilliseconds;
+
+	_Everything_Unlock();
+}
+
+// wait for Everything to start and load its database before sending a query, instead of failing with EVERYTHING_ERROR_IPC.
+// the wait counts against the query timeout.
+void EVERYTHINGAPI Everything_SetWaitForReady(BOOL bEnable)
+{
+	_Everything_Lock();
+
+	_Everything_WaitForReadyEnabled = bEnable;
+
+	_Everything_Unlock();
+}
+
+// cache up to dwMaxEntries query results for dwTTLMilliseconds.
+// a repeated query is answered from the cache without IPC, cached results are dropped when the index changes.
+// only queries that wait for their results are cached. 0 entries disables the cache.
+void EVERYTHINGAPI Everything_SetQueryCache(DWORD dwMaxEntries,DWORD dwTTLMilliseconds)
+{
+	_Everything_Lock();
+
+	_Everything_QueryCacheMax = dwMaxEntries;
+	_Everything_QueryCacheTTL = dwTTLMilliseconds;
+	
+	_Everything_TrimQueryCache(dwMaxEntries);
+
+	_Everything_Unlock();
+}
+
+void EVERYTHINGAPI Everything_FlushQueryCache(void)
+{
+	_Everything_Lock();
+
+	_Everything_TrimQueryCache(0);
+
+	_Everything_Unlock();
+}
+
 void EVERYTHINGAPI Everything_SetOffset(DWORD dwOffset)
 {
 	_Everything_Lock();
@@ -427,6 +771,63 @@ DWORD EVERYTHINGAPI Everything_GetMax(void)
 	return ret;
 }
 
+DWORD EVERYTHINGAPI Everything_GetTimeout(void)
+{
+	DWORD ret;
+	
+	_Everything_Lock();
+	
+	ret = _Everything_Timeout;
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+BOOL EVERYTHINGAPI Everything_GetWaitForReady(void)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+	
+	ret = _Everything_WaitForReadyEnabled;
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+BOOL EVERYTHINGAPI Everything_GetQueryStats(EVERYTHING_QUERYSTATS *lpStats)
+{
+	DWORD size;
+	
+	if ((!lpStats) || (lpStats->cbSize < sizeof(DWORD)))
+	{
+		_Everything_Lock();
+		
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDPARAMETER;
+		
+		_Everything_Unlock();
+		
+		return FALSE;
+	}
+	
+	_Everything_Lock();
+	
+	// older callers may pass a smaller structure.
+	size = lpStats->cbSize;
+	if (size > sizeof(EVERYTHING_QUERYSTATS))
+	{
+		size = sizeof(EVERYTHING_QUERYSTATS);
+	}
+	
+	CopyMemory((char *)lpStats + sizeof(DWORD),(char *)&_Everything_QueryStats + sizeof(DWORD),size - sizeof(DWORD));
+
+	_Everything_Unlock();
+	
+	return TRUE;
+}
+
 DWORD EVERYTHINGAPI Everything_GetOffset(void)
 {
 	DWORD ret;
@@ -495,6 +896,14 @@ DWORD EVERYTHINGAPI Everything_GetReplyID(void)
 // custom window proc
 static LRESULT WINAPI _Everything_window_proc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
 {
+	// Everything broadcasts EVERYTHING_IPC_CREATED to all top level windows once its IPC window is up.
+	if ((_Everything_IPCCreatedMessage) && (msg == _Everything_IPCCreatedMessage))
+	{
+		_Everything_IPCCreated = TRUE;
+		
+		return 0;
+	}
+	
 	switch(msg)
 	{
 		case WM_COPYDATA:
@@ -507,36 +916,14 @@ static LRESULT WINAPI _Everything_window_proc(HWND hwnd,UINT msg,WPARAM wParam,L
 					
 					if (_Everything_QueryVersion == 2)
 					{
-						_Everything_FreeLists();
-						
-						_Everything_List2 = _Everything_Alloc(cds->cbData);
-						
-						if (_Everything_List2)
-						{
-							CopyMemory(_Everything_List2,cds->lpData,cds->cbData);
-						}
-						else
-						{
-							_Everything_LastError = EVERYTHING_ERROR_MEMORY;
-						}
+						_Everything_SetResultList(cds->lpData,cds->cbData);
 						
 						PostQuitMessage(0);
 					}
 					else
 					if (_Everything_QueryVersion == 1)
 					{
-						_Everything_FreeLists();
-						
-						_Everything_List = _Everything_Alloc(cds->cbData);
-						
-						if (_Everything_List)
-						{
-							CopyMemory(_Everything_List,cds->lpData,cds->cbData);
-						}
-						else
-						{
-							_Everything_LastError = EVERYTHING_ERROR_MEMORY;
-						}
+						_Everything_SetResultList(cds->lpData,cds->cbData);
 						
 						PostQuitMessage(0);
 
@@ -646,7 +1033,7 @@ static DWORD EVERYTHINGAPI _Everything_query_thread_proc(void *param)
 	HWND everything_hwnd;
 
 	everything_hwnd = FindWindow(EVERYTHING_IPC_WNDCLASS,0);
-	if (everything_hwnd)
+	if ((everything_hwnd) || (_Everything_WaitForReadyEnabled))
 	{
 		WNDCLASSEX wcex;
 		HWND hwnd;
@@ -674,6 +1061,11 @@ static DWORD EVERYTHINGAPI _Everything_query_thread_proc(void *param)
 		
 //FIXME: this should be static so we keep file info cached.		
 		
+		if (_Everything_WaitForReadyEnabled)
+		{
+			_Everything_IPCCreatedMessage = RegisterWindowMessage(EVERYTHING_IPC_CREATED);
+		}
+		
 		hwnd = CreateWindow(
 			TEXT("EVERYTHING_DLL"),
 			TEXT(""),
@@ -688,12 +1080,22 @@ static DWORD EVERYTHINGAPI _Everything_query_thread_proc(void *param)
 			_Everything_ReplyWindow = hwnd;
 			_Everything_ReplyID = _EVERYTHING_COPYDATA_QUERYREPLY;
 			
-			if (_Everything_SendIPCQuery())
+			if (((!_Everything_WaitForReadyEnabled) || (_Everything_WaitForReady(TRUE))) && (_Everything_SendIPCQuery()))
 			{
 				// message pump
 loop:
 
-				WaitMessage();
+				// wait for the reply, a cancel or the deadline.
+				switch(MsgWaitForMultipleObjects(1,&_Everything_CancelEvent,FALSE,_Everything_GetRemainingTime(),QS_ALLINPUT))
+				{
+					case WAIT_OBJECT_0:
+						_Everything_LastError = EVERYTHING_ERROR_CANCELLED;
+						goto exit;
+						
+					case WAIT_TIMEOUT:
+						_Everything_LastError = EVERYTHING_ERROR_TIMEOUT;
+						goto exit;
+				}
 				
 				// update windows
 				while(PeekMessage(&msg,NULL,0,0,0)) 
@@ -723,14 +1125,15 @@ exit:
 	else
 	{
 		// the everything window was not found.
-		// we can optionally RegisterWindowMessage("EVERYTHING_IPC_CREATED") and 
-		// wait for Everything to post this message to all top level windows when its up and running.
+		// use Everything_SetWaitForReady to wait for it instead.
 		_Everything_LastError = EVERYTHING_ERROR_IPC;
 	}
 
 	return 0;
 }
 
+// the worker thread always returns by the deadline: sends are bounded by the
+// remaining time and the reply wait also wakes for Everything_CancelQuery.
 static BOOL EVERYTHINGAPI _Everything_Query(void)
 {
 	HANDLE hthread;
@@ -739,6 +1142,8 @@ static BOOL EVERYTHINGAPI _Everything_Query(void)
 	// reset the error flag.
 	_Everything_LastError = 0;
 	
+	ResetEvent(_Everything_CancelEvent);
+	
 	hthread = CreateThread(0,0,_Everything_query_thread_proc,0,0,&thread_id);
 		
 	if (hthread)
@@ -755,66 +1160,270 @@ static BOOL EVERYTHINGAPI _Everything_Query(void)
 	return (_Everything_LastError == 0)?TRUE:FALSE;
 }
 
-static BOOL _Everything_SendIPCQuery2(HWND everything_hwnd)
+// time left before the deadline of the query in progress, INFINITE if there is no timeout.
+static DWORD _Everything_GetRemainingTime(void)
 {
-	BOOL ret;
-	DWORD size;
-	EVERYTHING_IPC_QUERY2 *query;
-		
-	// try version 2.
+	DWORD elapsed;
 	
-	if (_Everything_IsUnicodeQuery)
+	if (_Everything_Timeout == INFINITE)
 	{
-		// unicode
-		size = sizeof(EVERYTHING_IPC_QUERY2) + ((_Everything_GetSearchLengthW() + 1) * sizeof(WCHAR));
+		return INFINITE;
 	}
-	else
+	
+	elapsed = GetTickCount() - _Everything_QueryStartTick;
+	
+	if (elapsed >= _Everything_Timeout)
 	{
-		// ansi
-		size = sizeof(EVERYTHING_IPC_QUERY2) + ((_Everything_GetSearchLengthA() + 1) * sizeof(char));
+		return 0;
 	}
 	
-	// alloc
-	query = _Everything_Alloc(size);
+	return _Everything_Timeout - elapsed;
+}
+
+// TRUE if Everything has loaded its database and is not busy with it.
+static BOOL _Everything_IsDBReady(HWND everything_hwnd,DWORD timeout)
+{
+	DWORD_PTR result;
 	
-	if (query)
+	if (!SendMessageTimeout(everything_hwnd,EVERYTHING_WM_IPC,EVERYTHING_IPC_IS_DB_LOADED,0,SMTO_BLOCK | SMTO_ABORTIFHUNG,timeout,&result))
 	{
-		COPYDATASTRUCT cds;
-
-		query->max_results = _Everything_Max;
-		query->offset = _Everything_Offset;
-		query->reply_copydata_message = _Everything_ReplyID;
-		query->search_flags = (_Everything_Regex?EVERYTHING_IPC_REGEX:0) | (_Everything_MatchCase?EVERYTHING_IPC_MATCHCASE:0) | (_Everything_MatchWholeWord?EVERYTHING_IPC_MATCHWHOLEWORD:0) | (_Everything_MatchPath?EVERYTHING_IPC_MATCHPATH:0);
-		query->reply_hwnd = (DWORD)(DWORD_PTR)_Everything_ReplyWindow;
-		query->sort_type = (DWORD)_Everything_Sort;
-		query->request_flags = (DWORD)_Everything_RequestFlags;
-
-		if (_Everything_IsUnicodeQuery)
-		{
-			_Everything_GetSearchTextW((LPWSTR)(query + 1));
-		}
-		else
-		{
-			_Everything_GetSearchTextA((LPSTR)(query + 1));
-		}
-
-		cds.cbData = size;
-		cds.dwData = _Everything_IsUnicodeQuery ? EVERYTHING_IPC_COPYDATA_QUERY2W : EVERYTHING_IPC_COPYDATA_QUERY2A;
-		cds.lpData = query;
+		return FALSE;
+	}
+	
+	if (!result)
+	{
+		return FALSE;
+	}
+	
+	if (!SendMessageTimeout(everything_hwnd,EVERYTHING_WM_IPC,EVERYTHING_IPC_IS_DB_BUSY,0,SMTO_BLOCK | SMTO_ABORTIFHUNG,timeout,&result))
+	{
+		return FALSE;
+	}
 	
-		if (SendMessage(everything_hwnd,WM_COPYDATA,(WPARAM)_Everything_ReplyWindow,(LPARAM)&cds))
+	return result ? FALSE : TRUE;
+}
+
+// wait for the Everything IPC window to exist and for its database to be loaded and idle.
+// polls with an exponential backoff, waking early for EVERYTHING_IPC_CREATED (when pumping messages) or Everything_CancelQuery.
+// bounded by the query timeout, or _EVERYTHING_WAIT_FOR_READY_TIMEOUT without one.
+static BOOL _Everything_WaitForReady(BOOL pump_messages)
+{
+	DWORD start_tick;
+	DWORD db_start_tick;
+	DWORD backoff;
+	BOOL found_window;
+	
+	start_tick = GetTickCount();
+	db_start_tick = start_tick;
+	backoff = _EVERYTHING_READY_MIN_BACKOFF;
+	found_window = FALSE;
+	_Everything_IPCCreated = FALSE;
+	
+	for(;;)
+	{
+		HWND everything_hwnd;
+		DWORD remaining;
+		DWORD elapsed;
+		
+		remaining = _Everything_GetRemainingTime();
+		
+		if (remaining == INFINITE)
 		{
-			// successful.
-			ret = TRUE;
+			elapsed = GetTickCount() - start_tick;
+			
+			remaining = (elapsed < _EVERYTHING_WAIT_FOR_READY_TIMEOUT) ? _EVERYTHING_WAIT_FOR_READY_TIMEOUT - elapsed : 0;
 		}
-		else
+		
+		if (!remaining)
 		{
-			// no ipc
-			_Everything_LastError = EVERYTHING_ERROR_IPC;
+			_Everything_LastError = EVERYTHING_ERROR_TIMEOUT;
 			
-			ret = FALSE;
+			break;
 		}
 		
+		_Everything_QueryStats.dwReadyPolls++;
+		
+		everything_hwnd = FindWindow(EVERYTHING_IPC_WNDCLASS,0);
+		
+		if (everything_hwnd)
+		{
+			if (!found_window)
+			{
+				found_window = TRUE;
+				db_start_tick = GetTickCount();
+				backoff = _EVERYTHING_READY_MIN_BACKOFF;
+				
+				_Everything_QueryStats.dwWaitForWindowTime = db_start_tick - start_tick;
+			}
+			
+			if (_Everything_IsDBReady(everything_hwnd,(remaining < _EVERYTHING_READY_MAX_BACKOFF) ? remaining : _EVERYTHING_READY_MAX_BACKOFF))
+			{
+				_Everything_QueryStats.dwWaitForDBTime = GetTickCount() - db_start_tick;
+				
+				return TRUE;
+			}
+		}
+		
+		if (remaining > backoff)
+		{
+			remaining = backoff;
+		}
+		
+		if (pump_messages)
+		{
+			DWORD wait;
+			
+			wait = MsgWaitForMultipleObjects(1,&_Everything_CancelEvent,FALSE,remaining,QS_ALLINPUT);
+			
+			if (wait == WAIT_OBJECT_0 + 1)
+			{
+				MSG msg;
+				
+				while(PeekMessage(&msg,NULL,0,0,PM_REMOVE)) 
+				{
+					TranslateMessage(&msg);
+					DispatchMessage(&msg);
+				}			
+			}
+			else
+			if (wait == WAIT_OBJECT_0)
+			{
+				_Everything_LastError = EVERYTHING_ERROR_CANCELLED;
+				
+				break;
+			}
+		}
+		else
+		{
+			if (WaitForSingleObject(_Everything_CancelEvent,remaining) == WAIT_OBJECT_0)
+			{
+				_Everything_LastError = EVERYTHING_ERROR_CANCELLED;
+				
+				break;
+			}
+		}
+		
+		if (_Everything_IPCCreated)
+		{
+			// poll again straight away.
+			_Everything_IPCCreated = FALSE;
+			backoff = _EVERYTHING_READY_MIN_BACKOFF;
+		}
+		else
+		if (backoff < _EVERYTHING_READY_MAX_BACKOFF)
+		{
+			backoff *= 2;
+		}
+	}
+	
+	// timed out or cancelled.
+	if (found_window)
+	{
+		_Everything_QueryStats.dwWaitForDBTime = GetTickCount() - db_start_tick;
+	}
+	else
+	{
+		_Everything_QueryStats.dwWaitForWindowTime = GetTickCount() - start_tick;
+	}
+	
+	return FALSE;
+}
+
+// send a query to the Everything window.
+// the send is bounded by the query deadline so a hung Everything cannot block the caller.
+static BOOL _Everything_SendQueryCopyData(HWND everything_hwnd,COPYDATASTRUCT *cds)
+{
+	DWORD remaining;
+	DWORD_PTR result;
+	
+	remaining = _Everything_GetRemainingTime();
+	
+	if (remaining == INFINITE)
+	{
+		if (SendMessage(everything_hwnd,WM_COPYDATA,(WPARAM)_Everything_ReplyWindow,(LPARAM)cds))
+		{
+			_Everything_QueryStats.dwQueryVersion = _Everything_QueryVersion;
+			InterlockedIncrement(&_Everything_SentCount);
+			
+			return TRUE;
+		}
+	}
+	else
+	{
+		if (SendMessageTimeout(everything_hwnd,WM_COPYDATA,(WPARAM)_Everything_ReplyWindow,(LPARAM)cds,SMTO_BLOCK | SMTO_ABORTIFHUNG,remaining ? remaining : 1,&result))
+		{
+			if (result)
+			{
+				_Everything_QueryStats.dwQueryVersion = _Everything_QueryVersion;
+				InterlockedIncrement(&_Everything_SentCount);
+				
+				return TRUE;
+			}
+		}
+		else
+		if (GetLastError() == ERROR_TIMEOUT)
+		{
+			_Everything_LastError = EVERYTHING_ERROR_TIMEOUT;
+			
+			return FALSE;
+		}
+	}
+	
+	// no ipc
+	_Everything_LastError = EVERYTHING_ERROR_IPC;
+	
+	return FALSE;
+}
+
+static BOOL _Everything_SendIPCQuery2(HWND everything_hwnd)
+{
+	BOOL ret;
+	DWORD size;
+	EVERYTHING_IPC_QUERY2 *query;
+		
+	// try version 2.
+	
+	if (_Everything_IsUnicodeQuery)
+	{
+		// unicode
+		size = sizeof(EVERYTHING_IPC_QUERY2) + ((_Everything_GetSearchLengthW() + 1) * sizeof(WCHAR));
+	}
+	else
+	{
+		// ansi
+		size = sizeof(EVERYTHING_IPC_QUERY2) + ((_Everything_GetSearchLengthA() + 1) * sizeof(char));
+	}
+	
+	// alloc
+	query = _Everything_Alloc(size);
+	
+	if (query)
+	{
+		COPYDATASTRUCT cds;
+
+		query->max_results = _Everything_Max;
+		query->offset = _Everything_Offset;
+		query->reply_copydata_message = _Everything_ReplyID;
+		query->search_flags = (_Everything_Regex?EVERYTHING_IPC_REGEX:0) | (_Everything_MatchCase?EVERYTHING_IPC_MATCHCASE:0) | (_Everything_MatchWholeWord?EVERYTHING_IPC_MATCHWHOLEWORD:0) | (_Everything_MatchPath?EVERYTHING_IPC_MATCHPATH:0);
+		query->reply_hwnd = (DWORD)(DWORD_PTR)_Everything_ReplyWindow;
+		query->sort_type = (DWORD)_Everything_Sort;
+		query->request_flags = (DWORD)_Everything_RequestFlags;
+
+		if (_Everything_IsUnicodeQuery)
+		{
+			_Everything_GetSearchTextW((LPWSTR)(query + 1));
+		}
+		else
+		{
+			_Everything_GetSearchTextA((LPSTR)(query + 1));
+		}
+
+		cds.cbData = size;
+		cds.dwData = _Everything_IsUnicodeQuery ? EVERYTHING_IPC_COPYDATA_QUERY2W : EVERYTHING_IPC_COPYDATA_QUERY2A;
+		cds.lpData = query;
+	
+		ret = _Everything_SendQueryCopyData(everything_hwnd,&cds);
+		
 		// get result from window.
 		_Everything_Free(query);
 	}
@@ -853,20 +1462,48 @@ static BOOL _Everything_SendIPCQuery(void)
 	everything_hwnd = FindWindow(EVERYTHING_IPC_WNDCLASS,0);
 	if (everything_hwnd)
 	{
+		_EVERYTHING_CAPABILITIES *capabilities;
+		BOOL use_query2;
+		
+		capabilities = _Everything_GetCapabilities(everything_hwnd);
+		
+		if (!capabilities->got_version)
+		{
+			_Everything_ReadVersion(capabilities);
+		}
+		
 		_Everything_QueryVersion = 2;
 		
-		// try version 2 first (if we specified some non-version 1 request flags or sort)
-		if ((_Everything_ShouldUseVersion2()) && (_Everything_SendIPCQuery2(everything_hwnd)))
+		// use version 2 if we specified some non-version 1 request flags or sort, and Everything is not known to lack it.
+		use_query2 = ((_Everything_ShouldUseVersion2()) && (capabilities->query2 != _EVERYTHING_CAPABILITY_NO));
+		
+		if ((use_query2) && (_Everything_SendIPCQuery2(everything_hwnd)))
 		{
 			// sucessful.
+			capabilities->query2 = _EVERYTHING_CAPABILITY_YES;
+			
 			ret = TRUE;		
 		}
 		else
+		if (!_Everything_GetRemainingTime())
+		{
+			// no time left to fall back to version 1.
+			_Everything_LastError = EVERYTHING_ERROR_TIMEOUT;
+			
+			ret = FALSE;
+		}
+		else
 		{
 			DWORD len;
 			DWORD size;
 			void *query;
 
+			// without a version, a rejected version 2 query means Everything does not have it, so only ever send version 1 to it.
+			if ((use_query2) && (capabilities->query2 == _EVERYTHING_CAPABILITY_UNKNOWN) && (_Everything_LastError == EVERYTHING_ERROR_IPC))
+			{
+				capabilities->query2 = _EVERYTHING_CAPABILITY_NO;
+			}
+			
 			// try version 1.		
 			
 			if (_Everything_IsUnicodeQuery)
@@ -918,18 +1555,7 @@ static BOOL _Everything_SendIPCQuery(void)
 			
 				_Everything_QueryVersion = 1;
 				
-				if (SendMessage(everything_hwnd,WM_COPYDATA,(WPARAM)_Everything_ReplyWindow,(LPARAM)&cds))
-				{
-					// sucessful.
-					ret = TRUE;
-				}
-				else
-				{
-					// no ipc
-					_Everything_LastError = EVERYTHING_ERROR_IPC;
-					
-					ret = FALSE;
-				}
+				ret = _Everything_SendQueryCopyData(everything_hwnd,&cds);
 				
 				// get result from window.
 				_Everything_Free(query);
@@ -952,555 +1578,2779 @@ static BOOL _Everything_SendIPCQuery(void)
 	return ret;
 }
 
-BOOL EVERYTHINGAPI Everything_QueryA(BOOL bWait)
+// start the query timeout and stats, then run the query on a worker thread or send it from this thread.
+static BOOL _Everything_ExecuteQuery(BOOL bWait)
 {
 	BOOL ret;
 	
-	_Everything_Lock();
-
-	_Everything_IsUnicodeQuery = FALSE;
+	_Everything_QueryStartTick = GetTickCount();
 	
-	if (bWait)	
+	ZeroMemory(&_Everything_QueryStats,sizeof(EVERYTHING_QUERYSTATS));
+	_Everything_QueryStats.cbSize = sizeof(EVERYTHING_QUERYSTATS);
+	
+	if ((bWait) && (_Everything_QueryCacheMax))
 	{
-		ret = _Everything_Query();
+		ret = _Everything_CachedQuery();
 	}
 	else
-	{
-		ret = _Everything_SendIPCQuery();
-	}
-
-	_Everything_Unlock();
-	
-	return ret;
-}
-
-BOOL EVERYTHINGAPI Everything_QueryW(BOOL bWait)
-{
-	BOOL ret;
-	
-	_Everything_Lock();
-	
-	_Everything_IsUnicodeQuery = TRUE;
-	
 	if (bWait)	
 	{
 		ret = _Everything_Query();
 	}
 	else
+	if (_Everything_WaitForReadyEnabled)
+	{
+		// the reply window belongs to the caller, so poll without pumping its messages.
+		ResetEvent(_Everything_CancelEvent);
+		
+		ret = ((_Everything_WaitForReady(FALSE)) && (_Everything_SendIPCQuery()));
+	}
+	else
 	{
 		ret = _Everything_SendIPCQuery();
 	}
-
-	_Everything_Unlock();
+	
+	_Everything_QueryStats.dwQueryTime = GetTickCount() - _Everything_QueryStartTick;
+	_Everything_QueryStats.dwLastError = ret ? EVERYTHING_OK : _Everything_LastError;
 	
 	return ret;
 }
 
-static int __cdecl _Everything_CompareA(const void *a,const void *b)
+// answer the query from the cache, or run it and cache the results.
+// results are only cached while the index is unchanged since the other cached results were received.
+static BOOL _Everything_CachedQuery(void)
 {
-	int i;
-	
-	i = stricmp(EVERYTHING_IPC_ITEMPATHA(_Everything_List,a),EVERYTHING_IPC_ITEMPATHA(_Everything_List,b));
+	_EVERYTHING_QUERY_CACHE_ENTRY *entry;
+	_EVERYTHING_QUERY_CACHE_ENTRY *found;
+	_EVERYTHING_INDEX_STAMP stamp;
+	BOOL can_cache;
+	BOOL ret;
 	
-	if (!i)
-	{
-		return stricmp(EVERYTHING_IPC_ITEMFILENAMEA(_Everything_List,a),EVERYTHING_IPC_ITEMFILENAMEA(_Everything_List,b));
-	}
-	else
-	if (i > 0)
+	entry = _Everything_CreateQueryCacheEntry();
+	if (!entry)
 	{
-		return 1;
+		return _Everything_Query();
 	}
-	else
+	
+	found = _Everything_FindQueryCacheEntry(entry);
+	if (found)
 	{
-		return -1;
+		_Everything_Free(entry);
+		
+		_Everything_FreeLists();
+		
+		_Everything_AddRefSnapshot(found->snapshot);
+		_Everything_SetCurrentSnapshot(found->snapshot);
+		
+		_Everything_LastError = 0;
+		_Everything_QueryStats.bFromCache = TRUE;
+		InterlockedIncrement(&_Everything_CacheHitCount);
+		
+		return TRUE;
 	}
-}
-
-static int __cdecl _Everything_CompareW(const void *a,const void *b)
-{
-	int i;
 	
-	i = wcsicmp(EVERYTHING_IPC_ITEMPATHW(_Everything_List,a),EVERYTHING_IPC_ITEMPATHW(_Everything_List,b));
+	// the probe is one result, much cheaper than the query it guards.
+	can_cache = _Everything_ProbeIndexStamp(&stamp);
 	
-	if (!i)
-	{
-		return wcsicmp(EVERYTHING_IPC_ITEMFILENAMEW(_Everything_List,a),EVERYTHING_IPC_ITEMFILENAMEW(_Everything_List,b));
-	}
-	else
-	if (i > 0)
-	{
-		return 1;
-	}
-	else
+	if ((!can_cache) || (!_Everything_QueryCacheHasStamp) || (stamp.totitems != _Everything_QueryCacheStamp.totitems) || (CompareFileTime(&stamp.date_recently_changed,&_Everything_QueryCacheStamp.date_recently_changed) != 0))
 	{
-		return -1;
+		_Everything_TrimQueryCache(0);
+		
+		_Everything_QueryCacheHasStamp = can_cache;
+		_Everything_QueryCacheStamp = stamp;
 	}
-}
-
-void EVERYTHINGAPI Everything_SortResultsByPath(void)
-{
-	_Everything_Lock();
 	
-	if (_Everything_List)
+	ret = _Everything_Query();
+	
+	if ((ret) && (can_cache) && (_Everything_Snapshot))
 	{
-		if (_Everything_IsUnicodeQuery)
+		_Everything_AddRefSnapshot(_Everything_Snapshot);
+		
+		entry->snapshot = _Everything_Snapshot;
+		entry->tick = GetTickCount();
+		
+		entry->prev = NULL;
+		entry->next = _Everything_QueryCacheHead;
+		
+		if (_Everything_QueryCacheHead)
 		{
-			qsort(((EVERYTHING_IPC_LISTW *)_Everything_List)->items,((EVERYTHING_IPC_LISTW *)_Everything_List)->numitems,sizeof(EVERYTHING_IPC_ITEMW),_Everything_CompareW);
+			_Everything_QueryCacheHead->prev = entry;
 		}
 		else
 		{
-			qsort(((EVERYTHING_IPC_LISTA *)_Everything_List)->items,((EVERYTHING_IPC_LISTA *)_Everything_List)->numitems,sizeof(EVERYTHING_IPC_ITEMA),_Everything_CompareA);
+			_Everything_QueryCacheTail = entry;
 		}
+		
+		_Everything_QueryCacheHead = entry;
+		_Everything_QueryCacheCount++;
+		
+		_Everything_TrimQueryCache(_Everything_QueryCacheMax);
 	}
 	else
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+		_Everything_Free(entry);
 	}
 	
-//FIXME://TODO: sort list2
-
-	_Everything_Unlock();
+	return ret;
 }
 
-DWORD EVERYTHINGAPI Everything_GetLastError(void)
+// build the cache key for the current query state.
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_CreateQueryCacheEntry(void)
 {
-	DWORD ret;
-		
-	_Everything_Lock();
-	
-	ret = _Everything_LastError;
-
-	_Everything_Unlock();
-	
-	return ret;
+	return _Everything_CreateQueryKey(_Everything_Search,_Everything_IsUnicodeSearch,_Everything_IsUnicodeQuery,(_Everything_Regex?EVERYTHING_IPC_REGEX:0) | (_Everything_MatchCase?EVERYTHING_IPC_MATCHCASE:0) | (_Everything_MatchWholeWord?EVERYTHING_IPC_MATCHWHOLEWORD:0) | (_Everything_MatchPath?EVERYTHING_IPC_MATCHPATH:0),_Everything_Sort,_Everything_RequestFlags,_Everything_Offset,_Everything_Max);
 }
 
-DWORD EVERYTHINGAPI Everything_GetNumFileResults(void)
+// build a query key, the search text is kept as WCHARs.
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_CreateQueryKey(const void *search,BOOL is_unicode_search,BOOL is_unicode,DWORD search_flags,DWORD sort,DWORD request_flags,DWORD offset,DWORD max)
 {
-	DWORD ret;
+	_EVERYTHING_QUERY_CACHE_ENTRY *entry;
+	DWORD search_len;
+	DWORD hash;
+	WCHAR *p;
+	DWORD i;
 	
-	_Everything_Lock();
-
-	if (_Everything_List)
+	search_len = 0;
+	
+	if (search)
 	{
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode_search)
 		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numfiles;
+			search_len = _Everything_StringLengthW((LPCWSTR)search);
 		}
 		else
 		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numfiles;
+			search_len = MultiByteToWideChar(CP_ACP,0,(LPCSTR)search,-1,0,0);
+			
+			if (search_len)
+			{
+				// without the null terminator.
+				search_len--;
+			}
 		}
 	}
-	else
+	
+	entry = _Everything_Alloc(sizeof(_EVERYTHING_QUERY_CACHE_ENTRY) + ((search_len + 1) * sizeof(WCHAR)));
+	if (!entry)
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = 0;
+		return NULL;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
-}
-
-DWORD EVERYTHINGAPI Everything_GetNumFolderResults(void)
-{
-	DWORD ret;
-
-	_Everything_Lock();
-
-	if (_Everything_List)
+	entry->next = NULL;
+	entry->prev = NULL;
+	entry->is_unicode = is_unicode;
+	entry->search_flags = search_flags;
+	entry->sort = sort;
+	entry->request_flags = request_flags;
+	entry->offset = offset;
+	entry->max = max;
+	entry->search_len = search_len;
+	entry->tick = 0;
+	entry->snapshot = NULL;
+	
+	p = (WCHAR *)(entry + 1);
+	
+	if (search_len)
 	{
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode_search)
 		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numfolders;
+			CopyMemory(p,search,search_len * sizeof(WCHAR));
 		}
 		else
 		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numfolders;
+			MultiByteToWideChar(CP_ACP,0,(LPCSTR)search,-1,p,search_len + 1);
 		}
 	}
-	else
+	
+	p[search_len] = 0;
+	
+	// FNV-1a
+	hash = 2166136261U;
+	hash = (hash ^ entry->is_unicode) * 16777619U;
+	hash = (hash ^ entry->search_flags) * 16777619U;
+	hash = (hash ^ entry->sort) * 16777619U;
+	hash = (hash ^ entry->request_flags) * 16777619U;
+	hash = (hash ^ entry->offset) * 16777619U;
+	hash = (hash ^ entry->max) * 16777619U;
+	
+	for(i=0;i<search_len;i++)
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = 0;
+		hash = (hash ^ p[i]) * 16777619U;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
+	entry->hash = hash;
+	
+	return entry;
 }
 
-DWORD EVERYTHINGAPI Everything_GetNumResults(void)
+static BOOL _Everything_IsSameQueryCacheKey(const _EVERYTHING_QUERY_CACHE_ENTRY *a,const _EVERYTHING_QUERY_CACHE_ENTRY *b)
 {
-	DWORD ret;
+	const WCHAR *a_search;
+	const WCHAR *b_search;
+	DWORD i;
 	
-	_Everything_Lock();
+	if ((a->hash != b->hash) || (a->is_unicode != b->is_unicode) || (a->search_flags != b->search_flags) || (a->sort != b->sort) || (a->request_flags != b->request_flags) || (a->offset != b->offset) || (a->max != b->max) || (a->search_len != b->search_len))
+	{
+		return FALSE;
+	}
+	
+	a_search = (const WCHAR *)(a + 1);
+	b_search = (const WCHAR *)(b + 1);
+	
+	for(i=0;i<a->search_len;i++)
+	{
+		if (a_search[i] != b_search[i])
+		{
+			return FALSE;
+		}
+	}
+	
+	return TRUE;
+}
 
-	if (_Everything_List)
+// find an unexpired entry with the same key and make it the most recently used.
+// expired entries are removed as they are passed.
+static _EVERYTHING_QUERY_CACHE_ENTRY *_Everything_FindQueryCacheEntry(const _EVERYTHING_QUERY_CACHE_ENTRY *key)
+{
+	_EVERYTHING_QUERY_CACHE_ENTRY *entry;
+	DWORD now;
+	
+	now = GetTickCount();
+	entry = _Everything_QueryCacheHead;
+	
+	while(entry)
 	{
-		if (_Everything_IsUnicodeQuery)
+		_EVERYTHING_QUERY_CACHE_ENTRY *next;
+		
+		next = entry->next;
+		
+		if (now - entry->tick >= _Everything_QueryCacheTTL)
 		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numitems;
+			_Everything_RemoveQueryCacheEntry(entry);
 		}
 		else
+		if (_Everything_IsSameQueryCacheKey(entry,key))
 		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numitems;
+			if (entry->prev)
+			{
+				// unlink
+				entry->prev->next = entry->next;
+				
+				if (entry->next)
+				{
+					entry->next->prev = entry->prev;
+				}
+				else
+				{
+					_Everything_QueryCacheTail = entry->prev;
+				}
+				
+				// insert at the head.
+				entry->prev = NULL;
+				entry->next = _Everything_QueryCacheHead;
+				_Everything_QueryCacheHead->prev = entry;
+				_Everything_QueryCacheHead = entry;
+			}
+			
+			return entry;
 		}
+		
+		entry = next;
+	}
+	
+	return NULL;
+}
+
+static void _Everything_RemoveQueryCacheEntry(_EVERYTHING_QUERY_CACHE_ENTRY *entry)
+{
+	if (entry->prev)
+	{
+		entry->prev->next = entry->next;
 	}
 	else
-	if (_Everything_List2)
 	{
-		ret = _Everything_List2->numitems;
+		_Everything_QueryCacheHead = entry->next;
+	}
+	
+	if (entry->next)
+	{
+		entry->next->prev = entry->prev;
 	}
 	else
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = 0;
+		_Everything_QueryCacheTail = entry->prev;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
+	_Everything_QueryCacheCount--;
+	
+	// callers may still hold the snapshot.
+	_Everything_ReleaseSnapshot(entry->snapshot);
+	_Everything_Free(entry);
 }
 
-DWORD EVERYTHINGAPI Everything_GetTotFileResults(void)
+// drop the least recently used entries until there are at most max_entries.
+static void _Everything_TrimQueryCache(DWORD max_entries)
 {
-	DWORD ret;
+	while(_Everything_QueryCacheCount > max_entries)
+	{
+		_Everything_RemoveQueryCacheEntry(_Everything_QueryCacheTail);
+	}
+}
 
-	_Everything_Lock();
+// query the most recently changed file, leaving the current results and query state untouched.
+// fails if Everything does not support version 2 queries.
+static BOOL _Everything_ProbeIndexStamp(_EVERYTHING_INDEX_STAMP *stamp)
+{
+	_EVERYTHING_QUERY_STATE state;
+	BOOL ret;
 	
-	if (_Everything_List)
+	ZeroMemory(stamp,sizeof(_EVERYTHING_INDEX_STAMP));
+	
+	_Everything_SaveQueryState(&state);
+	
+	_Everything_Search = NULL;
+	_Everything_MatchPath = FALSE;
+	_Everything_MatchCase = FALSE;
+	_Everything_MatchWholeWord = FALSE;
+	_Everything_Regex = FALSE;
+	_Everything_Max = 1;
+	_Everything_Offset = 0;
+	_Everything_Sort = EVERYTHING_SORT_DATE_RECENTLY_CHANGED_DESCENDING;
+	_Everything_RequestFlags = EVERYTHING_REQUEST_DATE_RECENTLY_CHANGED;
+	
+	ret = FALSE;
+	
+	if (_Everything_Query())
 	{
-		if (_Everything_IsUnicodeQuery)
-		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totfiles;
-		}
-		else
+		if (_Everything_List2)
 		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totfiles;
+			stamp->totitems = _Everything_List2->totitems;
+			
+			if (_Everything_List2->numitems)
+			{
+				FILETIME *date_recently_changed;
+				
+				date_recently_changed = _Everything_GetListRequestData(_Everything_List2,_Everything_IsUnicodeQuery,0,EVERYTHING_REQUEST_DATE_RECENTLY_CHANGED);
+				
+				if (date_recently_changed)
+				{
+					CopyMemory(&stamp->date_recently_changed,date_recently_changed,sizeof(FILETIME));
+				}
+			}
+			
+			ret = TRUE;
 		}
 	}
-	else
-	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = 0;
-	}
-
-	_Everything_Unlock();
+	
+	_Everything_RestoreQueryState(&state);
 	
 	return ret;
 }
 
-DWORD EVERYTHINGAPI Everything_GetTotFolderResults(void)
+// save the query settings and take the current results aside, so an internal query can use them.
+static void _Everything_SaveQueryState(_EVERYTHING_QUERY_STATE *state)
 {
-	DWORD ret;
-
-	_Everything_Lock();
+	state->snapshot = _Everything_Snapshot;
+	state->search = _Everything_Search;
+	state->is_unicode_search = _Everything_IsUnicodeSearch;
+	state->is_unicode_query = _Everything_IsUnicodeQuery;
+	state->match_path = _Everything_MatchPath;
+	state->match_case = _Everything_MatchCase;
+	state->match_whole_word = _Everything_MatchWholeWord;
+	state->regex = _Everything_Regex;
+	state->max = _Everything_Max;
+	state->offset = _Everything_Offset;
+	state->sort = _Everything_Sort;
+	state->request_flags = _Everything_RequestFlags;
+	state->timeout = _Everything_Timeout;
+	state->query_version = _Everything_QueryVersion;
+	
+	// the internal reply must not release the current results.
+	_Everything_Snapshot = NULL;
+	_Everything_List = NULL;
+	_Everything_List2 = NULL;
+}
 
-	if (_Everything_List)
+// release the results of the internal query and put back the saved state.
+static void _Everything_RestoreQueryState(const _EVERYTHING_QUERY_STATE *state)
+{
+	_Everything_FreeLists();
+	
+	if (state->snapshot)
 	{
-		if (_Everything_IsUnicodeQuery)
-		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totfolders;
-		}
-		else
-		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totfolders;
-		}
+		_Everything_SetCurrentSnapshot(state->snapshot);
 	}
-	else
-	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+	
+	_Everything_Search = state->search;
+	_Everything_IsUnicodeSearch = state->is_unicode_search;
+	_Everything_IsUnicodeQuery = state->is_unicode_query;
+	_Everything_MatchPath = state->match_path;
+	_Everything_MatchCase = state->match_case;
+	_Everything_MatchWholeWord = state->match_whole_word;
+	_Everything_Regex = state->regex;
+	_Everything_Max = state->max;
+	_Everything_Offset = state->offset;
+	_Everything_Sort = state->sort;
+	_Everything_RequestFlags = state->request_flags;
+	_Everything_Timeout = state->timeout;
+	_Everything_QueryVersion = state->query_version;
+}
 
-		ret = 0;
+// the capabilities of the Everything window, forgotten when the window changes.
+static _EVERYTHING_CAPABILITIES *_Everything_GetCapabilities(HWND everything_hwnd)
+{
+	if (_Everything_Capabilities.everything_hwnd != everything_hwnd)
+	{
+		ZeroMemory(&_Everything_Capabilities,sizeof(_EVERYTHING_CAPABILITIES));
+		
+		_Everything_Capabilities.everything_hwnd = everything_hwnd;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
+	return &_Everything_Capabilities;
 }
 
-DWORD EVERYTHINGAPI Everything_GetTotResults(void)
+// read the Everything version and decide if it takes version 2 queries.
+// left unknown if Everything does not answer in time, the next query tries again.
+static void _Everything_ReadVersion(_EVERYTHING_CAPABILITIES *capabilities)
 {
-	DWORD ret;
+	DWORD_PTR major_version;
+	DWORD_PTR minor_version;
+	DWORD_PTR revision;
 	
-	_Everything_Lock();
-
-	if (_Everything_List)
+	if (!_Everything_SendIPCCommand(capabilities->everything_hwnd,EVERYTHING_IPC_GET_MAJOR_VERSION,0,&major_version))
 	{
-		if (_Everything_IsUnicodeQuery)
-		{
-			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totitems;
-		}
-		else
-		{
-			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totitems;
-		}
+		return;
 	}
-	else
-	if (_Everything_List2)
+	
+	if (!_Everything_SendIPCCommand(capabilities->everything_hwnd,EVERYTHING_IPC_GET_MINOR_VERSION,0,&minor_version))
 	{
-		ret = _Everything_List2->totitems;
+		return;
 	}
-	else
+	
+	if (!_Everything_SendIPCCommand(capabilities->everything_hwnd,EVERYTHING_IPC_GET_REVISION,0,&revision))
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = 0;
+		return;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
-}
-
-BOOL EVERYTHINGAPI Everything_IsVolumeResult(DWORD dwIndex)
-{
-	BOOL ret;
+	capabilities->got_version = TRUE;
+	capabilities->major_version = (DWORD)major_version;
+	capabilities->minor_version = (DWORD)minor_version;
+	capabilities->revision = (DWORD)revision;
 	
-	_Everything_Lock();
-
-	if (_Everything_List)
+	if (!major_version)
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			if (_Everything_IsUnicodeQuery)
-			{
-				ret = (((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
-			}
-			else
-			{
-				ret = (((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
-			}
-		}
-		else
-		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
-		}
+		// no version, find out with the first version 2 query.
+		capabilities->query2 = _EVERYTHING_CAPABILITY_UNKNOWN;
 	}
 	else
-	if (_Everything_List2)
+	if ((major_version > 1) || ((major_version == 1) && ((minor_version > 4) || ((minor_version == 4) && (revision >= 1)))))
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
-		}
-		else
-		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
-		}
+		capabilities->query2 = _EVERYTHING_CAPABILITY_YES;
 	}
 	else
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+		capabilities->query2 = _EVERYTHING_CAPABILITY_NO;
+	}
+}
 
-		ret = FALSE;
+// send an EVERYTHING_WM_IPC command, bounded by the query deadline.
+static BOOL _Everything_SendIPCCommand(HWND everything_hwnd,int command,LPARAM lParam,DWORD_PTR *result)
+{
+	DWORD remaining;
+	
+	remaining = _Everything_GetRemainingTime();
+	
+	if (remaining == INFINITE)
+	{
+		*result = (DWORD_PTR)SendMessage(everything_hwnd,EVERYTHING_WM_IPC,command,lParam);
+		
+		return TRUE;
 	}
 	
-	_Everything_Unlock();
+	return SendMessageTimeout(everything_hwnd,EVERYTHING_WM_IPC,command,lParam,SMTO_BLOCK | SMTO_ABORTIFHUNG,remaining ? remaining : 1,result) ? TRUE : FALSE;
+}
 
-	return ret;	
+BOOL EVERYTHINGAPI Everything_QueryA(BOOL bWait)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+
+	_Everything_IsUnicodeQuery = FALSE;
+	
+	InterlockedIncrement(&_Everything_QueryCount);
+	
+	ret = _Everything_ExecuteQuery(bWait);
+
+	_Everything_Unlock();
+	
+	return ret;
 }
 
-BOOL EVERYTHINGAPI Everything_IsFolderResult(DWORD dwIndex)
+BOOL EVERYTHINGAPI Everything_QueryW(BOOL bWait)
 {
 	BOOL ret;
 	
 	_Everything_Lock();
+	
+	_Everything_IsUnicodeQuery = TRUE;
+	
+	InterlockedIncrement(&_Everything_QueryCount);
+	
+	ret = _Everything_ExecuteQuery(bWait);
 
-	if (_Everything_List)
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+// cancel the query in progress on another thread.
+// does not take the lock, which the querying thread holds until its query completes.
+// returns FALSE if the client is not initialized.
+BOOL EVERYTHINGAPI Everything_CancelQuery(void)
+{
+	if ((_Everything_Initialized) && (_Everything_CancelEvent))
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			if (_Everything_IsUnicodeQuery)
-			{
-				ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER) ? TRUE : FALSE;
-			}
+		return SetEvent(_Everything_CancelEvent);
+	}
+	
+	return FALSE;
+}
+
+// run a query without touching the search state or current results, the results are returned as a snapshot.
+// an identical query already in progress on another thread is waited for instead of sending another one.
+// safe to call from many threads, returns EVERYTHING_OK or an EVERYTHING_ERROR_* code.
+DWORD EVERYTHINGAPI Everything_QueryExW(const EVERYTHING_QUERYEXW *lpQuery,EVERYTHING_SNAPSHOT *lphSnapshot)
+{
+	return _Everything_QueryEx((const _EVERYTHING_QUERYEX *)lpQuery,TRUE,lphSnapshot);
+}
+
+DWORD EVERYTHINGAPI Everything_QueryExA(const EVERYTHING_QUERYEXA *lpQuery,EVERYTHING_SNAPSHOT *lphSnapshot)
+{
+	return _Everything_QueryEx((const _EVERYTHING_QUERYEX *)lpQuery,FALSE,lphSnapshot);
+}
+
+static DWORD _Everything_QueryEx(const _EVERYTHING_QUERYEX *query,BOOL is_unicode,EVERYTHING_SNAPSHOT *lphSnapshot)
+{
+	_EVERYTHING_QUERY_CACHE_ENTRY *key;
+	_EVERYTHING_QUERY_FLIGHT *flight;
+	_EVERYTHING_QUERY_STATE state;
+	_EVERYTHING_SNAPSHOT *snapshot;
+	HANDLE cancel_event;
+	DWORD start_tick;
+	DWORD error;
+	
+	if ((!query) || (!lphSnapshot) || (query->cbSize < _EVERYTHING_QUERYEX_SIZE_V1))
+	{
+		return EVERYTHING_ERROR_INVALIDPARAMETER;
+	}
+	
+	*lphSnapshot = NULL;
+	start_tick = GetTickCount();
+	cancel_event = (query->cbSize >= sizeof(_EVERYTHING_QUERYEX)) ? query->cancel_event : NULL;
+	
+	_Everything_Initialize();
+	
+	InterlockedIncrement(&_Everything_QueryCount);
+	
+lookup:
+
+	key = _Everything_CreateQueryKey(query->search,is_unicode,is_unicode,(query->regex?EVERYTHING_IPC_REGEX:0) | (query->match_case?EVERYTHING_IPC_MATCHCASE:0) | (query->match_whole_word?EVERYTHING_IPC_MATCHWHOLEWORD:0) | (query->match_path?EVERYTHING_IPC_MATCHPATH:0),query->sort,query->request_flags,query->offset,query->max);
+	if (!key)
+	{
+		return EVERYTHING_ERROR_MEMORY;
+	}
+	
+	EnterCriticalSection(&_Everything_FlightCS);
+	
+	flight = _Everything_FlightList;
+	
+	while(flight)
+	{
+		if (_Everything_IsSameQueryCacheKey(flight->key,key))
+		{
+			break;
+		}
+		
+		flight = flight->next;
+	}
+	
+	if (flight)
+	{
+		DWORD elapsed;
+		DWORD wait;
+		BOOL is_leader_stopped;
+		
+		// follow.
+		flight->ref_count++;
+		
+		LeaveCriticalSection(&_Everything_FlightCS);
+		
+		_Everything_Free(key);
+		
+		InterlockedIncrement(&_Everything_CoalescedCount);
+		
+		is_leader_stopped = FALSE;
+		wait = query->timeout;
+		
+		if (wait != INFINITE)
+		{
+			elapsed = GetTickCount() - start_tick;
+			
+			wait = (elapsed < wait) ? wait - elapsed : 0;
+		}
+		
+		{
+			HANDLE handles[2];
+			
+			handles[0] = flight->done_event;
+			handles[1] = cancel_event;
+			
+			switch(WaitForMultipleObjects(cancel_event ? 2 : 1,handles,FALSE,wait))
+			{
+				case WAIT_OBJECT_0:
+				
+					error = flight->error;
+					is_leader_stopped = ((error == EVERYTHING_ERROR_CANCELLED) || (error == EVERYTHING_ERROR_TIMEOUT));
+					
+					if (flight->snapshot)
+					{
+						_Everything_AddRefSnapshot(flight->snapshot);
+						
+						*lphSnapshot = flight->snapshot;
+					}
+					
+					break;
+					
+				case WAIT_OBJECT_0 + 1:
+					error = EVERYTHING_ERROR_CANCELLED;
+					break;
+					
+				default:
+					error = EVERYTHING_ERROR_TIMEOUT;
+					break;
+			}
+		}
+		
+		_Everything_ReleaseQueryFlight(flight);
+		
+		// the leader's own cancel event or shorter timeout stopped it, not ours.
+		// look again with the time left, leading a new flight if there is none.
+		if (is_leader_stopped)
+		{
+			if ((cancel_event) && (WaitForSingleObject(cancel_event,0) == WAIT_OBJECT_0))
+			{
+				return EVERYTHING_ERROR_CANCELLED;
+			}
+			
+			if ((query->timeout != INFINITE) && (GetTickCount() - start_tick >= query->timeout))
+			{
+				return EVERYTHING_ERROR_TIMEOUT;
+			}
+			
+			goto lookup;
+		}
+		
+		return error;
+	}
+	
+	flight = _Everything_Alloc(sizeof(_EVERYTHING_QUERY_FLIGHT));
+	if (flight)
+	{
+		flight->done_event = CreateEvent(0,TRUE,FALSE,0);
+		
+		if (!flight->done_event)
+		{
+			_Everything_Free(flight);
+			
+			flight = NULL;
+		}
+	}
+	
+	if (!flight)
+	{
+		LeaveCriticalSection(&_Everything_FlightCS);
+		
+		_Everything_Free(key);
+		
+		return EVERYTHING_ERROR_MEMORY;
+	}
+	
+	flight->key = key;
+	flight->ref_count = 1;
+	flight->error = 0;
+	flight->snapshot = NULL;
+	flight->next = _Everything_FlightList;
+	_Everything_FlightList = flight;
+	
+	LeaveCriticalSection(&_Everything_FlightCS);
+	
+	// lead.
+	snapshot = NULL;
+	
+	if (_Everything_SendQueryEx(query,is_unicode,cancel_event,start_tick,&error,&snapshot))
+	{
+		goto publish;
+	}
+	
+	_Everything_Lock();
+	
+	if ((cancel_event) && (WaitForSingleObject(cancel_event,0) == WAIT_OBJECT_0))
+	{
+		// cancelled while waiting for the lock.
+		_Everything_Unlock();
+		
+		error = EVERYTHING_ERROR_CANCELLED;
+		
+		goto publish;
+	}
+	
+	_Everything_SaveQueryState(&state);
+	
+	_Everything_Search = (void *)query->search;
+	_Everything_IsUnicodeSearch = is_unicode;
+	_Everything_IsUnicodeQuery = is_unicode;
+	_Everything_MatchPath = query->match_path;
+	_Everything_MatchCase = query->match_case;
+	_Everything_MatchWholeWord = query->match_whole_word;
+	_Everything_Regex = query->regex;
+	_Everything_Sort = query->sort;
+	_Everything_RequestFlags = query->request_flags;
+	_Everything_Offset = query->offset;
+	_Everything_Max = query->max;
+	_Everything_Timeout = query->timeout;
+	
+	// a follower that took over from a stopped leader only has what is left of its timeout.
+	if (query->timeout != INFINITE)
+	{
+		DWORD elapsed;
+		
+		elapsed = GetTickCount() - start_tick;
+		
+		_Everything_Timeout = (elapsed < query->timeout) ? query->timeout - elapsed : 0;
+	}
+	
+	if (_Everything_ExecuteQuery(TRUE))
+	{
+		error = EVERYTHING_OK;
+		
+		snapshot = _Everything_Snapshot;
+		
+		if (snapshot)
+		{
+			_Everything_AddRefSnapshot(snapshot);
+		}
+		else
+		{
+			error = EVERYTHING_ERROR_IPC;
+		}
+	}
+	else
+	{
+		error = _Everything_LastError;
+	}
+	
+	_Everything_RestoreQueryState(&state);
+	
+	_Everything_LastError = error;
+	
+	_Everything_Unlock();
+	
+publish:
+
+	// publish to the waiters, later identical queries start a new flight.
+	EnterCriticalSection(&_Everything_FlightCS);
+	
+	{
+		_EVERYTHING_QUERY_FLIGHT **link;
+		
+		link = &_Everything_FlightList;
+		
+		while(*link != flight)
+		{
+			link = &(*link)->next;
+		}
+		
+		*link = flight->next;
+	}
+	
+	flight->error = error;
+	flight->snapshot = snapshot;
+	
+	LeaveCriticalSection(&_Everything_FlightCS);
+	
+	SetEvent(flight->done_event);
+	
+	if (snapshot)
+	{
+		_Everything_AddRefSnapshot(snapshot);
+		
+		*lphSnapshot = snapshot;
+	}
+	
+	_Everything_ReleaseQueryFlight(flight);
+	
+	return error;
+}
+
+// send an Everything_QueryEx query from its own worker thread and reply window, without taking the lock for the round trip.
+// only version 1 queries go this way, queries that need version 2, the query cache or waiting for Everything to be ready go through the search state.
+// returns FALSE if the query was not sent this way.
+static BOOL _Everything_SendQueryEx(const _EVERYTHING_QUERYEX *query,BOOL is_unicode,HANDLE cancel_event,DWORD start_tick,DWORD *error,_EVERYTHING_SNAPSHOT **snapshot)
+{
+	_EVERYTHING_QUERYEX_CALL call;
+	HANDLE hthread;
+	DWORD thread_id;
+	BOOL use_cache;
+	BOOL wait_for_ready;
+	DWORD remaining;
+	
+	if ((query->request_flags != (EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME)) || (query->sort != EVERYTHING_SORT_NAME_ASCENDING))
+	{
+		return FALSE;
+	}
+	
+	ZeroMemory(&call,sizeof(_EVERYTHING_QUERYEX_CALL));
+	call.query = query;
+	call.is_unicode = is_unicode;
+	call.cancel_event = cancel_event;
+	call.start_tick = start_tick;
+	call.everything_hwnd = FindWindow(EVERYTHING_IPC_WNDCLASS,0);
+	
+	_Everything_Lock();
+	
+	use_cache = (_Everything_QueryCacheMax != 0);
+	wait_for_ready = _Everything_WaitForReadyEnabled;
+	
+	_Everything_Unlock();
+	
+	if (use_cache)
+	{
+		return FALSE;
+	}
+	
+	if (wait_for_ready)
+	{
+		remaining = _Everything_GetQueryExRemainingTime(&call);
+		
+		if ((!call.everything_hwnd) || (!_Everything_IsDBReady(call.everything_hwnd,(remaining < _EVERYTHING_READY_MAX_BACKOFF) ? remaining : _EVERYTHING_READY_MAX_BACKOFF)))
+		{
+			// let the search state wait for it.
+			return FALSE;
+		}
+	}
+	
+	if (!call.everything_hwnd)
+	{
+		// use Everything_SetWaitForReady to wait for it instead.
+		*error = EVERYTHING_ERROR_IPC;
+		
+		return TRUE;
+	}
+	
+	hthread = CreateThread(0,0,_Everything_queryex_thread_proc,&call,0,&thread_id);
+	
+	if (hthread)
+	{
+		WaitForSingleObject(hthread,INFINITE);
+		
+		CloseHandle(hthread);
+	}
+	else
+	{
+		call.error = EVERYTHING_ERROR_CREATETHREAD;
+	}
+	
+	*error = call.error;
+	*snapshot = call.snapshot;
+	
+	return TRUE;
+}
+
+// the worker thread for _Everything_SendQueryEx, it owns the reply window and pumps its messages until the reply, a cancel or the deadline.
+static DWORD EVERYTHINGAPI _Everything_queryex_thread_proc(void *param)
+{
+	_EVERYTHING_QUERYEX_CALL *call;
+	WNDCLASSEX wcex;
+	HWND hwnd;
+	
+	call = param;
+	
+	ZeroMemory(&wcex,sizeof(WNDCLASSEX));
+	wcex.cbSize = sizeof(WNDCLASSEX);
+	
+	if (!GetClassInfoEx(GetModuleHandle(0),TEXT("EVERYTHING_DLL_QUERYEX"),&wcex))
+	{
+		ZeroMemory(&wcex,sizeof(WNDCLASSEX));
+		wcex.cbSize = sizeof(WNDCLASSEX);
+		wcex.hInstance = GetModuleHandle(0);
+		wcex.lpfnWndProc = _Everything_queryex_window_proc;
+		wcex.lpszClassName = TEXT("EVERYTHING_DLL_QUERYEX");
+		
+		if (!RegisterClassEx(&wcex))
+		{
+			// another thread may have registered it first.
+			if (!GetClassInfoEx(GetModuleHandle(0),TEXT("EVERYTHING_DLL_QUERYEX"),&wcex))
+			{
+				call->error = EVERYTHING_ERROR_REGISTERCLASSEX;
+				
+				return 0;
+			}
+		}
+	}
+	
+	hwnd = CreateWindow(
+		TEXT("EVERYTHING_DLL_QUERYEX"),
+		TEXT(""),
+		0,
+		0,0,0,0,
+		0,0,GetModuleHandle(0),0);
+		
+	if (!hwnd)
+	{
+		call->error = EVERYTHING_ERROR_CREATEWINDOW;
+		
+		return 0;
+	}
+	
+	_Everything_ChangeWindowMessageFilter(hwnd);
+	
+	SetWindowLongPtr(hwnd,GWLP_USERDATA,(LONG_PTR)call);
+	
+	if (_Everything_SendQueryExCopyData(call,hwnd))
+	{
+		while((!call->snapshot) && (!call->error))
+		{
+			MSG msg;
+			
+			// wait for the reply, a cancel or the deadline.
+			switch(MsgWaitForMultipleObjects(call->cancel_event ? 1 : 0,&call->cancel_event,FALSE,_Everything_GetQueryExRemainingTime(call),QS_ALLINPUT))
+			{
+				case WAIT_TIMEOUT:
+					call->error = EVERYTHING_ERROR_TIMEOUT;
+					break;
+					
+				case WAIT_OBJECT_0:
+				
+					if (call->cancel_event)
+					{
+						call->error = EVERYTHING_ERROR_CANCELLED;
+						break;
+					}
+					
+					// fall through, without a cancel event WAIT_OBJECT_0 is a message.
+					
+				default:
+				
+					while(PeekMessage(&msg,NULL,0,0,PM_REMOVE)) 
+					{
+						TranslateMessage(&msg);
+						DispatchMessage(&msg);
+					}
+					
+					break;
+			}
+		}
+	}
+	
+	DestroyWindow(hwnd);
+	
+	return 0;
+}
+
+// build a version 1 query from an Everything_QueryEx query and send it with the reply going to reply_hwnd.
+static BOOL _Everything_SendQueryExCopyData(_EVERYTHING_QUERYEX_CALL *call,HWND reply_hwnd)
+{
+	const _EVERYTHING_QUERYEX *query;
+	COPYDATASTRUCT cds;
+	DWORD search_flags;
+	DWORD remaining;
+	DWORD_PTR result;
+	DWORD len;
+	DWORD size;
+	void *ipc_query;
+	BOOL ret;
+	
+	query = call->query;
+	search_flags = (query->regex?EVERYTHING_IPC_REGEX:0) | (query->match_case?EVERYTHING_IPC_MATCHCASE:0) | (query->match_whole_word?EVERYTHING_IPC_MATCHWHOLEWORD:0) | (query->match_path?EVERYTHING_IPC_MATCHPATH:0);
+	
+	if (call->is_unicode)
+	{
+		len = query->search ? _Everything_StringLengthW((LPCWSTR)query->search) : 0;
+		
+		size = sizeof(EVERYTHING_IPC_QUERYW) - sizeof(WCHAR) + len*sizeof(WCHAR) + sizeof(WCHAR);
+	}
+	else
+	{
+		len = query->search ? _Everything_StringLengthA((LPCSTR)query->search) : 0;
+		
+		size = sizeof(EVERYTHING_IPC_QUERYA) - sizeof(char) + (len*sizeof(char)) + sizeof(char);
+	}
+	
+	ipc_query = _Everything_Alloc(size);
+	
+	if (!ipc_query)
+	{
+		call->error = EVERYTHING_ERROR_MEMORY;
+		
+		return FALSE;
+	}
+	
+	if (call->is_unicode)
+	{
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->max_results = query->max;
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->offset = query->offset;
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->reply_copydata_message = _EVERYTHING_COPYDATA_QUERYREPLY;
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->search_flags = search_flags;
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->reply_hwnd = (DWORD)(DWORD_PTR)reply_hwnd;
+		
+		if (len)
+		{
+			CopyMemory(((EVERYTHING_IPC_QUERYW *)ipc_query)->search_string,query->search,len * sizeof(WCHAR));
+		}
+		
+		((EVERYTHING_IPC_QUERYW *)ipc_query)->search_string[len] = 0;
+	}
+	else
+	{
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->max_results = query->max;
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->offset = query->offset;
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->reply_copydata_message = _EVERYTHING_COPYDATA_QUERYREPLY;
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->search_flags = search_flags;
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->reply_hwnd = (DWORD)(DWORD_PTR)reply_hwnd;
+		
+		if (len)
+		{
+			CopyMemory(((EVERYTHING_IPC_QUERYA *)ipc_query)->search_string,query->search,len);
+		}
+		
+		((EVERYTHING_IPC_QUERYA *)ipc_query)->search_string[len] = 0;
+	}
+	
+	cds.cbData = size;
+	cds.dwData = call->is_unicode ? EVERYTHING_IPC_COPYDATAQUERYW : EVERYTHING_IPC_COPYDATAQUERYA;
+	cds.lpData = ipc_query;
+	
+	remaining = _Everything_GetQueryExRemainingTime(call);
+	
+	if (remaining == INFINITE)
+	{
+		ret = SendMessage(call->everything_hwnd,WM_COPYDATA,(WPARAM)reply_hwnd,(LPARAM)&cds) ? TRUE : FALSE;
+	}
+	else
+	if (SendMessageTimeout(call->everything_hwnd,WM_COPYDATA,(WPARAM)reply_hwnd,(LPARAM)&cds,SMTO_BLOCK | SMTO_ABORTIFHUNG,remaining ? remaining : 1,&result))
+	{
+		ret = result ? TRUE : FALSE;
+	}
+	else
+	{
+		ret = FALSE;
+		
+		if (GetLastError() == ERROR_TIMEOUT)
+		{
+			call->error = EVERYTHING_ERROR_TIMEOUT;
+		}
+	}
+	
+	_Everything_Free(ipc_query);
+	
+	if (ret)
+	{
+		InterlockedIncrement(&_Everything_SentCount);
+	}
+	else
+	if (!call->error)
+	{
+		call->error = EVERYTHING_ERROR_IPC;
+	}
+	
+	return ret;
+}
+
+// time left before the deadline of an Everything_QueryEx query, INFINITE if it has no timeout.
+static DWORD _Everything_GetQueryExRemainingTime(const _EVERYTHING_QUERYEX_CALL *call)
+{
+	DWORD elapsed;
+	
+	if (call->query->timeout == INFINITE)
+	{
+		return INFINITE;
+	}
+	
+	elapsed = GetTickCount() - call->start_tick;
+	
+	if (elapsed >= call->query->timeout)
+	{
+		return 0;
+	}
+	
+	return call->query->timeout - elapsed;
+}
+
+// the reply window proc for _Everything_SendQueryEx, the call is in the window user data.
+static LRESULT WINAPI _Everything_queryex_window_proc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
+{
+	if (msg == WM_COPYDATA)
+	{
+		COPYDATASTRUCT *cds;
+		_EVERYTHING_QUERYEX_CALL *call;
+		
+		cds = (COPYDATASTRUCT *)lParam;
+		call = (_EVERYTHING_QUERYEX_CALL *)GetWindowLongPtr(hwnd,GWLP_USERDATA);
+		
+		if ((call) && (cds->dwData == _EVERYTHING_COPYDATA_QUERYREPLY) && (!call->snapshot) && (!call->error))
+		{
+			call->snapshot = _Everything_CreateSnapshot(cds->lpData,cds->cbData,FALSE,call->is_unicode);
+			
+			if (!call->snapshot)
+			{
+				call->error = EVERYTHING_ERROR_MEMORY;
+			}
+			
+			return TRUE;
+		}
+	}
+	
+	return DefWindowProc(hwnd,msg,wParam,lParam);
+}
+
+static void _Everything_ReleaseQueryFlight(_EVERYTHING_QUERY_FLIGHT *flight)
+{
+	LONG ref_count;
+	
+	EnterCriticalSection(&_Everything_FlightCS);
+	
+	ref_count = --flight->ref_count;
+	
+	LeaveCriticalSection(&_Everything_FlightCS);
+	
+	if (!ref_count)
+	{
+		if (flight->snapshot)
+		{
+			_Everything_ReleaseSnapshot(flight->snapshot);
+		}
+		
+		CloseHandle(flight->done_event);
+		_Everything_Free(flight->key);
+		_Everything_Free(flight);
+	}
+}
+
+BOOL EVERYTHINGAPI Everything_GetQueryCounters(EVERYTHING_QUERYCOUNTERS *lpCounters)
+{
+	EVERYTHING_QUERYCOUNTERS counters;
+	DWORD size;
+	
+	if ((!lpCounters) || (lpCounters->cbSize < sizeof(DWORD)))
+	{
+		_Everything_Lock();
+		
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDPARAMETER;
+		
+		_Everything_Unlock();
+		
+		return FALSE;
+	}
+	
+	counters.cbSize = sizeof(EVERYTHING_QUERYCOUNTERS);
+	counters.dwQueries = (DWORD)_Everything_QueryCount;
+	counters.dwCoalesced = (DWORD)_Everything_CoalescedCount;
+	counters.dwSent = (DWORD)_Everything_SentCount;
+	counters.dwCacheHits = (DWORD)_Everything_CacheHitCount;
+	
+	// older callers may pass a smaller structure.
+	size = lpCounters->cbSize;
+	if (size > sizeof(EVERYTHING_QUERYCOUNTERS))
+	{
+		size = sizeof(EVERYTHING_QUERYCOUNTERS);
+	}
+	
+	CopyMemory((char *)lpCounters + sizeof(DWORD),(char *)&counters + sizeof(DWORD),size - sizeof(DWORD));
+	
+	return TRUE;
+}
+
+// sorting by path.
+// each result gets a contiguous case folded key (path, a \1 separator and the name)
+// so comparisons never re-derive item pointers, and the first few folded characters
+// are packed into an integer so most comparisons never touch the key text at all.
+// large lists are split into chunks which are keyed and sorted on worker threads
+// and then merged pairwise, also on worker threads.
+
+// build the folded key text into *dst, returns the length in characters including the separator and null terminator.
+static DWORD _Everything_FoldSortKeyA(CHAR *dst,LPCSTR path,DWORD path_len,LPCSTR name,DWORD name_len)
+{
+	fold_lower_copy(dst,path,path_len);
+	dst[path_len] = 1;
+	
+	fold_lower_copy(dst + path_len + 1,name,name_len);
+	dst[path_len + 1 + name_len] = 0;
+	
+	return path_len + name_len + 2;
+}
+
+static DWORD _Everything_FoldSortKeyW(WCHAR *dst,LPCWSTR path,DWORD path_len,LPCWSTR name,DWORD name_len)
+{
+	fold_lower_copy_w(dst,path,path_len);
+	dst[path_len] = 1;
+	
+	fold_lower_copy_w(dst + path_len + 1,name,name_len);
+	dst[path_len + 1 + name_len] = 0;
+	
+	return path_len + name_len + 2;
+}
+
+// get the path and name of a result for sorting.
+// list2 results without a separate path and name are keyed by their full path and name.
+static BOOL _Everything_GetSortStrings(DWORD dwIndex,const void **path,const void **name)
+{
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			*path = EVERYTHING_IPC_ITEMPATHW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
+			*name = EVERYTHING_IPC_ITEMFILENAMEW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
+		}
+		else
+		{
+			*path = EVERYTHING_IPC_ITEMPATHA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
+			*name = EVERYTHING_IPC_ITEMFILENAMEA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
+		}
+		
+		return TRUE;
+	}
+	else
+	{
+		const char *path_data;
+		const char *name_data;
+		
+		path_data = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_PATH);
+		name_data = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
+		
+		if ((path_data) && (name_data))
+		{
+			// skip length in characters.
+			*path = path_data + sizeof(DWORD);
+			*name = name_data + sizeof(DWORD);
+			
+			return TRUE;
+		}
+		
+		path_data = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME);
+		
+		if (path_data)
+		{
+			*path = path_data + sizeof(DWORD);
+			*name = _Everything_IsUnicodeQuery ? (const void *)L"" : (const void *)"";
+			
+			return TRUE;
+		}
+		
+		return FALSE;
+	}
+}
+
+static int _Everything_CompareSortKeys(const _EVERYTHING_SORT *sort,const _EVERYTHING_SORT_KEY *a,const _EVERYTHING_SORT_KEY *b)
+{
+	int i;
+	
+	if (a->prefix != b->prefix)
+	{
+		return (a->prefix < b->prefix) ? -1 : 1;
+	}
+
+	// a non-zero last prefix character means both keys share the whole prefix, skip it.
+	if (sort->is_unicode)
+	{
+		DWORD skip;
+		
+		skip = (a->prefix & 0xffff) ? 4 : 0;
+		
+		i = wcscmp((const WCHAR *)sort->keybuf + a->offset + skip,(const WCHAR *)sort->keybuf + b->offset + skip);
+	}
+	else
+	{
+		DWORD skip;
+		
+		skip = (a->prefix & 0xff) ? 8 : 0;
+		
+		i = strcmp((const CHAR *)sort->keybuf + a->offset + skip,(const CHAR *)sort->keybuf + b->offset + skip);
+	}
+	
+	if (i)
+	{
+		return i;
+	}
+	
+	// keep the sort stable.
+	return (a->index < b->index) ? -1 : 1;
+}
+
+static void _Everything_MergeSortKeyRuns(const _EVERYTHING_SORT *sort,const _EVERYTHING_SORT_KEY *a,DWORD acount,const _EVERYTHING_SORT_KEY *b,DWORD bcount,_EVERYTHING_SORT_KEY *dst)
+{
+	while((acount) && (bcount))
+	{
+		if (_Everything_CompareSortKeys(sort,b,a) < 0)
+		{
+			*dst++ = *b++;
+			bcount--;
+		}
+		else
+		{
+			*dst++ = *a++;
+			acount--;
+		}
+	}
+	
+	if (acount)
+	{
+		CopyMemory(dst,a,acount * sizeof(_EVERYTHING_SORT_KEY));
+	}
+
+	if (bcount)
+	{
+		CopyMemory(dst,b,bcount * sizeof(_EVERYTHING_SORT_KEY));
+	}
+}
+
+// stable bottom up merge sort, the sorted keys always end up in keys.
+static void _Everything_MergeSortKeys(const _EVERYTHING_SORT *sort,_EVERYTHING_SORT_KEY *keys,_EVERYTHING_SORT_KEY *tmp,DWORD count)
+{
+	_EVERYTHING_SORT_KEY *src;
+	_EVERYTHING_SORT_KEY *dst;
+	DWORD width;
+	DWORD lo;
+	
+	// insertion sort small runs.
+	for(lo=0;lo<count;lo+=_EVERYTHING_SORT_RUN)
+	{
+		DWORD hi;
+		DWORD i;
+		
+		hi = lo + _EVERYTHING_SORT_RUN;
+		if (hi > count) hi = count;
+		
+		for(i=lo+1;i<hi;i++)
+		{
+			_EVERYTHING_SORT_KEY key;
+			DWORD j;
+			
+			key = keys[i];
+			j = i;
+			
+			while((j > lo) && (_Everything_CompareSortKeys(sort,&key,&keys[j-1]) < 0))
+			{
+				keys[j] = keys[j-1];
+				j--;
+			}
+			
+			keys[j] = key;
+		}
+	}
+	
+	src = keys;
+	dst = tmp;
+	
+	for(width=_EVERYTHING_SORT_RUN;width<count;width*=2)
+	{
+		for(lo=0;lo<count;lo+=width*2)
+		{
+			DWORD mid;
+			DWORD hi;
+			
+			mid = lo + width;
+			if (mid > count) mid = count;
+			
+			hi = mid + width;
+			if (hi > count) hi = count;
+			
+			_Everything_MergeSortKeyRuns(sort,src+lo,mid-lo,src+mid,hi-mid,dst+lo);
+		}
+		
+		if (src == keys)
+		{
+			src = tmp;
+			dst = keys;
+		}
+		else
+		{
+			src = keys;
+			dst = tmp;
+		}
+	}
+	
+	if (src != keys)
+	{
+		CopyMemory(keys,src,count * sizeof(_EVERYTHING_SORT_KEY));
+	}
+}
+
+// measure the folded key text for a chunk.
+static DWORD EVERYTHINGAPI _Everything_sort_measure_thread_proc(void *param)
+{
+	_EVERYTHING_SORT_JOB *job;
+	ULONGLONG chars;
+	DWORD i;
+	
+	job = param;
+	chars = 0;
+	
+	for(i=job->start;i<job->start+job->count;i++)
+	{
+		const void *path;
+		const void *name;
+		
+		if (!_Everything_GetSortStrings(i,&path,&name))
+		{
+			job->ok = FALSE;
+			
+			return 0;
+		}
+
+		if (job->sort->is_unicode)
+		{
+			chars += _Everything_StringLengthW(path) + _Everything_StringLengthW(name) + 2;
+		}
+		else
+		{
+			chars += _Everything_StringLengthA(path) + _Everything_StringLengthA(name) + 2;
+		}
+	}
+	
+	job->key_chars = chars;
+	job->ok = TRUE;
+	
+	return 0;
+}
+
+// build the keys for a chunk and sort them.
+static DWORD EVERYTHINGAPI _Everything_sort_chunk_thread_proc(void *param)
+{
+	_EVERYTHING_SORT_JOB *job;
+	_EVERYTHING_SORT *sort;
+	ULONGLONG offset;
+	DWORD i;
+	
+	job = param;
+	sort = job->sort;
+	offset = job->key_offset;
+	
+	for(i=job->start;i<job->start+job->count;i++)
+	{
+		_EVERYTHING_SORT_KEY *key;
+		const void *path;
+		const void *name;
+		ULONGLONG prefix;
+		DWORD len;
+		DWORD j;
+		
+		_Everything_GetSortStrings(i,&path,&name);
+		
+		key = &sort->keys[i];
+		key->offset = (DWORD)offset;
+		key->index = i;
+		prefix = 0;
+		
+		if (sort->is_unicode)
+		{
+			const WCHAR *k;
+			
+			k = (WCHAR *)sort->keybuf + offset;
+			len = _Everything_FoldSortKeyW((WCHAR *)k,path,_Everything_StringLengthW(path),name,_Everything_StringLengthW(name));
+			
+			for(j=0;j<4;j++)
+			{
+				prefix <<= 16;
+				
+				if (j < len)
+				{
+					prefix |= k[j];
+				}
+			}
+		}
+		else
+		{
+			const BYTE *k;
+			
+			k = (BYTE *)sort->keybuf + offset;
+			len = _Everything_FoldSortKeyA((CHAR *)k,path,_Everything_StringLengthA(path),name,_Everything_StringLengthA(name));
+			
+			for(j=0;j<8;j++)
+			{
+				prefix <<= 8;
+				
+				if (j < len)
+				{
+					prefix |= k[j];
+				}
+			}
+		}
+		
+		key->prefix = prefix;
+		offset += len;
+	}
+	
+	_Everything_MergeSortKeys(sort,sort->keys + job->start,sort->tmp + job->start,job->count);
+	
+	return 0;
+}
+
+// merge two adjacent sorted chunks.
+static DWORD EVERYTHINGAPI _Everything_sort_merge_thread_proc(void *param)
+{
+	_EVERYTHING_SORT_JOB *job;
+	
+	job = param;
+	
+	_Everything_MergeSortKeyRuns(job->sort,job->src + job->start,job->mid - job->start,job->src + job->mid,job->start + job->count - job->mid,job->dst + job->start);
+	
+	return 0;
+}
+
+// run the jobs on worker threads, the calling thread does the first job itself.
+static void _Everything_RunSortJobs(_EVERYTHING_SORT_JOB *jobs,DWORD count,DWORD (EVERYTHINGAPI *proc)(void *))
+{
+	HANDLE threads[_EVERYTHING_SORT_MAX_THREADS];
+	DWORD i;
+	
+	for(i=1;i<count;i++)
+	{
+		threads[i] = CreateThread(0,0,proc,&jobs[i],0,0);
+		
+		if (!threads[i])
+		{
+			// no thread, do it here.
+			proc(&jobs[i]);
+		}
+	}
+	
+	proc(&jobs[0]);
+	
+	for(i=1;i<count;i++)
+	{
+		if (threads[i])
+		{
+			WaitForSingleObject(threads[i],INFINITE);
+			
+			CloseHandle(threads[i]);
+		}
+	}
+}
+
+static DWORD _Everything_GetSortThreadCount(DWORD numitems)
+{
+	SYSTEM_INFO system_info;
+	DWORD thread_count;
+	
+	if (numitems < _EVERYTHING_SORT_PARALLEL_THRESHOLD)
+	{
+		return 1;
+	}
+	
+	GetSystemInfo(&system_info);
+	
+	thread_count = 1;
+	
+	while((thread_count * 2 <= system_info.dwNumberOfProcessors) && (thread_count * 2 <= _EVERYTHING_SORT_MAX_THREADS) && (numitems / (thread_count * 2) >= _EVERYTHING_SORT_PARALLEL_THRESHOLD / 2))
+	{
+		thread_count *= 2;
+	}
+	
+	return thread_count;
+}
+
+// sort the current list (or list2) by path then name.
+// assumes the lock is held and there is a list.
+static BOOL _Everything_SortListByPath(void)
+{
+	_EVERYTHING_SORT sort;
+	_EVERYTHING_SORT_JOB jobs[_EVERYTHING_SORT_MAX_THREADS];
+	DWORD thread_count;
+	DWORD item_size;
+	BYTE *items;
+	BYTE *items_copy;
+	ULONGLONG key_chars;
+	DWORD chunk_count;
+	DWORD i;
+	
+	sort.is_unicode = _Everything_IsUnicodeQuery;
+	
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			sort.numitems = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numitems;
+			items = (BYTE *)((EVERYTHING_IPC_LISTW *)_Everything_List)->items;
+			item_size = sizeof(EVERYTHING_IPC_ITEMW);
+		}
+		else
+		{
+			sort.numitems = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numitems;
+			items = (BYTE *)((EVERYTHING_IPC_LISTA *)_Everything_List)->items;
+			item_size = sizeof(EVERYTHING_IPC_ITEMA);
+		}
+	}
+	else
+	{
+		sort.numitems = _Everything_List2->numitems;
+		items = (BYTE *)(_Everything_List2 + 1);
+		item_size = sizeof(EVERYTHING_IPC_ITEM2);
+	}
+	
+	if (sort.numitems < 2)
+	{
+		return TRUE;
+	}
+	
+	thread_count = _Everything_GetSortThreadCount(sort.numitems);
+	
+	// split into chunks.
+	for(i=0;i<thread_count;i++)
+	{
+		jobs[i].sort = &sort;
+		jobs[i].start = (DWORD)(((ULONGLONG)sort.numitems * i) / thread_count);
+		jobs[i].count = (DWORD)(((ULONGLONG)sort.numitems * (i + 1)) / thread_count) - jobs[i].start;
+	}
+	
+	_Everything_RunSortJobs(jobs,thread_count,_Everything_sort_measure_thread_proc);
+	
+	key_chars = 0;
+	
+	for(i=0;i<thread_count;i++)
+	{
+		if (!jobs[i].ok)
+		{
+			// no path or name data to sort by.
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+			
+			return FALSE;
+		}
+		
+		jobs[i].key_offset = key_chars;
+		key_chars += jobs[i].key_chars;
+	}
+	
+	if ((key_chars * (sort.is_unicode ? sizeof(WCHAR) : sizeof(CHAR)) > 0xffffffff) || (key_chars > 0xffffffff))
+	{
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+		
+		return FALSE;
+	}
+	
+	sort.keybuf = _Everything_Alloc((DWORD)(key_chars * (sort.is_unicode ? sizeof(WCHAR) : sizeof(CHAR))));
+	sort.keys = _Everything_Alloc(sort.numitems * sizeof(_EVERYTHING_SORT_KEY));
+	sort.tmp = _Everything_Alloc(sort.numitems * sizeof(_EVERYTHING_SORT_KEY));
+	items_copy = _Everything_Alloc(sort.numitems * item_size);
+	
+	if ((!sort.keybuf) || (!sort.keys) || (!sort.tmp) || (!items_copy))
+	{
+		if (sort.keybuf) _Everything_Free(sort.keybuf);
+		if (sort.keys) _Everything_Free(sort.keys);
+		if (sort.tmp) _Everything_Free(sort.tmp);
+		if (items_copy) _Everything_Free(items_copy);
+		
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+		
+		return FALSE;
+	}
+	
+	_Everything_RunSortJobs(jobs,thread_count,_Everything_sort_chunk_thread_proc);
+	
+	// merge the sorted chunks pairwise until there is one.
+	chunk_count = thread_count;
+	
+	if (chunk_count > 1)
+	{
+		_EVERYTHING_SORT_KEY *src;
+		_EVERYTHING_SORT_KEY *dst;
+		
+		src = sort.keys;
+		dst = sort.tmp;
+		
+		while(chunk_count > 1)
+		{
+			for(i=0;i<chunk_count/2;i++)
+			{
+				jobs[i].src = src;
+				jobs[i].dst = dst;
+				jobs[i].mid = jobs[i*2+1].start;
+				jobs[i].start = jobs[i*2].start;
+				jobs[i].count = jobs[i*2].count + jobs[i*2+1].count;
+			}
+			
+			_Everything_RunSortJobs(jobs,chunk_count/2,_Everything_sort_merge_thread_proc);
+			
+			chunk_count /= 2;
+			
+			dst = src;
+			src = jobs[0].dst;
+		}
+		
+		if (src != sort.keys)
+		{
+			CopyMemory(sort.keys,src,sort.numitems * sizeof(_EVERYTHING_SORT_KEY));
+		}
+	}
+	
+	// apply the order.
+	CopyMemory(items_copy,items,sort.numitems * item_size);
+	
+	for(i=0;i<sort.numitems;i++)
+	{
+		CopyMemory(items + (i * item_size),items_copy + (sort.keys[i].index * item_size),item_size);
+	}
+	
+	if (_Everything_List2)
+	{
+		_Everything_List2->sort_type = EVERYTHING_SORT_PATH_ASCENDING;
+	}
+	
+	// assembled full paths are in the old order.
+	// the snapshot is not shared, see _Everything_UnshareSnapshot.
+	if (_Everything_Snapshot->full_path_views)
+	{
+		_Everything_Free(_Everything_Snapshot->full_path_views);
+		
+		_Everything_Snapshot->full_path_views = NULL;
+	}
+	
+	_Everything_Free(items_copy);
+	_Everything_Free(sort.tmp);
+	_Everything_Free(sort.keys);
+	_Everything_Free(sort.keybuf);
+	
+	return TRUE;
+}
+
+void EVERYTHINGAPI Everything_SortResultsByPath(void)
+{
+	_Everything_Lock();
+	
+	if ((_Everything_List) || (_Everything_List2))
+	{
+		// the sort is done in place.
+		if (_Everything_UnshareSnapshot())
+		{
+			_Everything_SortListByPath();
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+	}
+	
+	_Everything_Unlock();
+}
+
+DWORD EVERYTHINGAPI Everything_GetLastError(void)
+{
+	DWORD ret;
+		
+	_Everything_Lock();
+	
+	ret = _Everything_LastError;
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetNumFileResults(void)
+{
+	DWORD ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numfiles;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numfiles;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetNumFolderResults(void)
+{
+	DWORD ret;
+
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numfolders;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numfolders;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetNumResults(void)
+{
+	DWORD ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->numitems;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->numitems;
+		}
+	}
+	else
+	if (_Everything_List2)
+	{
+		ret = _Everything_List2->numitems;
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetTotFileResults(void)
+{
+	DWORD ret;
+
+	_Everything_Lock();
+	
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totfiles;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totfiles;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetTotFolderResults(void)
+{
+	DWORD ret;
+
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totfolders;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totfolders;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+DWORD EVERYTHINGAPI Everything_GetTotResults(void)
+{
+	DWORD ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsUnicodeQuery)
+		{
+			ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->totitems;
+		}
+		else
+		{
+			ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->totitems;
+		}
+	}
+	else
+	if (_Everything_List2)
+	{
+		ret = _Everything_List2->totitems;
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = 0;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+BOOL EVERYTHINGAPI Everything_IsVolumeResult(DWORD dwIndex)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			if (_Everything_IsUnicodeQuery)
+			{
+				ret = (((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
+			}
+			else
+			{
+				ret = (((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	if (_Everything_List2)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & EVERYTHING_IPC_DRIVE) ? TRUE : FALSE;
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = FALSE;
+	}
+	
+	_Everything_Unlock();
+
+	return ret;	
+}
+
+BOOL EVERYTHINGAPI Everything_IsFolderResult(DWORD dwIndex)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			if (_Everything_IsUnicodeQuery)
+			{
+				ret = ((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER) ? TRUE : FALSE;
+			}
+			else
+			{
+				ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER) ? TRUE : FALSE;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	if (_Everything_List2)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? TRUE : FALSE;
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = FALSE;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+BOOL EVERYTHINGAPI Everything_IsFileResult(DWORD dwIndex)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			if (_Everything_IsUnicodeQuery)
+			{
+				ret = (((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
+			}
+			else
+			{
+				ret = (((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	if (_Everything_List2)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = FALSE;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = FALSE;
+	}
+	
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+LPCWSTR EVERYTHINGAPI Everything_GetResultFileNameW(DWORD dwIndex)
+{
+	LPCWSTR ret;
+	
+	_Everything_Lock();
+	
+	if ((_Everything_List) && (_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = EVERYTHING_IPC_ITEMFILENAMEW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	if ((_Everything_List2) && (_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
+			
+			if (ret)
+			{
+				// skip length in characters.
+				ret = (LPCWSTR)(((char *)ret) + sizeof(DWORD));
+			}
 			else
 			{
-				ret = ((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER) ? TRUE : FALSE;
+				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = NULL;
+	}
+	
+	_Everything_Unlock();
+
+	return ret;
+}
+
+LPCSTR EVERYTHINGAPI Everything_GetResultFileNameA(DWORD dwIndex)
+{
+	LPCSTR ret;
+	
+	_Everything_Lock();
+
+	if ((_Everything_List) && (!_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = EVERYTHING_IPC_ITEMFILENAMEA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	if ((_Everything_List2) && (!_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
+			
+			if (ret)
+			{
+				// skip length in characters.
+				ret = (LPCSTR)(((char *)ret) + sizeof(DWORD));
+			}
+			else
+			{
+				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = NULL;
+	}
+	
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+LPCWSTR EVERYTHINGAPI Everything_GetResultPathW(DWORD dwIndex)
+{
+	LPCWSTR ret;
+
+	_Everything_Lock();
+	
+	if ((_Everything_List) && (_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = EVERYTHING_IPC_ITEMPATHW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	if ((_Everything_List2) && (_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_PATH);
+			
+			if (ret)
+			{
+				// skip length in characters.
+				ret = (LPCWSTR)(((char *)ret) + sizeof(DWORD));
+			}
+			else
+			{
+				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+			}
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = NULL;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+LPCSTR EVERYTHINGAPI Everything_GetResultPathA(DWORD dwIndex)
+{
+	LPCSTR ret;
+	
+	_Everything_Lock();
+
+	if (_Everything_List)
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = EVERYTHING_IPC_ITEMPATHA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	if ((_Everything_List2) && (!_Everything_IsUnicodeQuery))
+	{
+		if (_Everything_IsValidResultIndex(dwIndex))
+		{
+			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_PATH);
+			
+			if (ret)
+			{
+				// skip length in characters.
+				ret = (LPCSTR)(((char *)ret) + sizeof(DWORD));
+			}
+			else
+			{
+				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
 			}
 		}
 		else
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			
+			ret = NULL;
+		}
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+
+		ret = NULL;
+	}
+
+	_Everything_Unlock();
+	
+	return ret;
+}
+
+// max is in chars
+static DWORD _Everything_CopyW(LPWSTR buf,DWORD bufmax,DWORD catlen,LPCWSTR s)
+{
+	DWORD wlen;
+
+	if (buf)
+	{
+		buf += catlen;
+		bufmax -= catlen;
+	}
+	
+	wlen = _Everything_StringLengthW(s);
+	if (!wlen) 
+	{
+		if (buf)
+		{
+			buf[wlen] = 0;
+		}
+	
+		return catlen;
+	}
+
+	// terminate
+	if (wlen > bufmax-1) wlen = bufmax-1;
+
+	if (buf)
+	{
+		CopyMemory(buf,s,wlen*sizeof(WCHAR));
+
+		buf[wlen] = 0;
+	}
+	
+	return wlen + catlen;
+}
+
+static DWORD _Everything_CopyA(LPSTR buf,DWORD max,DWORD catlen,LPCSTR s)
+{
+	DWORD len;
+	
+	if (buf)
+	{
+		buf += catlen;
+		max -= catlen;
+	}
+	
+	len = _Everything_StringLengthA(s);
+	if (!len) 
+	{
+		if (buf)
+		{
+			buf[len] = 0;
+		}
+	
+		return catlen;
+	}
+
+	// terminate
+	if (len > max-1) len = max-1;
+
+	if (buf)
+	{
+		CopyMemory(buf,s,len*sizeof(char));
+
+		buf[len] = 0;
+	}
+	
+	return len + catlen;
+
+}
+
+// max is in chars
+// ascii strings are the same in every ansi code page and are widened directly.
+static DWORD _Everything_CopyWFromA(LPWSTR buf,DWORD bufmax,DWORD catlen,LPCSTR s)
+{
+	DWORD len;
+	DWORD wlen;
+	BOOL is_ascii;
+
+	if (buf)
+	{
+		buf += catlen;
+		bufmax -= catlen;
+	}
+	
+	len = _Everything_StringLengthA(s);
+	is_ascii = (transcode_ascii_prefix(s,len) == len);
+	
+	wlen = is_ascii ? len : MultiByteToWideChar(CP_ACP,0,s,len,0,0);
+	if (!wlen) 
+	{
+		if (buf)
+		{
+			buf[wlen] = 0;
 		}
+	
+		return catlen;
 	}
-	else
-	if (_Everything_List2)
+
+	// terminate
+	if (wlen > bufmax-1) wlen = bufmax-1;
+
+	if (buf)
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
+		if (is_ascii)
 		{
-			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? TRUE : FALSE;
+			transcode_widen_ascii(buf,s,wlen);
 		}
 		else
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
+			MultiByteToWideChar(CP_ACP,0,s,len,buf,wlen);
 		}
-	}
-	else
-	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 
-		ret = FALSE;
+		buf[wlen] = 0;
 	}
-
-	_Everything_Unlock();
 	
-	return ret;
+	return wlen + catlen;
 }
 
-BOOL EVERYTHINGAPI Everything_IsFileResult(DWORD dwIndex)
+static DWORD _Everything_CopyAFromW(LPSTR buf,DWORD max,DWORD catlen,LPCWSTR s)
 {
-	BOOL ret;
+	DWORD len;
+	DWORD wlen;
+	BOOL is_ascii;
 	
-	_Everything_Lock();
-
-	if (_Everything_List)
+	if (buf)
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			if (_Everything_IsUnicodeQuery)
-			{
-				ret = (((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
-			}
-			else
-			{
-				ret = (((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
-			}
-		}
-		else
+		buf += catlen;
+		max -= catlen;
+	}
+	
+	wlen = _Everything_StringLengthW(s);
+	is_ascii = (transcode_ascii_prefix_w(s,wlen) == wlen);
+	
+	len = is_ascii ? wlen : WideCharToMultiByte(CP_ACP,0,s,wlen,0,0,0,0);
+	if (!len) 
+	{
+		if (buf)
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
+			buf[len] = 0;
 		}
+	
+		return catlen;
 	}
-	else
-	if (_Everything_List2)
+
+	// terminate
+	if (len > max-1) len = max-1;
+
+	if (buf)
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
+		if (is_ascii)
 		{
-			ret = (((EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1))[dwIndex].flags & (EVERYTHING_IPC_FOLDER)) ? FALSE : TRUE;
+			transcode_narrow_ascii(buf,s,len);
 		}
 		else
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = FALSE;
+			WideCharToMultiByte(CP_ACP,0,s,wlen,buf,len,0,0);
 		}
+
+		buf[len] = 0;
+	}
+	
+	return len + catlen;
+
+}
+
+// max is in bytes
+// a truncated string never ends in a partial utf-8 sequence.
+static DWORD _Everything_CopyUTF8FromW(LPSTR buf,DWORD max,DWORD catlen,LPCWSTR s)
+{
+	DWORD len;
+	
+	if (buf)
+	{
+		buf += catlen;
+		max -= catlen;
+
+		len = (DWORD)transcode_utf16_to_utf8(buf,max-1,s,_Everything_StringLengthW(s));
+		
+		buf[len] = 0;
 	}
 	else
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
+		len = (DWORD)transcode_utf16_to_utf8(NULL,0,s,_Everything_StringLengthW(s));
+	}
+	
+	return len + catlen;
+}
 
-		ret = FALSE;
+static DWORD _Everything_CopyUTF8FromA(LPSTR buf,DWORD max,DWORD catlen,LPCSTR s)
+{
+	DWORD len;
+	DWORD wlen;
+	LPWSTR wbuf;
+	
+	len = _Everything_StringLengthA(s);
+	
+	if (transcode_ascii_prefix(s,len) == len)
+	{
+		return _Everything_CopyA(buf,max,catlen,s);
 	}
 	
-	_Everything_Unlock();
+	wlen = MultiByteToWideChar(CP_ACP,0,s,len,0,0);
 	
-	return ret;
+	wbuf = _Everything_Alloc((wlen + 1) * sizeof(WCHAR));
+	if (!wbuf)
+	{
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+		
+		return _Everything_CopyA(buf,max,catlen,"");
+	}
+	
+	MultiByteToWideChar(CP_ACP,0,s,len,wbuf,wlen);
+	wbuf[wlen] = 0;
+	
+	len = _Everything_CopyUTF8FromW(buf,max,catlen,wbuf);
+	
+	_Everything_Free(wbuf);
+	
+	return len;
 }
 
-LPCWSTR EVERYTHINGAPI Everything_GetResultFileNameW(DWORD dwIndex)
+static DWORD _Everything_CopyUTF8(LPSTR buf,DWORD max,DWORD catlen,const void *s)
 {
-	LPCWSTR ret;
+	if (_Everything_IsUnicodeQuery)
+	{
+		return _Everything_CopyUTF8FromW(buf,max,catlen,s);
+	}
+	else
+	{
+		return _Everything_CopyUTF8FromA(buf,max,catlen,s);
+	}
+}
+
+// get the number of results in a snapshot.
+static DWORD _Everything_GetSnapshotNumItems(const _EVERYTHING_SNAPSHOT *snapshot)
+{
+	if (snapshot->list2)
+	{
+		return snapshot->list2->numitems;
+	}
 	
-	_Everything_Lock();
+	if (snapshot->is_unicode)
+	{
+		return ((EVERYTHING_IPC_LISTW *)snapshot->list)->numitems;
+	}
 	
-	if ((_Everything_List) && (_Everything_IsUnicodeQuery))
+	return ((EVERYTHING_IPC_LISTA *)snapshot->list)->numitems;
+}
+
+// get a result string in the query character set.
+// dwRequestType is one of EVERYTHING_REQUEST_FILE_NAME, EVERYTHING_REQUEST_PATH or EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME.
+// version 2 strings are length prefixed, version 1 strings are measured.
+// returns FALSE if the string is not available.
+// assumes dwIndex is valid.
+static BOOL _Everything_GetSnapshotView(const _EVERYTHING_SNAPSHOT *snapshot,DWORD dwIndex,DWORD dwRequestType,_EVERYTHING_STRINGVIEW *view)
+{
+	if (snapshot->list)
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
+		switch(dwRequestType)
 		{
-			ret = EVERYTHING_IPC_ITEMFILENAMEW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
+			case EVERYTHING_REQUEST_FILE_NAME:
+				view->ptr = snapshot->is_unicode ? (const void *)EVERYTHING_IPC_ITEMFILENAMEW(snapshot->list,&((EVERYTHING_IPC_LISTW *)snapshot->list)->items[dwIndex]) : (const void *)EVERYTHING_IPC_ITEMFILENAMEA(snapshot->list,&((EVERYTHING_IPC_LISTA *)snapshot->list)->items[dwIndex]);
+				break;
+				
+			case EVERYTHING_REQUEST_PATH:
+				view->ptr = snapshot->is_unicode ? (const void *)EVERYTHING_IPC_ITEMPATHW(snapshot->list,&((EVERYTHING_IPC_LISTW *)snapshot->list)->items[dwIndex]) : (const void *)EVERYTHING_IPC_ITEMPATHA(snapshot->list,&((EVERYTHING_IPC_LISTA *)snapshot->list)->items[dwIndex]);
+				break;
+				
+			default:
+				return FALSE;
 		}
-		else
+		
+		view->len = snapshot->is_unicode ? _Everything_StringLengthW(view->ptr) : _Everything_StringLengthA(view->ptr);
+		
+		return TRUE;
+	}
+	else
+	{
+		const char *data;
+		
+		data = _Everything_GetListRequestData(snapshot->list2,snapshot->is_unicode,dwIndex,dwRequestType);
+		
+		if (data)
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			view->len = *(const DWORD *)data;
+			view->ptr = data + sizeof(DWORD);
 			
-			ret = NULL;
+			return TRUE;
 		}
 	}
-	else
-	if ((_Everything_List2) && (_Everything_IsUnicodeQuery))
+	
+	return FALSE;
+}
+
+// assumes a list and dwIndex are valid.
+static const void *_Everything_GetResultString(DWORD dwIndex,DWORD dwRequestType)
+{
+	_EVERYTHING_STRINGVIEW view;
+	
+	if (_Everything_GetSnapshotView(_Everything_Snapshot,dwIndex,dwRequestType,&view))
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
+		return view.ptr;
+	}
+	
+	return NULL;
+}
+
+// assemble the full path and name of every result into one allocation.
+// done once per snapshot, on the first full path view of a list without full path data.
+// snapshots are read without the lock, so the views are published with an interlocked exchange and a losing thread frees its copy.
+static _EVERYTHING_STRINGVIEW *_Everything_GetFullPathViews(_EVERYTHING_SNAPSHOT *snapshot)
+{
+	DWORD numitems;
+	DWORD i;
+	DWORD chars;
+	DWORD charsize;
+	_EVERYTHING_STRINGVIEW path;
+	_EVERYTHING_STRINGVIEW name;
+	_EVERYTHING_STRINGVIEW *views;
+	_EVERYTHING_STRINGVIEW *published;
+	char *d;
+	
+	if (snapshot->full_path_views)
+	{
+		return snapshot->full_path_views;
+	}
+	
+	numitems = _Everything_GetSnapshotNumItems(snapshot);
+	charsize = snapshot->is_unicode ? sizeof(WCHAR) : sizeof(CHAR);
+	chars = 0;
+	
+	for(i=0;i<numitems;i++)
+	{
+		if ((!_Everything_GetSnapshotView(snapshot,i,EVERYTHING_REQUEST_PATH,&path)) || (!_Everything_GetSnapshotView(snapshot,i,EVERYTHING_REQUEST_FILE_NAME,&name)))
 		{
-			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
+			// path or name data not available.
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
 			
-			if (ret)
+			return NULL;
+		}
+		
+		// separator and null terminator.
+		chars += path.len + name.len + 2;
+	}
+	
+	views = _Everything_Alloc(numitems * sizeof(_EVERYTHING_STRINGVIEW) + chars * charsize);
+	if (!views)
+	{
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+		
+		return NULL;
+	}
+	
+	d = (char *)(views + numitems);
+	
+	for(i=0;i<numitems;i++)
+	{
+		_Everything_GetSnapshotView(snapshot,i,EVERYTHING_REQUEST_PATH,&path);
+		_Everything_GetSnapshotView(snapshot,i,EVERYTHING_REQUEST_FILE_NAME,&name);
+		
+		views[i].ptr = d;
+		views[i].len = path.len;
+
+		CopyMemory(d,path.ptr,path.len * charsize);
+		d += path.len * charsize;
+		
+		if (path.len)
+		{
+			if (snapshot->is_unicode)
 			{
-				// skip length in characters.
-				ret = (LPCWSTR)(((char *)ret) + sizeof(DWORD));
+				*(WCHAR *)d = _Everything_IsSchemeNameW(path.ptr) ? '/' : '\\';
 			}
 			else
 			{
-				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+				*(CHAR *)d = _Everything_IsSchemeNameA(path.ptr) ? '/' : '\\';
 			}
+			
+			d += charsize;
+			views[i].len++;
+		}
+		
+		CopyMemory(d,name.ptr,name.len * charsize);
+		d += name.len * charsize;
+		views[i].len += name.len;
+		
+		if (snapshot->is_unicode)
+		{
+			*(WCHAR *)d = 0;
 		}
 		else
 		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = NULL;
+			*(CHAR *)d = 0;
 		}
+		
+		d += charsize;
 	}
-	else
+	
+	published = InterlockedCompareExchangePointer((PVOID volatile *)&snapshot->full_path_views,views,NULL);
+	if (published)
 	{
-		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = NULL;
+		_Everything_Free(views);
+		
+		return published;
 	}
 	
-	_Everything_Unlock();
-
-	return ret;
+	return views;
 }
 
-LPCSTR EVERYTHINGAPI Everything_GetResultFileNameA(DWORD dwIndex)
+// get a string view from a snapshot, does not take the lock.
+static BOOL _Everything_GetSnapshotStringView(_EVERYTHING_SNAPSHOT *snapshot,DWORD dwIndex,DWORD dwRequestType,BOOL bUnicode,_EVERYTHING_STRINGVIEW *view)
 {
-	LPCSTR ret;
+	BOOL ret;
 	
-	_Everything_Lock();
-
-	if ((_Everything_List) && (!_Everything_IsUnicodeQuery))
-	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			ret = EVERYTHING_IPC_ITEMFILENAMEA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
-		}
-		else
-		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = NULL;
-		}
-	}
-	else
-	if ((_Everything_List2) && (!_Everything_IsUnicodeQuery))
+	ret = FALSE;
+	
+	if ((snapshot) && (snapshot->is_unicode == bUnicode))
 	{
-		if (_Everything_IsValidResultIndex(dwIndex))
+		if (dwIndex < _Everything_GetSnapshotNumItems(snapshot))
 		{
-			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
-			
-			if (ret)
+			if (_Everything_GetSnapshotView(snapshot,dwIndex,dwRequestType,view))
 			{
-				// skip length in characters.
-				ret = (LPCSTR)(((char *)ret) + sizeof(DWORD));
+				ret = TRUE;
+			}
+			else
+			if (dwRequestType == EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME)
+			{
+				_EVERYTHING_STRINGVIEW *full_path_views;
+				
+				full_path_views = _Everything_GetFullPathViews(snapshot);
+				
+				if (full_path_views)
+				{
+					*view = full_path_views[dwIndex];
+					
+					ret = TRUE;
+				}
 			}
 			else
 			{
@@ -1510,270 +4360,353 @@ LPCSTR EVERYTHINGAPI Everything_GetResultFileNameA(DWORD dwIndex)
 		else
 		{
 			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
-			
-			ret = NULL;
 		}
 	}
 	else
 	{
 		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
-
-		ret = NULL;
 	}
 	
+	if (!ret)
+	{
+		view->ptr = bUnicode ? (const void *)L"" : (const void *)"";
+		view->len = 0;
+	}
+	
+	return ret;
+}
+
+static BOOL _Everything_GetResultStringView(DWORD dwIndex,DWORD dwRequestType,BOOL bUnicode,_EVERYTHING_STRINGVIEW *view)
+{
+	BOOL ret;
+	
+	_Everything_Lock();
+	
+	ret = _Everything_GetSnapshotStringView(_Everything_Snapshot,dwIndex,dwRequestType,bUnicode,view);
+	
 	_Everything_Unlock();
 	
 	return ret;
 }
 
-LPCWSTR EVERYTHINGAPI Everything_GetResultPathW(DWORD dwIndex)
+BOOL EVERYTHINGAPI Everything_GetResultFileNameViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
 {
-	LPCWSTR ret;
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_FILE_NAME,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetResultFileNameViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_FILE_NAME,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetResultPathViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
+{
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_PATH,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetResultPathViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_PATH,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
 
+// full paths are assembled once per result list when the reply does not include them.
+BOOL EVERYTHINGAPI Everything_GetResultFullPathNameViewW(DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
+{
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetResultFullPathNameViewA(DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetResultStringView(dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+static DWORD _Everything_GetResultStringUTF8(DWORD dwIndex,DWORD dwRequestType,LPSTR buf,DWORD bufsize)
+{
+	DWORD len;
+	
 	_Everything_Lock();
 	
-	if ((_Everything_List) && (_Everything_IsUnicodeQuery))
+	if ((_Everything_List) || (_Everything_List2))
 	{
 		if (_Everything_IsValidResultIndex(dwIndex))
 		{
-			ret = EVERYTHING_IPC_ITEMPATHW(_Everything_List,&((EVERYTHING_IPC_LISTW *)_Everything_List)->items[dwIndex]);
-		}
-		else
-		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			const void *s;
 			
-			ret = NULL;
-		}
-	}
-	else
-	if ((_Everything_List2) && (_Everything_IsUnicodeQuery))
-	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_PATH);
+			s = _Everything_GetResultString(dwIndex,dwRequestType);
 			
-			if (ret)
+			if (s)
 			{
-				// skip length in characters.
-				ret = (LPCWSTR)(((char *)ret) + sizeof(DWORD));
+				len = _Everything_CopyUTF8(buf,bufsize,0,s);
 			}
 			else
 			{
 				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+				
+				len = _Everything_CopyA(buf,bufsize,0,"");
 			}
 		}
 		else
 		{
 			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
 			
-			ret = NULL;
+			len = _Everything_CopyA(buf,bufsize,0,"");
 		}
 	}
 	else
 	{
 		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 
-		ret = NULL;
+		len = _Everything_CopyA(buf,bufsize,0,"");
 	}
 
 	_Everything_Unlock();
 	
-	return ret;
+	return len;
 }
 
-LPCSTR EVERYTHINGAPI Everything_GetResultPathA(DWORD dwIndex)
+DWORD EVERYTHINGAPI Everything_GetResultFileNameUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize)
 {
-	LPCSTR ret;
+	return _Everything_GetResultStringUTF8(dwIndex,EVERYTHING_REQUEST_FILE_NAME,buf,bufsize);
+}
+
+DWORD EVERYTHINGAPI Everything_GetResultPathUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize)
+{
+	return _Everything_GetResultStringUTF8(dwIndex,EVERYTHING_REQUEST_PATH,buf,bufsize);
+}
+
+DWORD EVERYTHINGAPI Everything_GetResultFullPathNameUTF8(DWORD dwIndex,LPSTR buf,DWORD bufsize)
+{
+	DWORD len;
 	
 	_Everything_Lock();
-
-	if (_Everything_List)
+	
+	if ((_Everything_List) || (_Everything_List2))
 	{
 		if (_Everything_IsValidResultIndex(dwIndex))
 		{
-			ret = EVERYTHING_IPC_ITEMPATHA(_Everything_List,&((EVERYTHING_IPC_LISTA *)_Everything_List)->items[dwIndex]);
-		}
-		else
-		{
-			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
+			const void *full_path_and_name;
+			const void *path;
+			const void *name;
 			
-			ret = NULL;
-		}
-	}
-	else
-	if ((_Everything_List2) && (!_Everything_IsUnicodeQuery))
-	{
-		if (_Everything_IsValidResultIndex(dwIndex))
-		{
-			ret = _Everything_GetRequestData(dwIndex,EVERYTHING_REQUEST_PATH);
+			full_path_and_name = _Everything_GetResultString(dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME);
+			path = _Everything_GetResultString(dwIndex,EVERYTHING_REQUEST_PATH);
+			name = _Everything_GetResultString(dwIndex,EVERYTHING_REQUEST_FILE_NAME);
 			
-			if (ret)
+			if (full_path_and_name)
 			{
-				// skip length in characters.
-				ret = (LPCSTR)(((char *)ret) + sizeof(DWORD));
+				// we got the full path and name already.
+				len = _Everything_CopyUTF8(buf,bufsize,0,full_path_and_name);
+			}
+			else
+			if ((path) && (name))
+			{
+				len = _Everything_CopyUTF8(buf,bufsize,0,path);
+				
+				if (len)
+				{
+					if (_Everything_IsUnicodeQuery)
+					{
+						len = _Everything_CopyA(buf,bufsize,len,_Everything_IsSchemeNameW(path) ? "/" : "\\");
+					}
+					else
+					{
+						len = _Everything_CopyA(buf,bufsize,len,_Everything_IsSchemeNameA(path) ? "/" : "\\");
+					}
+				}
+				
+				len = _Everything_CopyUTF8(buf,bufsize,len,name);
 			}
 			else
 			{
+				// path or name data not available.
 				_Everything_LastError = EVERYTHING_ERROR_INVALIDREQUEST;
+				
+				len = _Everything_CopyA(buf,bufsize,0,"");
 			}
 		}
 		else
 		{
 			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
 			
-			ret = NULL;
+			len = _Everything_CopyA(buf,bufsize,0,"");
 		}
 	}
 	else
 	{
 		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 
-		ret = NULL;
+		len = _Everything_CopyA(buf,bufsize,0,"");
 	}
 
 	_Everything_Unlock();
 	
-	return ret;
+	return len;
 }
 
-// max is in chars
-static DWORD _Everything_CopyW(LPWSTR buf,DWORD bufmax,DWORD catlen,LPCWSTR s)
+// read a length prefixed version 2 string, returns the data following it.
+static const char *_Everything_ReadStringView(const char *p,DWORD charsize,_EVERYTHING_STRINGVIEW *view)
 {
-	DWORD wlen;
-
-	if (buf)
-	{
-		buf += catlen;
-		bufmax -= catlen;
-	}
-	
-	wlen = _Everything_StringLengthW(s);
-	if (!wlen) 
-	{
-		if (buf)
-		{
-			buf[wlen] = 0;
-		}
-	
-		return catlen;
-	}
-
-	// terminate
-	if (wlen > bufmax-1) wlen = bufmax-1;
-
-	if (buf)
-	{
-		CopyMemory(buf,s,wlen*sizeof(WCHAR));
-
-		buf[wlen] = 0;
-	}
+	view->len = *(const DWORD *)p;
+	view->ptr = p + sizeof(DWORD);
 	
-	return wlen + catlen;
+	return p + sizeof(DWORD) + (view->len + 1) * charsize;
 }
 
-static DWORD _Everything_CopyA(LPSTR buf,DWORD max,DWORD catlen,LPCSTR s)
+// fill one record, walking the item data once.
+// assumes dwIndex is valid.
+static void _Everything_GetRecord(const _EVERYTHING_SNAPSHOT *snapshot,DWORD dwIndex,_EVERYTHING_RESULTRECORD *record)
 {
-	DWORD len;
-	
-	if (buf)
-	{
-		buf += catlen;
-		max -= catlen;
-	}
+	ZeroMemory(record,sizeof(_EVERYTHING_RESULTRECORD));
 	
-	len = _Everything_StringLengthA(s);
-	if (!len) 
+	if (snapshot->list)
 	{
-		if (buf)
+		_Everything_GetSnapshotView(snapshot,dwIndex,EVERYTHING_REQUEST_FILE_NAME,&record->file_name);
+		_Everything_GetSnapshotView(snapshot,dwIndex,EVERYTHING_REQUEST_PATH,&record->path);
+		
+		record->request_flags = EVERYTHING_REQUEST_FILE_NAME | EVERYTHING_REQUEST_PATH;
+
+		if (snapshot->is_unicode)
 		{
-			buf[len] = 0;
+			record->flags = ((EVERYTHING_IPC_LISTW *)snapshot->list)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER | EVERYTHING_IPC_DRIVE);
+		}
+		else
+		{
+			record->flags = ((EVERYTHING_IPC_LISTA *)snapshot->list)->items[dwIndex].flags & (EVERYTHING_IPC_FOLDER | EVERYTHING_IPC_DRIVE);
 		}
-	
-		return catlen;
 	}
-
-	// terminate
-	if (len > max-1) len = max-1;
-
-	if (buf)
+	else
 	{
-		CopyMemory(buf,s,len*sizeof(char));
-
-		buf[len] = 0;
+		EVERYTHING_IPC_ITEM2 *item;
+		const char *p;
+		DWORD request_flags;
+		DWORD charsize;
+		_EVERYTHING_STRINGVIEW skip;
+		
+		item = ((EVERYTHING_IPC_ITEM2 *)(snapshot->list2 + 1)) + dwIndex;
+		p = ((const char *)snapshot->list2) + item->data_offset;
+		request_flags = snapshot->list2->request_flags;
+		charsize = snapshot->is_unicode ? sizeof(WCHAR) : sizeof(CHAR);
+		
+		record->flags = item->flags & (EVERYTHING_IPC_FOLDER | EVERYTHING_IPC_DRIVE);
+		
+		// same order as _Everything_GetRequestData.
+		if (request_flags & EVERYTHING_REQUEST_FILE_NAME)
+		{
+			p = _Everything_ReadStringView(p,charsize,&record->file_name);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_PATH)
+		{
+			p = _Everything_ReadStringView(p,charsize,&record->path);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME)
+		{
+			p = _Everything_ReadStringView(p,charsize,&skip);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_EXTENSION)
+		{
+			p = _Everything_ReadStringView(p,charsize,&skip);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_SIZE)
+		{
+			CopyMemory(&record->size,p,sizeof(LARGE_INTEGER));
+			p += sizeof(LARGE_INTEGER);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_DATE_CREATED)
+		{
+			CopyMemory(&record->date_created,p,sizeof(FILETIME));
+			p += sizeof(FILETIME);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_DATE_MODIFIED)
+		{
+			CopyMemory(&record->date_modified,p,sizeof(FILETIME));
+			p += sizeof(FILETIME);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_DATE_ACCESSED)
+		{
+			p += sizeof(FILETIME);
+		}
+		
+		if (request_flags & EVERYTHING_REQUEST_ATTRIBUTES)
+		{
+			CopyMemory(&record->attributes,p,sizeof(DWORD));
+		}
+		
+		record->request_flags = request_flags & (EVERYTHING_REQUEST_FILE_NAME | EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_SIZE | EVERYTHING_REQUEST_DATE_CREATED | EVERYTHING_REQUEST_DATE_MODIFIED | EVERYTHING_REQUEST_ATTRIBUTES);
 	}
-	
-	return len + catlen;
-
 }
 
-// max is in chars
-static DWORD _Everything_CopyWFromA(LPWSTR buf,DWORD bufmax,DWORD catlen,LPCSTR s)
+// fill records for dwCount results from dwStart under one lock.
+// returns the number of records filled.
+// does not take the lock.
+static DWORD _Everything_GetSnapshotRecords(const _EVERYTHING_SNAPSHOT *snapshot,DWORD dwStart,DWORD dwCount,BOOL bUnicode,_EVERYTHING_RESULTRECORD *records)
 {
-	DWORD wlen;
-
-	if (buf)
-	{
-		buf += catlen;
-		bufmax -= catlen;
-	}
+	DWORD ret;
 	
-	wlen = MultiByteToWideChar(CP_ACP,0,s,_Everything_StringLengthA(s),0,0);
-	if (!wlen) 
+	ret = 0;
+	
+	if ((snapshot) && (snapshot->is_unicode == bUnicode))
 	{
-		if (buf)
+		DWORD numresults;
+		
+		numresults = _Everything_GetSnapshotNumItems(snapshot);
+		
+		if (dwStart < numresults)
 		{
-			buf[wlen] = 0;
+			DWORD i;
+			
+			if (dwCount > numresults - dwStart)
+			{
+				dwCount = numresults - dwStart;
+			}
+			
+			for(i=0;i<dwCount;i++)
+			{
+				_Everything_GetRecord(snapshot,dwStart + i,records + i);
+			}
+			
+			ret = dwCount;
+		}
+		else
+		{
+			_Everything_LastError = EVERYTHING_ERROR_INVALIDINDEX;
 		}
-	
-		return catlen;
 	}
-
-	// terminate
-	if (wlen > bufmax-1) wlen = bufmax-1;
-
-	if (buf)
+	else
 	{
-		MultiByteToWideChar(CP_ACP,0,s,_Everything_StringLengthA(s),buf,wlen);
-
-		buf[wlen] = 0;
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 	}
 	
-	return wlen + catlen;
+	return ret;
 }
 
-static DWORD _Everything_CopyAFromW(LPSTR buf,DWORD max,DWORD catlen,LPCWSTR s)
+static DWORD _Everything_GetResultRecords(DWORD dwStart,DWORD dwCount,BOOL bUnicode,_EVERYTHING_RESULTRECORD *records)
 {
-	DWORD len;
+	DWORD ret;
 	
-	if (buf)
-	{
-		buf += catlen;
-		max -= catlen;
-	}
+	_Everything_Lock();
 	
-	len = WideCharToMultiByte(CP_ACP,0,s,_Everything_StringLengthW(s),0,0,0,0);
-	if (!len) 
-	{
-		if (buf)
-		{
-			buf[len] = 0;
-		}
+	ret = _Everything_GetSnapshotRecords(_Everything_Snapshot,dwStart,dwCount,bUnicode,records);
 	
-		return catlen;
-	}
-
-	// terminate
-	if (len > max-1) len = max-1;
-
-	if (buf)
-	{
-		WideCharToMultiByte(CP_ACP,0,s,_Everything_StringLengthW(s),buf,len,0,0);
-
-		buf[len] = 0;
-	}
+	_Everything_Unlock();
 	
-	return len + catlen;
+	return ret;
+}
 
+DWORD EVERYTHINGAPI Everything_GetResultRecordsW(DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDW *lpRecords)
+{
+	return _Everything_GetResultRecords(dwStart,dwCount,TRUE,(_EVERYTHING_RESULTRECORD *)lpRecords);
+}
+
+DWORD EVERYTHINGAPI Everything_GetResultRecordsA(DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDA *lpRecords)
+{
+	return _Everything_GetResultRecords(dwStart,dwCount,FALSE,(_EVERYTHING_RESULTRECORD *)lpRecords);
 }
 
 DWORD EVERYTHINGAPI Everything_GetResultFullPathNameW(DWORD dwIndex,LPWSTR wbuf,DWORD wbuf_size_in_wchars)
@@ -2076,177 +5009,602 @@ BOOL EVERYTHINGAPI Everything_IsQueryReply(UINT message,WPARAM wParam,LPARAM lPa
 {
 	if (message == WM_COPYDATA)
 	{
-		COPYDATASTRUCT *cds = (COPYDATASTRUCT *)lParam;
+		COPYDATASTRUCT *cds = (COPYDATASTRUCT *)lParam;
+		
+		if (cds)
+		{
+			if ((cds->dwData == _Everything_ReplyID) && (cds->dwData == dwId))
+			{
+				if (_Everything_QueryVersion == 2)
+				{
+					if (_Everything_SetResultList(cds->lpData,cds->cbData))
+					{
+						_Everything_LastError = 0;
+					}
+					
+					return TRUE;
+				}
+				else
+				if (_Everything_QueryVersion == 1)
+				{
+					if (_Everything_IsUnicodeQuery)				
+					{
+						if (_Everything_SetResultList(cds->lpData,cds->cbData))
+						{
+							_Everything_LastError = 0;
+						}
+						
+						return TRUE;
+					}
+					else
+					{
+						if (_Everything_SetResultList(cds->lpData,cds->cbData))
+						{
+							_Everything_LastError = 0;
+						}
+
+						return TRUE;
+					}
+				}
+			}
+		}
+	}
+	
+	return FALSE;
+}
+
+void EVERYTHINGAPI Everything_Reset(void)
+{
+	_Everything_Lock();
+	
+	if (_Everything_Search)
+	{
+		_Everything_Free(_Everything_Search);
+		
+		_Everything_Search = 0;
+	}
+	
+	_Everything_FreeLists();
+
+	// reset state
+	_Everything_MatchPath = FALSE;
+	_Everything_MatchCase = FALSE;
+	_Everything_MatchWholeWord = FALSE;
+	_Everything_Regex = FALSE;
+	_Everything_LastError = FALSE;
+	_Everything_Max = EVERYTHING_IPC_ALLRESULTS;
+	_Everything_Offset = 0;
+	_Everything_Sort = EVERYTHING_SORT_NAME_ASCENDING;
+	_Everything_RequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+	_Everything_Timeout = INFINITE;
+	_Everything_WaitForReadyEnabled = FALSE;
+	_Everything_IsUnicodeQuery = FALSE;
+	_Everything_IsUnicodeSearch = FALSE;
+
+	_Everything_Unlock();
+}
+
+void EVERYTHINGAPI Everything_CleanUp(void)
+{
+	Everything_Reset();
+	Everything_FlushQueryCache();
+	DeleteCriticalSection(&_Everything_cs);
+	DeleteCriticalSection(&_Everything_FlightCS);
+	
+	ZeroMemory(&_Everything_Capabilities,sizeof(_EVERYTHING_CAPABILITIES));
+	
+	if (_Everything_CancelEvent)
+	{
+		CloseHandle(_Everything_CancelEvent);
+		
+		_Everything_CancelEvent = NULL;
+	}
+	
+	_Everything_Initialized = 0;
+}
+
+static void *_Everything_Alloc(DWORD size)
+{
+	return HeapAlloc(GetProcessHeap(),0,size);
+}
+
+static void _Everything_Free(void *ptr)
+{
+	HeapFree(GetProcessHeap(),0,ptr);
+}
+
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListSort(void)
+{
+	DWORD dwSort;
+	
+	_Everything_Lock();
+	
+	dwSort = EVERYTHING_SORT_NAME_ASCENDING;
+	
+	if (_Everything_List2)
+	{
+		dwSort = _Everything_List2->sort_type;
+	}
+
+	_Everything_Unlock();	
+	
+	return dwSort;
+}
+
+EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListRequestFlags(void)
+{
+	DWORD dwRequestFlags;
+	
+	_Everything_Lock();
+	
+	dwRequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+	
+	if (_Everything_List2)
+	{
+		dwRequestFlags = _Everything_List2->request_flags;
+	}
+
+	_Everything_Unlock();	
+	
+	return dwRequestFlags;
+}
+
+// the size in bytes of the string at offset in a version 1 reply, with its null terminator.
+// the reply must end with a null terminator, so that a string starting inside it also ends inside it.
+// returns 0 if the string does not start inside the reply.
+static DWORD _Everything_GetListStringSize(const void *data,DWORD size,DWORD offset,BOOL is_unicode)
+{
+	const BYTE *p;
+	
+	p = (const BYTE *)data + offset;
+	
+	if (is_unicode)
+	{
+		if ((offset >= size) || (offset % sizeof(WCHAR)))
+		{
+			return 0;
+		}
+		
+		return (_Everything_StringLengthW((LPCWSTR)p) + 1) * sizeof(WCHAR);
+	}
+	
+	if (offset >= size)
+	{
+		return 0;
+	}
+	
+	return _Everything_StringLengthA((LPCSTR)p) + 1;
+}
+
+// avoid other libs
+static BOOL _Everything_IsEqualMemory(const void *a,const void *b,DWORD size)
+{
+	const BYTE *pa;
+	const BYTE *pb;
+	DWORD i;
+	
+	pa = (const BYTE *)a;
+	pb = (const BYTE *)b;
+	
+	for(i=0;i<size;i++)
+	{
+		if (pa[i] != pb[i])
+		{
+			return FALSE;
+		}
+	}
+	
+	return TRUE;
+}
+
+// copy a version 1 reply keeping each distinct path once.
+// the reply repeats the path of every result, and most results share their folder with others.
+// the results in the same folder point at the same text, so callers can tell them by their path pointers.
+// returns NULL if the reply is not a well formed list, or there is not enough memory.
+static void *_Everything_InternListPaths(const void *data,DWORD size,BOOL is_unicode,DWORD *interned_size)
+{
+	const EVERYTHING_IPC_LISTA *list;
+	EVERYTHING_IPC_LISTA *copy;
+	DWORD charsize;
+	DWORD numitems;
+	DWORD header_size;
+	DWORD slot_count;
+	DWORD *slots;
+	DWORD *firsts;
+	DWORD *path_sizes;
+	DWORD total;
+	DWORD d;
+	DWORD i;
+	
+	// the A and W items only differ in the strings they point at.
+	list = (const EVERYTHING_IPC_LISTA *)data;
+	charsize = is_unicode ? sizeof(WCHAR) : sizeof(CHAR);
+	header_size = (DWORD)((const BYTE *)list->items - (const BYTE *)list);
+	
+	if (size < header_size + charsize)
+	{
+		return NULL;
+	}
+	
+	if ((((const BYTE *)data)[size - 1]) || (((const BYTE *)data)[size - charsize]))
+	{
+		return NULL;
+	}
+	
+	numitems = list->numitems;
+	
+	if (numitems > (size - header_size) / sizeof(EVERYTHING_IPC_ITEMA))
+	{
+		return NULL;
+	}
+	
+	header_size += numitems * sizeof(EVERYTHING_IPC_ITEMA);
+	
+	slot_count = 16;
+	
+	while (slot_count < numitems * 2)
+	{
+		slot_count *= 2;
+	}
+	
+	// a slot holds the first result with a path plus 1, 0 if the slot is free.
+	slots = _Everything_Alloc(slot_count * sizeof(DWORD));
+	firsts = _Everything_Alloc((numitems * 2 + 1) * sizeof(DWORD));
+	
+	if ((!slots) || (!firsts))
+	{
+		if (slots)
+		{
+			_Everything_Free(slots);
+		}
+		
+		if (firsts)
+		{
+			_Everything_Free(firsts);
+		}
+		
+		return NULL;
+	}
+	
+	ZeroMemory(slots,slot_count * sizeof(DWORD));
+	path_sizes = firsts + numitems;
+	total = header_size;
+	
+	for(i=0;i<numitems;i++)
+	{
+		const BYTE *path;
+		DWORD name_size;
+		DWORD hash;
+		DWORD slot;
+		DWORD j;
+		
+		name_size = _Everything_GetListStringSize(data,size,list->items[i].filename_offset,is_unicode);
+		path_sizes[i] = _Everything_GetListStringSize(data,size,list->items[i].path_offset,is_unicode);
+		
+		if ((!name_size) || (!path_sizes[i]))
+		{
+			_Everything_Free(firsts);
+			_Everything_Free(slots);
+			
+			return NULL;
+		}
+		
+		path = (const BYTE *)data + list->items[i].path_offset;
+		
+		// FNV-1a
+		hash = 2166136261U;
+		
+		for(j=0;j<path_sizes[i];j++)
+		{
+			hash = (hash ^ path[j]) * 16777619U;
+		}
+		
+		for(slot=hash&(slot_count-1);slots[slot];slot=(slot+1)&(slot_count-1))
+		{
+			DWORD first;
+			
+			first = slots[slot] - 1;
+			
+			if ((path_sizes[first] == path_sizes[i]) && (_Everything_IsEqualMemory((const BYTE *)data + list->items[first].path_offset,path,path_sizes[i])))
+			{
+				break;
+			}
+		}
+		
+		if (slots[slot])
+		{
+			firsts[i] = slots[slot] - 1;
+		}
+		else
+		{
+			slots[slot] = i + 1;
+			firsts[i] = i;
+			total += path_sizes[i];
+		}
+		
+		total += name_size;
+	}
+	
+	_Everything_Free(slots);
+	
+	copy = _Everything_Alloc(total);
+	if (!copy)
+	{
+		_Everything_Free(firsts);
+		
+		return NULL;
+	}
+	
+	CopyMemory(copy,data,header_size);
+	d = header_size;
+	
+	for(i=0;i<numitems;i++)
+	{
+		DWORD name_size;
 		
-		if (cds)
+		name_size = _Everything_GetListStringSize(data,size,list->items[i].filename_offset,is_unicode);
+		CopyMemory((BYTE *)copy + d,(const BYTE *)data + list->items[i].filename_offset,name_size);
+		copy->items[i].filename_offset = d;
+		d += name_size;
+		
+		if (firsts[i] == i)
 		{
-			if ((cds->dwData == _Everything_ReplyID) && (cds->dwData == dwId))
-			{
-				if (_Everything_QueryVersion == 2)
-				{
-					_Everything_FreeLists();
-
-					_Everything_List2 = _Everything_Alloc(cds->cbData);
-						
-					if (_Everything_List2)
-					{
-						_Everything_LastError = 0;
-						
-						CopyMemory(_Everything_List2,cds->lpData,cds->cbData);
-					}
-					else
-					{
-						_Everything_LastError = EVERYTHING_ERROR_MEMORY;
-					}
-					
-					return TRUE;
-				}
-				else
-				if (_Everything_QueryVersion == 1)
-				{
-					if (_Everything_IsUnicodeQuery)				
-					{
-						_Everything_FreeLists();
-
-						_Everything_List = _Everything_Alloc(cds->cbData);
-						
-						if (_Everything_List)
-						{
-							_Everything_LastError = 0;
-							
-							CopyMemory(_Everything_List,cds->lpData,cds->cbData);
-						}
-						else
-						{
-							_Everything_LastError = EVERYTHING_ERROR_MEMORY;
-						}
-						
-						return TRUE;
-					}
-					else
-					{
-						_Everything_FreeLists();
-						
-						_Everything_List = _Everything_Alloc(cds->cbData);
-						
-						if (_Everything_List)
-						{
-							_Everything_LastError = 0;
-							
-							CopyMemory(_Everything_List,cds->lpData,cds->cbData);
-						}
-						else
-						{
-							_Everything_LastError = EVERYTHING_ERROR_MEMORY;
-						}
-
-						return TRUE;
-					}
-				}
-			}
+			CopyMemory((BYTE *)copy + d,(const BYTE *)data + list->items[i].path_offset,path_sizes[i]);
+			copy->items[i].path_offset = d;
+			d += path_sizes[i];
+		}
+		else
+		{
+			copy->items[i].path_offset = copy->items[firsts[i]].path_offset;
 		}
 	}
 	
-	return FALSE;
+	_Everything_Free(firsts);
+	
+	*interned_size = total;
+	
+	return copy;
 }
 
-void EVERYTHINGAPI Everything_Reset(void)
+// take a copy of a reply list.
+// version 1 lists are copied with their paths interned, see _Everything_InternListPaths.
+static _EVERYTHING_SNAPSHOT *_Everything_CreateSnapshot(const void *data,DWORD size,BOOL is_list2,BOOL is_unicode)
 {
-	_Everything_Lock();
+	_EVERYTHING_SNAPSHOT *snapshot;
+	void *list;
 	
-	if (_Everything_Search)
+	snapshot = _Everything_Alloc(sizeof(_EVERYTHING_SNAPSHOT));
+	if (!snapshot)
 	{
-		_Everything_Free(_Everything_Search);
+		return NULL;
+	}
+	
+	list = is_list2 ? NULL : _Everything_InternListPaths(data,size,is_unicode,&size);
+	
+	if (!list)
+	{
+		list = _Everything_Alloc(size);
+		if (!list)
+		{
+			_Everything_Free(snapshot);
+			
+			return NULL;
+		}
 		
-		_Everything_Search = 0;
+		CopyMemory(list,data,size);
 	}
 	
-	_Everything_FreeLists();
-
-	// reset state
-	_Everything_MatchPath = FALSE;
-	_Everything_MatchCase = FALSE;
-	_Everything_MatchWholeWord = FALSE;
-	_Everything_Regex = FALSE;
-	_Everything_LastError = FALSE;
-	_Everything_Max = EVERYTHING_IPC_ALLRESULTS;
-	_Everything_Offset = 0;
-	_Everything_Sort = EVERYTHING_SORT_NAME_ASCENDING;
-	_Everything_RequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
-	_Everything_IsUnicodeQuery = FALSE;
-	_Everything_IsUnicodeSearch = FALSE;
-
-	_Everything_Unlock();
+	snapshot->ref_count = 1;
+	snapshot->is_unicode = is_unicode;
+	snapshot->size = size;
+	snapshot->list = is_list2 ? NULL : list;
+	snapshot->list2 = is_list2 ? list : NULL;
+	snapshot->full_path_views = NULL;
+	
+	return snapshot;
 }
 
-void EVERYTHINGAPI Everything_CleanUp(void)
+static void _Everything_AddRefSnapshot(_EVERYTHING_SNAPSHOT *snapshot)
 {
-	Everything_Reset();
-	DeleteCriticalSection(&_Everything_cs);
-	_Everything_Initialized = 0;
+	InterlockedIncrement(&snapshot->ref_count);
 }
 
-static void *_Everything_Alloc(DWORD size)
+// the last reference frees the snapshot, from any thread.
+static void _Everything_ReleaseSnapshot(_EVERYTHING_SNAPSHOT *snapshot)
 {
-	return HeapAlloc(GetProcessHeap(),0,size);
+	if (InterlockedDecrement(&snapshot->ref_count) == 0)
+	{
+		if (snapshot->full_path_views)
+		{
+			_Everything_Free(snapshot->full_path_views);
+		}
+		
+		_Everything_Free(snapshot->list ? snapshot->list : snapshot->list2);
+		_Everything_Free(snapshot);
+	}
 }
 
-static void _Everything_Free(void *ptr)
+static void _Everything_SetCurrentSnapshot(_EVERYTHING_SNAPSHOT *snapshot)
 {
-	HeapFree(GetProcessHeap(),0,ptr);
+	_Everything_Snapshot = snapshot;
+	_Everything_List = snapshot->list;
+	_Everything_List2 = snapshot->list2;
 }
 
-EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListSort(void)
+// make the current results the reply data.
+static BOOL _Everything_SetResultList(const void *data,DWORD size)
 {
-	DWORD dwSort;
+	_EVERYTHING_SNAPSHOT *snapshot;
 	
-	_Everything_Lock();
+	_Everything_FreeLists();
 	
-	dwSort = EVERYTHING_SORT_NAME_ASCENDING;
+	snapshot = _Everything_CreateSnapshot(data,size,_Everything_QueryVersion == 2,_Everything_IsUnicodeQuery);
+	if (!snapshot)
+	{
+		_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+		
+		return FALSE;
+	}
 	
-	if (_Everything_List2)
+	_Everything_SetCurrentSnapshot(snapshot);
+	
+	return TRUE;
+}
+
+// make the current results safe to modify in place.
+// they are copied if a caller holds a snapshot of them.
+// a caller can only get a new reference with the lock held, so a count of 1 stays 1.
+static BOOL _Everything_UnshareSnapshot(void)
+{
+	if (_Everything_Snapshot->ref_count > 1)
 	{
-		dwSort = _Everything_List2->sort_type;
+		_EVERYTHING_SNAPSHOT *copy;
+		
+		copy = _Everything_CreateSnapshot(_Everything_Snapshot->list ? _Everything_Snapshot->list : _Everything_Snapshot->list2,_Everything_Snapshot->size,_Everything_Snapshot->list2 != NULL,_Everything_Snapshot->is_unicode);
+		if (!copy)
+		{
+			_Everything_LastError = EVERYTHING_ERROR_MEMORY;
+			
+			return FALSE;
+		}
+		
+		_Everything_ReleaseSnapshot(_Everything_Snapshot);
+		
+		_Everything_SetCurrentSnapshot(copy);
 	}
+	
+	return TRUE;
+}
 
-	_Everything_Unlock();	
+static void _Everything_FreeLists(void)
+{
+	if (_Everything_Snapshot)
+	{
+		_Everything_ReleaseSnapshot(_Everything_Snapshot);
+		
+		_Everything_Snapshot = 0;
+	}
 	
-	return dwSort;
+	_Everything_List = 0;
+	_Everything_List2 = 0;
 }
 
-EVERYTHINGUSERAPI DWORD EVERYTHINGAPI Everything_GetResultListRequestFlags(void)
+EVERYTHING_SNAPSHOT EVERYTHINGAPI Everything_GetResultSnapshot(void)
 {
-	DWORD dwRequestFlags;
+	_EVERYTHING_SNAPSHOT *ret;
 	
 	_Everything_Lock();
 	
-	dwRequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+	ret = _Everything_Snapshot;
 	
-	if (_Everything_List2)
+	if (ret)
 	{
-		dwRequestFlags = _Everything_List2->request_flags;
+		_Everything_AddRefSnapshot(ret);
+	}
+	else
+	{
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 	}
-
-	_Everything_Unlock();	
 	
-	return dwRequestFlags;
+	_Everything_Unlock();
+	
+	return ret;
 }
 
-static void _Everything_FreeLists(void)
+void EVERYTHINGAPI Everything_AddRefSnapshot(EVERYTHING_SNAPSHOT hSnapshot)
 {
-	if (_Everything_List)
+	if (hSnapshot)
+	{
+		_Everything_AddRefSnapshot(hSnapshot);
+	}
+}
+
+void EVERYTHINGAPI Everything_ReleaseSnapshot(EVERYTHING_SNAPSHOT hSnapshot)
+{
+	if (hSnapshot)
+	{
+		_Everything_ReleaseSnapshot(hSnapshot);
+	}
+}
+
+BOOL EVERYTHINGAPI Everything_IsSnapshotUnicode(EVERYTHING_SNAPSHOT hSnapshot)
+{
+	return hSnapshot ? hSnapshot->is_unicode : FALSE;
+}
+
+DWORD EVERYTHINGAPI Everything_GetSnapshotNumResults(EVERYTHING_SNAPSHOT hSnapshot)
+{
+	if (!hSnapshot)
 	{
-		_Everything_Free(_Everything_List);
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 		
-		_Everything_List = 0;
+		return 0;
 	}
+	
+	return _Everything_GetSnapshotNumItems(hSnapshot);
+}
 
-	if (_Everything_List2)
+// the number of results the query matched, not just the ones in the snapshot.
+DWORD EVERYTHINGAPI Everything_GetSnapshotTotResults(EVERYTHING_SNAPSHOT hSnapshot)
+{
+	if (!hSnapshot)
 	{
-		_Everything_Free(_Everything_List2);
+		_Everything_LastError = EVERYTHING_ERROR_INVALIDCALL;
 		
-		_Everything_List2 = 0;
+		return 0;
+	}
+	
+	if (hSnapshot->list2)
+	{
+		return hSnapshot->list2->totitems;
+	}
+	
+	if (hSnapshot->is_unicode)
+	{
+		return ((EVERYTHING_IPC_LISTW *)hSnapshot->list)->totitems;
 	}
+	
+	return ((EVERYTHING_IPC_LISTA *)hSnapshot->list)->totitems;
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotFileNameViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_FILE_NAME,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotFileNameViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_FILE_NAME,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotPathViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_PATH,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotPathViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_PATH,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotFullPathNameViewW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWW *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME,TRUE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+BOOL EVERYTHINGAPI Everything_GetSnapshotFullPathNameViewA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwIndex,EVERYTHING_STRINGVIEWA *lpView)
+{
+	return _Everything_GetSnapshotStringView(hSnapshot,dwIndex,EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME,FALSE,(_EVERYTHING_STRINGVIEW *)lpView);
+}
+
+DWORD EVERYTHINGAPI Everything_GetSnapshotRecordsW(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDW *lpRecords)
+{
+	return _Everything_GetSnapshotRecords(hSnapshot,dwStart,dwCount,TRUE,(_EVERYTHING_RESULTRECORD *)lpRecords);
+}
+
+DWORD EVERYTHINGAPI Everything_GetSnapshotRecordsA(EVERYTHING_SNAPSHOT hSnapshot,DWORD dwStart,DWORD dwCount,EVERYTHING_RESULTRECORDA *lpRecords)
+{
+	return _Everything_GetSnapshotRecords(hSnapshot,dwStart,dwCount,FALSE,(_EVERYTHING_RESULTRECORD *)lpRecords);
 }
 
 static BOOL _Everything_IsValidResultIndex(DWORD dwIndex)
@@ -2266,15 +5624,21 @@ static BOOL _Everything_IsValidResultIndex(DWORD dwIndex)
 
 // assumes _Everything_List2 and dwIndex are valid.
 static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
+{
+	return _Everything_GetListRequestData(_Everything_List2,_Everything_IsUnicodeQuery,dwIndex,dwRequestType);
+}
+
+// assumes dwIndex is valid.
+static void *_Everything_GetListRequestData(EVERYTHING_IPC_LIST2 *list2,BOOL is_unicode,DWORD dwIndex,DWORD dwRequestType)
 {
 	char *p;
 	EVERYTHING_IPC_ITEM2 *items;
 	
-	items = (EVERYTHING_IPC_ITEM2 *)(_Everything_List2 + 1);
+	items = (EVERYTHING_IPC_ITEM2 *)(list2 + 1);
 	
-	p = ((char *)_Everything_List2) + items[dwIndex].data_offset;
+	p = ((char *)list2) + items[dwIndex].data_offset;
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_FILE_NAME)
+	if (list2->request_flags & EVERYTHING_REQUEST_FILE_NAME)
 	{
 		DWORD len;
 
@@ -2286,7 +5650,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2296,7 +5660,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}		
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_PATH)
+	if (list2->request_flags & EVERYTHING_REQUEST_PATH)
 	{
 		DWORD len;
 		
@@ -2308,7 +5672,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2318,7 +5682,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME)
+	if (list2->request_flags & EVERYTHING_REQUEST_FULL_PATH_AND_FILE_NAME)
 	{
 		DWORD len;
 		
@@ -2330,7 +5694,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2340,7 +5704,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_EXTENSION)
+	if (list2->request_flags & EVERYTHING_REQUEST_EXTENSION)
 	{
 		DWORD len;
 		
@@ -2352,7 +5716,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2362,7 +5726,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_SIZE)
+	if (list2->request_flags & EVERYTHING_REQUEST_SIZE)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_SIZE)	
 		{
@@ -2372,7 +5736,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(LARGE_INTEGER);
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_DATE_CREATED)
+	if (list2->request_flags & EVERYTHING_REQUEST_DATE_CREATED)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_DATE_CREATED)	
 		{
@@ -2382,7 +5746,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(FILETIME);
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_DATE_MODIFIED)
+	if (list2->request_flags & EVERYTHING_REQUEST_DATE_MODIFIED)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_DATE_MODIFIED)	
 		{
@@ -2392,7 +5756,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(FILETIME);
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_DATE_ACCESSED)
+	if (list2->request_flags & EVERYTHING_REQUEST_DATE_ACCESSED)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_DATE_ACCESSED)	
 		{
@@ -2402,7 +5766,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(FILETIME);
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_ATTRIBUTES)
+	if (list2->request_flags & EVERYTHING_REQUEST_ATTRIBUTES)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_ATTRIBUTES)	
 		{
@@ -2412,7 +5776,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(DWORD);
 	}
 		
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_FILE_LIST_FILE_NAME)
+	if (list2->request_flags & EVERYTHING_REQUEST_FILE_LIST_FILE_NAME)
 	{
 		DWORD len;
 		
@@ -2424,7 +5788,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2434,7 +5798,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}	
 		
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_RUN_COUNT)
+	if (list2->request_flags & EVERYTHING_REQUEST_RUN_COUNT)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_RUN_COUNT)	
 		{
@@ -2444,7 +5808,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(DWORD);
 	}	
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_DATE_RUN)
+	if (list2->request_flags & EVERYTHING_REQUEST_DATE_RUN)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_DATE_RUN)	
 		{
@@ -2454,7 +5818,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(FILETIME);
 	}		
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_DATE_RECENTLY_CHANGED)
+	if (list2->request_flags & EVERYTHING_REQUEST_DATE_RECENTLY_CHANGED)
 	{
 		if (dwRequestType == EVERYTHING_REQUEST_DATE_RECENTLY_CHANGED)	
 		{
@@ -2464,7 +5828,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		p += sizeof(FILETIME);
 	}	
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_FILE_NAME)
+	if (list2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_FILE_NAME)
 	{
 		DWORD len;
 		
@@ -2476,7 +5840,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2486,7 +5850,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}		
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_PATH)
+	if (list2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_PATH)
 	{
 		DWORD len;
 		
@@ -2498,7 +5862,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2508,7 +5872,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		}
 	}
 	
-	if (_Everything_List2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_FULL_PATH_AND_FILE_NAME)
+	if (list2->request_flags & EVERYTHING_REQUEST_HIGHLIGHTED_FULL_PATH_AND_FILE_NAME)
 	{
 		DWORD len;
 		
@@ -2520,7 +5884,7 @@ static void *_Everything_GetRequestData(DWORD dwIndex,DWORD dwRequestType)
 		len = *(DWORD *)p;
 		p += sizeof(DWORD);
 		
-		if (_Everything_IsUnicodeQuery)
+		if (is_unicode)
 		{
 			p += (len + 1) * sizeof(WCHAR);
 		}
@@ -2605,6 +5969,11 @@ static void _Everything_ChangeWindowMessageFilter(HWND hwnd)
 		if (_Everything_pChangeWindowMessageFilterEx)
 		{
 			_Everything_pChangeWindowMessageFilterEx(hwnd,WM_COPYDATA,_EVERYTHING_MSGFLT_ALLOW,0);
+			
+			if (_Everything_IPCCreatedMessage)
+			{
+				_Everything_pChangeWindowMessageFilterEx(hwnd,_Everything_IPCCreatedMessage,_EVERYTHING_MSGFLT_ALLOW,0);
+			}
 		}
 	}
 }
@@ -2959,14 +6328,76 @@ BOOL EVERYTHINGAPI Everything_Exit(void)
 	return _Everything_SendAPIBoolCommand(EVERYTHING_IPC_EXIT,0);
 }
 
+// the answer is kept until Everything restarts.
 BOOL EVERYTHINGAPI Everything_IsFastSort(DWORD sortType)
 {
-	return _Everything_SendAPIBoolCommand(EVERYTHING_IPC_IS_FAST_SORT,(LPARAM)sortType);
+	return _Everything_IsIndexed(EVERYTHING_IPC_IS_FAST_SORT,sortType);
 }
 
+// the answer is kept until Everything restarts.
 BOOL EVERYTHINGAPI Everything_IsFileInfoIndexed(DWORD fileInfoType)
 {
-	return _Everything_SendAPIBoolCommand(EVERYTHING_IPC_IS_FILE_INFO_INDEXED,(LPARAM)fileInfoType);
+	return _Everything_IsIndexed(EVERYTHING_IPC_IS_FILE_INFO_INDEXED,fileInfoType);
+}
+
+// ask Everything if a sort or file info is indexed, once per Everything window.
+static BOOL _Everything_IsIndexed(int command,DWORD type)
+{
+	_EVERYTHING_CAPABILITIES *capabilities;
+	HWND everything_hwnd;
+	DWORD *checked;
+	DWORD *indexed;
+	DWORD bit;
+	BOOL ret;
+	
+	_Everything_Lock();
+	
+	everything_hwnd = FindWindow(EVERYTHING_IPC_WNDCLASS,0);
+	if (!everything_hwnd)
+	{
+		_Everything_LastError = EVERYTHING_ERROR_IPC;
+		
+		_Everything_Unlock();
+		
+		return FALSE;
+	}
+	
+	capabilities = _Everything_GetCapabilities(everything_hwnd);
+	
+	if (command == EVERYTHING_IPC_IS_FAST_SORT)
+	{
+		checked = &capabilities->fast_sort_checked;
+		indexed = &capabilities->fast_sort;
+	}
+	else
+	{
+		checked = &capabilities->file_info_checked;
+		indexed = &capabilities->file_info_indexed;
+	}
+	
+	bit = (type < 32) ? ((DWORD)1 << type) : 0;
+	
+	_Everything_LastError = 0;
+	
+	if (*checked & bit)
+	{
+		ret = (*indexed & bit) ? TRUE : FALSE;
+	}
+	else
+	{
+		ret = SendMessage(everything_hwnd,EVERYTHING_WM_IPC,command,(LPARAM)type) ? TRUE : FALSE;
+		
+		*checked |= bit;
+		
+		if (ret)
+		{
+			*indexed |= bit;
+		}
+	}
+	
+	_Everything_Unlock();
+	
+	return ret;
 }
 
 static LRESULT _Everything_SendCopyData(int command,const void *data,int size)
@@ -0,0 +1,464 @@
+// fuzzy.c : ranking candidates by how closely they match what was typed
+//
+// (MIT license - see run.c)
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <process.h>
+#include "fuzzy.h"
+#include "strfold.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FUZZY_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define FUZZY_AVX2
+#include <immintrin.h>
+#endif
+
+#define FUZZY_MAX_THREADS 16
+#define SORT_MAX_SCORES 65536           // Wider score ranges are sorted by comparison
+
+// fzf's scores, as for paths: a word after a \ counts more than after a space
+#define SCORE_MATCH 16
+#define SCORE_GAP_START (-3)
+#define SCORE_GAP_EXTENSION (-1)
+#define BONUS_BOUNDARY (SCORE_MATCH / 2)
+#define BONUS_BOUNDARY_WHITE BONUS_BOUNDARY
+#define BONUS_BOUNDARY_DELIMITER (BONUS_BOUNDARY + 1)
+#define BONUS_NON_WORD (SCORE_MATCH / 2)
+#define BONUS_CAMEL_123 (BONUS_BOUNDARY + SCORE_GAP_EXTENSION)
+#define BONUS_CONSECUTIVE (-(SCORE_GAP_START + SCORE_GAP_EXTENSION))
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+// and run's own
+#define BONUS_FILE_NAME 4           // Per character in the file name
+#define BONUS_EXACT_NAME SCORE_MATCH    // The pattern is the whole name, less its extension
+
+enum CharClass
+{
+    CHAR_WHITE,
+    CHAR_NON_WORD,
+    CHAR_DELIMITER,
+    CHAR_LOWER,
+    CHAR_UPPER,
+    CHAR_NUMBER
+};
+
+struct RankSlice
+{
+    const struct FuzzyPattern *pattern;
+    const struct FuzzyCandidate *candidates;
+    const unsigned *char_masks;
+    const unsigned *indexes;
+    size_t from;
+    size_t to;
+    struct FuzzyMatch *matches;         // Room for to - from
+    size_t n_matches;
+    HANDLE thread;
+};
+
+static int char_class(unsigned char c)
+{
+    if (c >= 'a' && c <= 'z')
+        return CHAR_LOWER;
+    if (c >= 'A' && c <= 'Z')
+        return CHAR_UPPER;
+    if (c >= '0' && c <= '9')
+        return CHAR_NUMBER;
+    if (c == ' ' || c == '\t')
+        return CHAR_WHITE;
+    if (c == '\\' || c == '/' || c == ':' || c == ';' || c == ',' || c == '|')
+        return CHAR_DELIMITER;
+    return c >= 0x80 ? CHAR_LOWER : CHAR_NON_WORD;
+}
+
+// Letters have a bit each; digits and everything else share the rest
+static unsigned char_bit(unsigned char c)
+{
+    c = fold_char(c);
+    if (c >= 'a' && c <= 'z')
+        return 1u << (c - 'a');
+    if (c >= '0' && c <= '9')
+        return 1u << (26 + (c - '0') % 5);
+    return 1u << 31;
+}
+
+static int bonus_at(const char *str, size_t i)
+{
+    int previous = i ? char_class((unsigned char)str[i - 1]) : CHAR_WHITE;
+    int current = char_class((unsigned char)str[i]);
+
+    if (current > CHAR_DELIMITER) {
+        if (previous == CHAR_WHITE)
+            return BONUS_BOUNDARY_WHITE;
+        if (previous == CHAR_DELIMITER)
+            return BONUS_BOUNDARY_DELIMITER;
+        if (previous == CHAR_NON_WORD)
+            return BONUS_BOUNDARY;
+    }
+    if ((previous == CHAR_LOWER && current == CHAR_UPPER) || (previous != CHAR_NUMBER && current == CHAR_NUMBER))
+        return BONUS_CAMEL_123;
+    if (current == CHAR_NON_WORD || current == CHAR_DELIMITER)
+        return BONUS_NON_WORD;
+    if (current == CHAR_WHITE)
+        return BONUS_BOUNDARY_WHITE;
+    return 0;
+}
+
+size_t fuzzy_strip(char *dest, size_t dest_size, const char *text)
+{
+    size_t len = 0;
+
+    for (; *text && len + 1 < dest_size; text++) {
+        if (!strchr("*?<>| \"", *text))
+            dest[len++] = *text;
+    }
+    if (dest_size)
+        dest[len] = '\0';
+
+    return len;
+}
+
+void fuzzy_compile(struct FuzzyPattern *pattern, const char *text, size_t text_len)
+{
+    size_t i;
+
+    memset(pattern, 0, sizeof(*pattern));
+    pattern->len = text_len < FUZZY_MAX_PATTERN ? text_len : FUZZY_MAX_PATTERN;
+
+    for (i = 0; i < pattern->len; i++) {
+        unsigned char c = fold_char((unsigned char)text[i]);
+        unsigned char upper = c >= 'a' && c <= 'z' ? (unsigned char)(c - ('a' - 'A')) : c;
+
+        pattern->folded[i] = (char)c;
+        pattern->forward[c] |= 1ULL << i;
+        pattern->forward[upper] |= 1ULL << i;
+        pattern->backward[c] |= 1ULL << (pattern->len - 1 - i);
+        pattern->backward[upper] |= 1ULL << (pattern->len - 1 - i);
+        pattern->char_mask |= char_bit(c);
+    }
+}
+
+unsigned fuzzy_char_mask(const char *str, size_t len)
+{
+    unsigned mask = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        mask |= char_bit((unsigned char)str[i]);
+
+    return mask;
+}
+
+// Bit k of state is set once pattern[0..k] was seen in order, so the
+// pattern matches when its last bit is. Returns the end of the first match
+// in str[from, to), 0 if there is none.
+static size_t find_end(const struct FuzzyPattern *pattern, const char *str, size_t from, size_t to)
+{
+    unsigned long long last = 1ULL << (pattern->len - 1);
+    unsigned long long state = 0;
+    size_t i;
+
+    for (i = from; i < to; i++) {
+        state |= ((state << 1) | 1) & pattern->forward[(unsigned char)str[i]];
+        if (state & last)
+            return i + 1;
+    }
+
+    return 0;
+}
+
+// The same backwards from end: where the shortest match ending there starts
+static size_t find_start(const struct FuzzyPattern *pattern, const char *str, size_t from, size_t end)
+{
+    unsigned long long last = 1ULL << (pattern->len - 1);
+    unsigned long long state = 0;
+    size_t i;
+
+    for (i = end; i-- > from; ) {
+        state |= ((state << 1) | 1) & pattern->backward[(unsigned char)str[i]];
+        if (state & last)
+            return i;
+    }
+
+    return from;
+}
+
+static int score_window(const struct FuzzyPattern *pattern, const struct FuzzyCandidate *candidate, size_t start, size_t end)
+{
+    const char *str = candidate->str;
+    size_t base = candidate->base;
+    int score = 0;
+    int consecutive = 0;
+    int first_bonus = 0;
+    int is_in_gap = FALSE;
+    size_t k = 0;
+    size_t i;
+
+    for (i = start; i < end; i++) {
+        if (k < pattern->len && fold_char((unsigned char)str[i]) == (unsigned char)pattern->folded[k]) {
+            int bonus = bonus_at(str, i);
+
+            score += SCORE_MATCH;
+            if (consecutive == 0) {
+                first_bonus = bonus;
+            }
+            else {
+                // A run of characters shares the bonus of the boundary it started at
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus)
+                    first_bonus = bonus;
+                if (bonus < first_bonus)
+                    bonus = first_bonus;
+                if (bonus < BONUS_CONSECUTIVE)
+                    bonus = BONUS_CONSECUTIVE;
+            }
+            score += k == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus;
+            if (i >= base)
+                score += BONUS_FILE_NAME;
+
+            is_in_gap = FALSE;
+            consecutive++;
+            k++;
+        }
+        else {
+            score += is_in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            is_in_gap = TRUE;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+    }
+
+    if (start == base && end - start == pattern->len && (end == candidate->len || str[end] == '.'))
+        score += BONUS_EXACT_NAME;
+
+    return score;
+}
+
+int fuzzy_score(const struct FuzzyPattern *pattern, const struct FuzzyCandidate *candidate)
+{
+    const char *str = candidate->str;
+    size_t end;
+    size_t start;
+    int score;
+
+    if (pattern->len == 0)
+        return 0;
+
+    end = find_end(pattern, str, 0, candidate->len);
+    if (!end)
+        return FUZZY_NO_MATCH;
+    start = find_start(pattern, str, 0, end);
+    score = score_window(pattern, candidate, start, end);
+
+    // The first match reaches into the folder; the file name alone may do better
+    if (start < candidate->base) {
+        end = find_end(pattern, str, candidate->base, candidate->len);
+        if (end) {
+            int name_score;
+
+            start = find_start(pattern, str, candidate->base, end);
+            name_score = score_window(pattern, candidate, start, end);
+            if (name_score > score)
+                score = name_score;
+        }
+    }
+
+    return score;
+}
+
+static void score_candidate(struct RankSlice *slice, unsigned index)
+{
+    int score = fuzzy_score(slice->pattern, &slice->candidates[index]);
+
+    if (score != FUZZY_NO_MATCH) {
+        slice->matches[slice->n_matches].index = index;
+        slice->matches[slice->n_matches].score = score;
+        slice->n_matches++;
+    }
+}
+
+static unsigned __stdcall rank_slice(void *param)
+{
+    struct RankSlice *slice = (struct RankSlice *)param;
+    unsigned pattern_mask = slice->pattern->char_mask;
+    size_t i = slice->from;
+
+    slice->n_matches = 0;
+
+    if (slice->indexes) {
+        for (; i < slice->to; i++) {
+            unsigned index = slice->indexes[i];
+
+            if ((slice->char_masks[index] & pattern_mask) == pattern_mask)
+                score_candidate(slice, index);
+        }
+        return 0;
+    }
+
+#ifdef FUZZY_AVX2
+    {
+        __m256i wanted = _mm256_set1_epi32((int)pattern_mask);
+
+        for (; i + 8 <= slice->to; i += 8) {
+            __m256i masks = _mm256_loadu_si256((const __m256i *)(slice->char_masks + i));
+            unsigned hits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(masks, wanted), wanted)));
+            unsigned bit;
+
+            for (bit = 0; hits >> bit; bit++) {
+                if (hits & (1u << bit))
+                    score_candidate(slice, (unsigned)(i + bit));
+            }
+        }
+    }
+#endif
+#ifdef FUZZY_SSE2
+    {
+        __m128i wanted = _mm_set1_epi32((int)pattern_mask);
+
+        for (; i + 4 <= slice->to; i += 4) {
+            __m128i masks = _mm_loadu_si128((const __m128i *)(slice->char_masks + i));
+            unsigned hits = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(masks, wanted), wanted)));
+
+            // Four candidates at most, in order
+            if (hits & 1)
+                score_candidate(slice, (unsigned)i);
+            if (hits & 2)
+                score_candidate(slice, (unsigned)i + 1);
+            if (hits & 4)
+                score_candidate(slice, (unsigned)i + 2);
+            if (hits & 8)
+                score_candidate(slice, (unsigned)i + 3);
+        }
+    }
+#endif
+    for (; i < slice->to; i++) {
+        if ((slice->char_masks[i] & pattern_mask) == pattern_mask)
+            score_candidate(slice, (unsigned)i);
+    }
+
+    return 0;
+}
+
+static int compare_matches(const void *a, const void *b)
+{
+    const struct FuzzyMatch *match_a = (const struct FuzzyMatch *)a;
+    const struct FuzzyMatch *match_b = (const struct FuzzyMatch *)b;
+
+    if (match_a->score != match_b->score)
+        return match_a->score > match_b->score ? -1 : 1;
+
+    return match_a->index < match_b->index ? -1 : match_a->index > match_b->index;
+}
+
+// Scores span a narrow range, so a counting sort does, keeping the order
+// matches came in among equals. Falls back to qsort otherwise.
+static void sort_matches(struct FuzzyMatch *matches, size_t n)
+{
+    struct FuzzyMatch *sorted;
+    size_t *counts;
+    int min_score;
+    int max_score;
+    size_t n_scores;
+    size_t total = 0;
+    size_t i;
+
+    if (n < 2)
+        return;
+
+    min_score = max_score = matches[0].score;
+    for (i = 1; i < n; i++) {
+        if (matches[i].score < min_score)
+            min_score = matches[i].score;
+        if (matches[i].score > max_score)
+            max_score = matches[i].score;
+    }
+
+    n_scores = (size_t)((long long)max_score - min_score + 1);
+    sorted = n_scores <= SORT_MAX_SCORES ? (struct FuzzyMatch *)malloc(n * sizeof(struct FuzzyMatch)) : NULL;
+    counts = sorted ? (size_t *)calloc(n_scores, sizeof(size_t)) : NULL;
+    if (!counts) {
+        free(sorted);
+        qsort(matches, n, sizeof(struct FuzzyMatch), compare_matches);
+        return;
+    }
+
+    // Best first: the highest score starts at 0
+    for (i = 0; i < n; i++)
+        counts[max_score - matches[i].score]++;
+    for (i = 0; i < n_scores; i++) {
+        size_t count = counts[i];
+
+        counts[i] = total;
+        total += count;
+    }
+    for (i = 0; i < n; i++)
+        sorted[counts[max_score - matches[i].score]++] = matches[i];
+
+    memcpy(matches, sorted, n * sizeof(struct FuzzyMatch));
+    free(counts);
+    free(sorted);
+}
+
+static int processor_count()
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? (int)info.dwNumberOfProcessors : 1;
+}
+
+size_t fuzzy_rank(const struct FuzzyPattern *pattern, const struct FuzzyCandidate *candidates, const unsigned *char_masks,
+    const unsigned *indexes, size_t n, struct FuzzyMatch *matches)
+{
+    struct RankSlice slices[FUZZY_MAX_THREADS];
+    size_t n_matches = 0;
+    int n_slices = 1;
+    int i;
+
+    if (n >= 2 * FUZZY_THREAD_MIN) {
+        n_slices = processor_count();
+        if ((size_t)n_slices > n / FUZZY_THREAD_MIN)
+            n_slices = (int)(n / FUZZY_THREAD_MIN);
+        if (n_slices > FUZZY_MAX_THREADS)
+            n_slices = FUZZY_MAX_THREADS;
+    }
+
+    for (i = 0; i < n_slices; i++) {
+        struct RankSlice *slice = &slices[i];
+
+        slice->pattern = pattern;
+        slice->candidates = candidates;
+        slice->char_masks = char_masks;
+        slice->indexes = indexes;
+        slice->from = n * i / n_slices;
+        slice->to = n * (i + 1) / n_slices;
+        slice->matches = matches + slice->from;
+        slice->thread = NULL;
+
+        // This thread takes the first slice itself
+        if (i > 0)
+            slice->thread = (HANDLE)_beginthreadex(NULL, 0, rank_slice, slice, 0, NULL);
+    }
+
+    for (i = 0; i < n_slices; i++) {
+        struct RankSlice *slice = &slices[i];
+
+        if (slice->thread) {
+            WaitForSingleObject(slice->thread, INFINITE);
+            CloseHandle(slice->thread);
+        }
+        else {
+            rank_slice(slice);
+        }
+
+        memmove(matches + n_matches, slice->matches, slice->n_matches * sizeof(struct FuzzyMatch));
+        n_matches += slice->n_matches;
+    }
+
+    sort_matches(matches, n_matches);
+    return n_matches;
+}
@@ -0,0 +1,79 @@
+// fuzzy.h : ranking candidates by how closely they match what was typed
+//
+// (MIT license - see run.c)
+//
+// A pattern matches a candidate path when its characters appear in it in
+// order, ignoring case. Whether and where they do is found bit-parallel: one
+// 64 bit word holds which prefixes of the pattern were seen so far, so each
+// character of the candidate costs a shift, an or and an and whatever the
+// pattern's length. The shortest match ending there is then scored the way
+// fzf does: points per character, bonuses for characters starting a word or
+// a path component or following the one before, and penalties for gaps.
+// There is more for each character in the file name rather than its folder,
+// and for the pattern being the whole name.
+//
+// Ranking a set first drops the candidates missing some character of the
+// pattern by comparing character bitmasks, four candidates at a time with
+// SSE2 (eight with AVX2), and splits sets of more than FUZZY_THREAD_MIN
+// candidates among threads.
+
+#ifndef RUN_FUZZY_H
+#define RUN_FUZZY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FUZZY_MAX_PATTERN 64        // Longer patterns are cut to this
+#define FUZZY_THREAD_MIN 32768      // Candidates worth a thread of their own
+#define FUZZY_NO_MATCH (-0x7fffffff - 1)
+
+struct FuzzyPattern
+{
+    size_t len;
+    char folded[FUZZY_MAX_PATTERN];
+    unsigned long long forward[256];    // Bit i is set for the (either case) character at i
+    unsigned long long backward[256];   // The same for the pattern reversed
+    unsigned char_mask;
+};
+
+struct FuzzyCandidate
+{
+    const char *str;                    // Full path
+    unsigned len;
+    unsigned base;                      // Where the file name starts
+};
+
+struct FuzzyMatch
+{
+    unsigned index;
+    int score;
+};
+
+// Copies text to dest without the characters a fuzzy search leaves out,
+// those Everything's search syntax gives a meaning to (*?<>| and spaces and
+// quotes), so that the search and the ranking see the same pattern. Returns
+// the copy's length.
+size_t fuzzy_strip(char *dest, size_t dest_size, const char *text);
+
+void fuzzy_compile(struct FuzzyPattern *pattern, const char *text, size_t text_len);
+
+// What fuzzy_rank compares to the pattern's before scoring a candidate
+unsigned fuzzy_char_mask(const char *str, size_t len);
+
+// FUZZY_NO_MATCH if the pattern does not match
+int fuzzy_score(const struct FuzzyPattern *pattern, const struct FuzzyCandidate *candidate);
+
+// Scores candidates (or, given indexes, the n candidates they select) and
+// fills matches with the ones that match, best first and in the order they
+// were given among equals. Returns how many there are.
+size_t fuzzy_rank(const struct FuzzyPattern *pattern, const struct FuzzyCandidate *candidates, const unsigned *char_masks,
+    const unsigned *indexes, size_t n, struct FuzzyMatch *matches);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
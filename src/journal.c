@@ -0,0 +1,182 @@
+// journal.c : telling from the NTFS/ReFS change journals what names appeared
+//
+// (MIT license - see run.c)
+//
+
+#include <string.h>
+#include "journal.h"
+
+#define SCAN_BUFFER_SIZE (64 * 1024)
+
+// The journal can be queried on the volume itself, which needs no access
+// rights, or failing that on its root folder
+static HANDLE open_volume(DWORD drive)
+{
+    char volume_path[] = "\\\\.\\A:";
+    char root_path[] = "A:\\";
+    HANDLE volume;
+
+    volume_path[4] = (char)('A' + drive);
+    volume = CreateFileA(volume_path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL);
+    if (volume != INVALID_HANDLE_VALUE)
+        return volume;
+
+    root_path[0] = (char)('A' + drive);
+    return CreateFileA(root_path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+}
+
+int journal_stamp(struct JournalStamp *stamp)
+{
+    DWORD drives = GetLogicalDrives();
+    DWORD drive;
+
+    memset(stamp, 0, sizeof(*stamp));
+    for (drive = 0; drive < JOURNAL_MAX_VOLUMES; drive++) {
+        char root_path[] = "A:\\";
+        struct JournalVolume *volume = &stamp->volumes[stamp->n_volumes];
+        USN_JOURNAL_DATA journal;
+        HANDLE handle;
+        DWORD bytes;
+        BOOL ok;
+
+        if (!(drives & (1 << drive)))
+            continue;
+
+        root_path[0] = (char)('A' + drive);
+        switch (GetDriveTypeA(root_path)) {
+            case DRIVE_FIXED:
+            case DRIVE_REMOVABLE:
+                break;
+            default:
+                continue;
+        }
+
+        // No media
+        if (!GetVolumeInformationA(root_path, NULL, 0, &volume->serial, NULL, NULL, NULL, 0))
+            continue;
+
+        handle = open_volume(drive);
+        if (handle == INVALID_HANDLE_VALUE)
+            return FALSE;
+
+        ok = DeviceIoControl(handle, FSCTL_QUERY_USN_JOURNAL, NULL, 0, &journal, sizeof(journal), &bytes, NULL);
+        CloseHandle(handle);
+        if (!ok)
+            return FALSE;
+
+        volume->drive = drive;
+        volume->journal_id = journal.UsnJournalID;
+        volume->first_usn = journal.FirstUsn;
+        volume->next_usn = journal.NextUsn;
+        stamp->n_volumes++;
+    }
+
+    return TRUE;
+}
+
+int journal_compare(const struct JournalStamp *before, const struct JournalStamp *after)
+{
+    int result = JOURNAL_SAME;
+    DWORD i;
+
+    if (before->n_volumes != after->n_volumes)
+        return JOURNAL_RESET;
+
+    for (i = 0; i < after->n_volumes; i++) {
+        const struct JournalVolume *was = &before->volumes[i];
+        const struct JournalVolume *is = &after->volumes[i];
+
+        if (was->drive != is->drive || was->serial != is->serial || was->journal_id != is->journal_id ||
+            was->next_usn > is->next_usn || was->next_usn < is->first_usn)
+            return JOURNAL_RESET;
+
+        if (was->next_usn != is->next_usn)
+            result = JOURNAL_MOVED;
+    }
+
+    return result;
+}
+
+int journal_scan(const struct JournalVolume *volume, USN from_usn, USN to_usn, ULONGLONG not_before, JOURNAL_NAME_PROC name_proc, void *context)
+{
+    static BYTE buffer[SCAN_BUFFER_SIZE];
+    READ_USN_JOURNAL_DATA_V1 read = { 0 };
+    HANDLE handle = open_volume(volume->drive);
+    int result = JOURNAL_SCAN_DONE;
+
+    if (handle == INVALID_HANDLE_VALUE)
+        return JOURNAL_SCAN_FAILED;
+
+    read.StartUsn = from_usn;
+    read.ReasonMask = USN_REASON_FILE_CREATE | USN_REASON_RENAME_NEW_NAME | USN_REASON_HARD_LINK_CHANGE;
+    read.UsnJournalID = volume->journal_id;
+    read.MinMajorVersion = 2;
+    read.MaxMajorVersion = 3;
+
+    while (result == JOURNAL_SCAN_DONE && read.StartUsn < to_usn) {
+        DWORD bytes;
+        BYTE *record_ptr;
+
+        if (!DeviceIoControl(handle, FSCTL_READ_USN_JOURNAL, &read, sizeof(read), buffer, sizeof(buffer), &bytes, NULL)) {
+            result = JOURNAL_SCAN_FAILED;
+            break;
+        }
+
+        if (bytes <= sizeof(USN))
+            break;
+
+        for (record_ptr = buffer + sizeof(USN); record_ptr < buffer + bytes; record_ptr += ((USN_RECORD *)record_ptr)->RecordLength) {
+            USN_RECORD *record = (USN_RECORD *)record_ptr;
+            USN_RECORD_V3 *record_v3 = (USN_RECORD_V3 *)record_ptr;
+            const WCHAR *name;
+            size_t name_len;
+
+            if (record->RecordLength == 0)
+                break;
+
+            if (record->MajorVersion == 3) {
+                if (record_v3->Usn >= to_usn)
+                    break;
+                if ((ULONGLONG)record_v3->TimeStamp.QuadPart < not_before)
+                    continue;
+                name = (const WCHAR *)(record_ptr + record_v3->FileNameOffset);
+                name_len = record_v3->FileNameLength / sizeof(WCHAR);
+            }
+            else {
+                if (record->Usn >= to_usn)
+                    break;
+                if ((ULONGLONG)record->TimeStamp.QuadPart < not_before)
+                    continue;
+                name = (const WCHAR *)(record_ptr + record->FileNameOffset);
+                name_len = record->FileNameLength / sizeof(WCHAR);
+            }
+
+            if (name_proc(name, name_len, context)) {
+                result = JOURNAL_SCAN_STOPPED;
+                break;
+            }
+        }
+
+        // Stopped short of the end of what was read: stopped or reached to_usn
+        if (record_ptr < buffer + bytes)
+            break;
+
+        read.StartUsn = *(USN *)buffer;
+    }
+
+    CloseHandle(handle);
+    return result;
+}
+
+int journal_scan_since(const struct JournalStamp *before, const struct JournalStamp *after, JOURNAL_NAME_PROC name_proc, void *context)
+{
+    int result = JOURNAL_SCAN_DONE;
+    DWORD i;
+
+    for (i = 0; i < after->n_volumes && result == JOURNAL_SCAN_DONE; i++) {
+        if (before->volumes[i].next_usn != after->volumes[i].next_usn)
+            result = journal_scan(&after->volumes[i], before->volumes[i].next_usn, after->volumes[i].next_usn, 0, name_proc, context);
+    }
+
+    return result;
+}
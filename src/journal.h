@@ -0,0 +1,67 @@
+// journal.h : telling from the NTFS/ReFS change journals what names appeared
+//
+// (MIT license - see run.c)
+//
+// A stamp is the journal ID and position of every local volume Everything
+// could index. Comparing stamps says whether anything changed; reading the
+// journals between them says which names were created, renamed or linked.
+// Querying a journal needs no access rights, reading one needs an elevated
+// process.
+
+#ifndef RUN_JOURNAL_H
+#define RUN_JOURNAL_H
+
+#include <stddef.h>
+#include <windows.h>
+#include <winioctl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOURNAL_MAX_VOLUMES 26
+
+#define JOURNAL_SAME    0       // Nothing changed on any volume
+#define JOURNAL_MOVED   1       // The same journals, moved on; journal_scan_since can tell what appeared
+#define JOURNAL_RESET   2       // Volumes or journals differ, or the records in between are gone
+
+#define JOURNAL_SCAN_DONE       0
+#define JOURNAL_SCAN_STOPPED    1   // The name callback asked to stop
+#define JOURNAL_SCAN_FAILED     2   // Typically no access to read the journal
+
+struct JournalVolume
+{
+    DWORD drive;                // 0 is A:
+    DWORD serial;
+    DWORDLONG journal_id;
+    USN first_usn;
+    USN next_usn;
+};
+
+struct JournalStamp
+{
+    DWORD n_volumes;
+    struct JournalVolume volumes[JOURNAL_MAX_VOLUMES];
+};
+
+// Returns nonzero to stop the scan
+typedef int (*JOURNAL_NAME_PROC)(const WCHAR *name, size_t name_len, void *context);
+
+// Returns FALSE if some local volume has no journal to tell its changes by
+int journal_stamp(struct JournalStamp *stamp);
+
+int journal_compare(const struct JournalStamp *before, const struct JournalStamp *after);
+
+// Passes each name created, renamed or linked on a volume from one position up
+// to another to name_proc. Records older than not_before (a FILETIME) are
+// skipped.
+int journal_scan(const struct JournalVolume *volume, USN from_usn, USN to_usn, ULONGLONG not_before, JOURNAL_NAME_PROC name_proc, void *context);
+
+// journal_scan over every volume that moved between two JOURNAL_MOVED stamps
+int journal_scan_since(const struct JournalStamp *before, const struct JournalStamp *after, JOURNAL_NAME_PROC name_proc, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
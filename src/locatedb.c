@@ -0,0 +1,1210 @@
+// locatedb.c : searching a locate database when Everything is not running
+//
+// (MIT license - see run.c)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "locatedb.h"
+#include "pathext.h"
+#include "strfold.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define LOCATE_MAGIC 0x32444c52         // "RLD2"
+#define MLOCATE_MAGIC "\0mlocate"
+#define MLOCATE_HEADER_SIZE 16          // Magic, configuration size, version, flags, padding
+#define MLOCATE_DIR_HEADER_SIZE 16      // Modification time
+#define MLOCATE_FILE 0
+#define MLOCATE_END 2
+#define EFU_HEADER "Filename,"
+#define EFU_ATTRIBUTES "Attributes"
+#define EFU_DIRECTORY 0x10              // FILE_ATTRIBUTE_DIRECTORY
+#define UTF8_BOM "\xEF\xBB\xBF"
+#define MAX_NAME_LEN 1024               // Longer names are left out
+#define MAX_PATH_LEN 4096
+#define MAX_DIR_DEPTH 512
+#define MAX_TRIGRAMS 256                // Of a name searched for; the rest is just compared
+#define BLOCK_FILES 16                  // Names a block, all but the first sharing a prefix with the one before
+#define NO_PARENT 0xFFFFFFFF
+#define NO_POSTING 0xFFFFFFFF
+#define NO_FILE ((size_t)-1)
+
+// The index file is the header followed by the dirs, the offsets of the
+// name blocks, the trigrams, then the names, the postings and the folders'
+// parts. Numbers in the names and postings are stored 7 bits a byte, the
+// high bit set on all but the last byte.
+struct LocateHeader
+{
+    unsigned magic;
+    unsigned n_dirs;
+    unsigned n_files;
+    unsigned n_trigrams;
+    unsigned names_size;
+    unsigned postings_size;
+    unsigned parts_size;
+    unsigned reserved;
+    unsigned long long source_size;     // Of the database it was compiled from
+    unsigned long long source_time;
+    unsigned long long types_hash;      // Of the program types it was compiled with
+};
+
+// A folder is its parent and the last part of its path, starting with its
+// separator, so the folders under "C:\Program Files" keep it once
+struct LocateDir
+{
+    unsigned parent;                    // NO_PARENT for the first part ("C:", or "/usr")
+    unsigned part;                      // Offset in the parts
+    unsigned part_len;
+};
+
+struct LocateTrigram
+{
+    unsigned key;                       // Its three case folded characters
+    unsigned first;                     // Offset of its files in the postings, in name order
+    unsigned count;
+};
+
+// A file name decoded from the blocks, which are in name order. Each name is
+// the length of the prefix it shares with the name before, the length of
+// the rest, the rest and the name's folder.
+struct NameCursor
+{
+    const unsigned char *pos;
+    size_t file;                        // Of the name decoded last
+    unsigned dir;
+    size_t name_len;
+    char name[MAX_NAME_LEN];
+};
+
+struct PostingCursor
+{
+    const unsigned char *pos;
+    size_t left;
+    unsigned file;                      // Read last, NO_POSTING before the first
+};
+
+// A search in progress
+struct Search
+{
+    int tier;
+    const char *name;
+    size_t name_len;
+    int is_typed;                       // The name ends with a program type
+    struct LocateMatch *matches;
+    size_t offset;                      // Matches before the first to fill
+    size_t max_matches;
+    size_t n_matches;
+    size_t n_filled;
+    int is_failed;                      // Out of memory
+};
+
+struct BuildDir
+{
+    unsigned path;                      // Offset in the strings
+    unsigned path_len;
+};
+
+struct BuildFile
+{
+    unsigned name;
+    unsigned dir;
+    unsigned short name_len;
+    unsigned short stem_len;            // Without its type
+};
+
+// An index being compiled
+struct Builder
+{
+    struct BuildDir *dirs;
+    size_t n_dirs;
+    size_t dirs_alloc;
+    struct BuildFile *files;
+    size_t n_files;
+    size_t files_alloc;
+    char *strings;
+    size_t strings_size;
+    size_t strings_alloc;
+    const char *folder;                 // Being read, in the database
+    size_t folder_len;
+    long last_dir;                      // Of the folder being read, -1 until it has a program
+};
+
+// A match found, its strings copied to s_found
+struct Found
+{
+    size_t name;
+    size_t path;
+};
+
+static const struct LocateHeader *s_header;
+static size_t s_size;
+static const struct LocateDir *s_dirs;
+static const unsigned *s_blocks;
+static const struct LocateTrigram *s_trigrams;
+static const unsigned char *s_names;
+static const unsigned char *s_postings;
+static const char *s_parts;
+
+static char *s_found;                   // The strings of the matches of the last search
+static size_t s_found_size;
+static size_t s_found_alloc;
+static struct Found *s_found_matches;
+static size_t s_found_matches_alloc;
+
+static const char *s_sort_strings;      // For compare_files
+
+static int file_stamp(const char *path, unsigned long long *size, unsigned long long *time)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return 0;
+
+    *size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    *time = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    *size = (unsigned long long)st.st_size;
+    *time = (unsigned long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+
+    return 1;
+}
+
+static const void *map_read(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+    const void *view;
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0 || (unsigned long long)file_size.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+
+    view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return view;
+#else
+    struct stat st;
+    void *view;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    *size = (size_t)st.st_size;
+    return view == MAP_FAILED ? NULL : view;
+#endif
+}
+
+static void unmap(const void *view, size_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap((void *)view, size);
+#endif
+}
+
+static int grow(void **array, size_t *alloc, size_t needed, size_t item_size)
+{
+    size_t new_alloc = *alloc ? *alloc : 4096;
+    void *new_array;
+
+    if (needed <= *alloc)
+        return 1;
+
+    while (new_alloc < needed)
+        new_alloc *= 2;
+
+    new_array = realloc(*array, new_alloc * item_size);
+    if (!new_array)
+        return 0;
+
+    *array = new_array;
+    *alloc = new_alloc;
+    return 1;
+}
+
+// Returns the string's offset, or -1 when out of memory
+static long add_string(struct Builder *builder, const char *str, size_t len)
+{
+    size_t offset = builder->strings_size;
+
+    if (offset + len + 1 > 0xFFFFFFFF || !grow((void **)&builder->strings, &builder->strings_alloc, offset + len + 1, 1))
+        return -1;
+
+    memcpy(builder->strings + offset, str, len);
+    builder->strings[offset + len] = '\0';
+    builder->strings_size += len + 1;
+    return (long)offset;
+}
+
+// Adds a file of the folder being read, if it is a program. Its folder is
+// added along with its first program. Returns 0 when out of memory.
+static int add_file(struct Builder *builder, const char *dir, size_t dir_len, const char *name, size_t name_len)
+{
+    struct BuildFile *file;
+    size_t n_types = pathext_count();
+    size_t type = pathext_rank(name, name_len);
+    long offset;
+
+    if ((n_types && type == n_types) || name_len == 0 || name_len >= MAX_NAME_LEN)
+        return 1;
+
+    if (builder->last_dir < 0) {
+        if (!grow((void **)&builder->dirs, &builder->dirs_alloc, builder->n_dirs + 1, sizeof(struct BuildDir)))
+            return 0;
+        offset = add_string(builder, dir, dir_len);
+        if (offset < 0)
+            return 0;
+        builder->dirs[builder->n_dirs].path = (unsigned)offset;
+        builder->dirs[builder->n_dirs].path_len = (unsigned)dir_len;
+        builder->last_dir = (long)builder->n_dirs++;
+    }
+
+    if (!grow((void **)&builder->files, &builder->files_alloc, builder->n_files + 1, sizeof(struct BuildFile)))
+        return 0;
+    offset = add_string(builder, name, name_len);
+    if (offset < 0)
+        return 0;
+
+    file = &builder->files[builder->n_files++];
+    file->name = (unsigned)offset;
+    file->dir = (unsigned)builder->last_dir;
+    file->name_len = (unsigned short)name_len;
+    file->stem_len = (unsigned short)(type < n_types ? name_len - strlen(pathext_type(type)) : name_len);
+    return 1;
+}
+
+// mlocate's format: a header and the root folder, then for each folder its
+// path and its entries, each a type byte and a name, up to an end byte.
+// Numbers are big-endian.
+static int read_mlocate(struct Builder *builder, const char *data, size_t size)
+{
+    size_t conf_size = ((size_t)(unsigned char)data[8] << 24) | ((size_t)(unsigned char)data[9] << 16) |
+        ((size_t)(unsigned char)data[10] << 8) | (unsigned char)data[11];
+    size_t pos = MLOCATE_HEADER_SIZE;
+
+    pos += strnlen(data + pos, size - pos) + 1;
+    if (pos > size || conf_size > size - pos)
+        return 1;
+    pos += conf_size;
+
+    while (pos + MLOCATE_DIR_HEADER_SIZE < size) {
+        const char *dir = data + pos + MLOCATE_DIR_HEADER_SIZE;
+        size_t dir_len = strnlen(dir, size - pos - MLOCATE_DIR_HEADER_SIZE);
+
+        pos += MLOCATE_DIR_HEADER_SIZE + dir_len + 1;
+        builder->last_dir = -1;
+        while (pos < size && data[pos] != MLOCATE_END) {
+            int type = data[pos++];
+            const char *name = data + pos;
+            size_t name_len = strnlen(name, size - pos);
+
+            pos += name_len + 1;
+            if (pos > size)
+                return 1;
+            if (type == MLOCATE_FILE && !add_file(builder, dir, dir_len, name, name_len))
+                return 0;
+        }
+        pos++;
+    }
+
+    return 1;
+}
+
+// Names on other systems can have backslashes, but Everything's paths
+// are always Windows ones
+static int is_separator(char c, int is_windows_path)
+{
+#ifdef _WIN32
+    is_windows_path = 1;
+#endif
+
+    return c == '/' || (is_windows_path && c == '\\');
+}
+
+// Adds the file at a full path; a path ending with a separator is a folder's
+static int add_path(struct Builder *builder, const char *path, size_t len, int is_windows_path)
+{
+    size_t name_start = len;
+    size_t dir_len;
+
+    while (name_start && !is_separator(path[name_start - 1], is_windows_path))
+        name_start--;
+
+    if (name_start == 0 || name_start == len)
+        return 1;
+
+    // The root's separator stays, any other folder's does not
+    dir_len = name_start > 1 && path[name_start - 2] != ':' ? name_start - 1 : name_start;
+    if (!builder->folder || dir_len != builder->folder_len || memcmp(path, builder->folder, dir_len) != 0) {
+        builder->folder = path;
+        builder->folder_len = dir_len;
+        builder->last_dir = -1;
+    }
+
+    return add_file(builder, path, dir_len, path + name_start, len - name_start);
+}
+
+// One full path a line
+static int read_list(struct Builder *builder, const char *data, size_t size)
+{
+    const char *line = data;
+    const char *end = data + size;
+
+    while (line < end) {
+        const char *line_end = (const char *)memchr(line, '\n', end - line);
+        size_t len = (line_end ? line_end : end) - line;
+
+        if (len && line[len - 1] == '\r')
+            len--;
+        if (!add_path(builder, line, len, 0))
+            return 0;
+
+        line = line_end ? line_end + 1 : end;
+    }
+
+    return 1;
+}
+
+// Everything's file lists: a header naming the columns, then a line for
+// each file or folder with its full path first, quoted if it has a comma.
+// Windows names cannot have quotes, so a quoted path just ends at the next
+// quote. Folders are told by their attributes, when the list has them.
+static int read_efu(struct Builder *builder, const char *data, size_t size)
+{
+    const char *line = data;
+    const char *end = data + size;
+    const char *header_end = (const char *)memchr(data, '\n', size);
+    int attributes_column = -1;
+    int column = 0;
+
+    for (; line < (header_end ? header_end : end); line++) {
+        if (*line == ',')
+            column++;
+        else if (*line == 'A' && line + strlen(EFU_ATTRIBUTES) <= end && memcmp(line, EFU_ATTRIBUTES, strlen(EFU_ATTRIBUTES)) == 0)
+            attributes_column = column;
+    }
+
+    line = header_end ? header_end + 1 : end;
+    while (line < end) {
+        const char *line_end = (const char *)memchr(line, '\n', end - line);
+        const char *path = line;
+        const char *path_end;
+        const char *field;
+        unsigned long attributes = 0;
+
+        if (!line_end)
+            line_end = end;
+
+        if (*path == '"') {
+            path++;
+            path_end = (const char *)memchr(path, '"', line_end - path);
+            if (!path_end)
+                path_end = line_end;
+            field = path_end;
+        }
+        else {
+            path_end = (const char *)memchr(path, ',', line_end - path);
+            if (!path_end)
+                path_end = line_end;
+            field = path_end;
+        }
+
+        for (column = 0; field < line_end && column < attributes_column; field++) {
+            if (*field == ',')
+                column++;
+        }
+        if (column == attributes_column && column > 0) {
+            for (; field < line_end && *field >= '0' && *field <= '9'; field++)
+                attributes = attributes * 10 + (*field - '0');
+        }
+
+        if (path_end > path && path_end[-1] == '\r')
+            path_end--;
+        if (!(attributes & EFU_DIRECTORY) && !add_path(builder, path, path_end - path, 1))
+            return 0;
+
+        line = line_end + 1;
+    }
+
+    return 1;
+}
+
+static int compare_files(const void *a, const void *b)
+{
+    const struct BuildFile *file_a = (const struct BuildFile *)a;
+    const struct BuildFile *file_b = (const struct BuildFile *)b;
+    int result = fold_compare(s_sort_strings + file_a->name, file_a->name_len, s_sort_strings + file_b->name, file_b->name_len);
+
+    if (result)
+        return result;
+
+    return file_a->dir < file_b->dir ? -1 : file_a->dir > file_b->dir;
+}
+
+// Sorts by key then file, 16 bits a pass
+static void radix_sort(unsigned long long *pairs, unsigned long long *temp, size_t n)
+{
+    static size_t counts[65536];
+    unsigned long long *from = pairs;
+    unsigned long long *to = temp;
+    unsigned long long *swap;
+    int shift;
+    size_t i;
+
+    for (shift = 0; shift < 64; shift += 16) {
+        size_t total = 0;
+
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < n; i++)
+            counts[(from[i] >> shift) & 0xFFFF]++;
+        for (i = 0; i < 65536; i++) {
+            size_t count = counts[i];
+
+            counts[i] = total;
+            total += count;
+        }
+        for (i = 0; i < n; i++)
+            to[counts[(from[i] >> shift) & 0xFFFF]++] = from[i];
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+}
+
+static unsigned trigram_key(const char *folded)
+{
+    return ((unsigned)(unsigned char)folded[0] << 16) | ((unsigned)(unsigned char)folded[1] << 8) | (unsigned char)folded[2];
+}
+
+static size_t put_number(unsigned char *out, unsigned value)
+{
+    size_t n = 0;
+
+    for (; value >= 0x80; value >>= 7)
+        out[n++] = (unsigned char)(value | 0x80);
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+// Reads a number from a section ending at end; only a damaged index has
+// one running past it
+static unsigned get_number(const unsigned char **pos, const unsigned char *end)
+{
+    unsigned value = 0;
+    int shift;
+
+    for (shift = 0; *pos < end && (**pos & 0x80) && shift < 28; shift += 7)
+        value |= (unsigned)(*(*pos)++ & 0x7F) << shift;
+    return *pos < end ? value | (unsigned)*(*pos)++ << shift : value;
+}
+
+// The end of the part of a folder's path starting at start. Each part but
+// the first starts with a separator, and a separator ending the path stays
+// with its part, as in "C:\" or "/".
+static size_t part_end(const char *path, size_t len, size_t start)
+{
+    size_t i;
+
+    for (i = start + 1; i + 1 < len; i++) {
+        if (path[i] == '\\' || path[i] == '/')
+            return i;
+    }
+
+    return len;
+}
+
+static size_t part_hash(unsigned parent, const char *part, size_t len)
+{
+    unsigned long long hash = 14695981039346656037ULL ^ parent;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)part[i]) * 1099511628211ULL;
+
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+// Keeps each folder as its parent and its last part, so the parts the
+// folders share are kept once. Fills dir_ids with the index of each of the
+// builder's folders. Returns 0 when out of memory.
+static int intern_dirs(struct Builder *builder, struct LocateDir **dirs, size_t *n_dirs, char **parts, size_t *parts_size, unsigned *dir_ids)
+{
+    unsigned *slots;
+    size_t n_slots = 1;
+    size_t max_dirs = 0;
+    size_t i;
+
+    for (i = 0; i < builder->n_dirs; i++) {
+        const char *path = builder->strings + builder->dirs[i].path;
+        size_t start;
+
+        for (start = 0; start < builder->dirs[i].path_len; max_dirs++)
+            start = part_end(path, builder->dirs[i].path_len, start);
+    }
+    while (n_slots < 2 * max_dirs)
+        n_slots *= 2;
+
+    // Slots hold a folder's index plus one, 0 when free
+    slots = (unsigned *)calloc(n_slots, sizeof(unsigned));
+    *dirs = (struct LocateDir *)malloc((max_dirs + 1) * sizeof(struct LocateDir));
+    *parts = (char *)malloc(builder->strings_size + 1);
+    *n_dirs = 0;
+    *parts_size = 0;
+    if (!slots || !*dirs || !*parts) {
+        free(slots);
+        return 0;
+    }
+
+    for (i = 0; i < builder->n_dirs; i++) {
+        const char *path = builder->strings + builder->dirs[i].path;
+        size_t len = builder->dirs[i].path_len;
+        unsigned parent = NO_PARENT;
+        size_t start;
+        size_t end;
+
+        for (start = 0; start < len; start = end) {
+            size_t slot;
+
+            end = part_end(path, len, start);
+            for (slot = part_hash(parent, path + start, end - start) & (n_slots - 1); slots[slot]; slot = (slot + 1) & (n_slots - 1)) {
+                const struct LocateDir *dir = &(*dirs)[slots[slot] - 1];
+
+                if (dir->parent == parent && dir->part_len == end - start && memcmp(*parts + dir->part, path + start, end - start) == 0)
+                    break;
+            }
+
+            if (!slots[slot]) {
+                struct LocateDir *dir = &(*dirs)[*n_dirs];
+
+                dir->parent = parent;
+                dir->part = (unsigned)*parts_size;
+                dir->part_len = (unsigned)(end - start);
+                memcpy(*parts + *parts_size, path + start, end - start);
+                *parts_size += end - start;
+                slots[slot] = (unsigned)++*n_dirs;
+            }
+            parent = slots[slot] - 1;
+        }
+        dir_ids[i] = parent;
+    }
+
+    free(slots);
+    return 1;
+}
+
+// Each file is listed once under each trigram of its name, less the type.
+// The names are front coded in blocks and the postings delta coded.
+static int write_index(struct Builder *builder, const char *index_path, unsigned long long source_size, unsigned long long source_time)
+{
+    struct LocateHeader header = { 0 };
+    struct LocateTrigram *trigrams = NULL;
+    struct LocateDir *dirs = NULL;
+    unsigned *dir_ids;
+    unsigned *blocks;
+    unsigned char *names;
+    unsigned char *postings = NULL;
+    char *parts = NULL;
+    unsigned long long *pairs = NULL;
+    unsigned long long *temp = NULL;
+    size_t n_blocks = (builder->n_files + BLOCK_FILES - 1) / BLOCK_FILES;
+    size_t n_dirs = 0;
+    size_t n_pairs = 0;
+    size_t n_trigrams = 0;
+    size_t names_size = 0;
+    size_t postings_size = 0;
+    size_t parts_size = 0;
+    unsigned last_file = 0;
+    char folded[MAX_NAME_LEN];
+    char temp_path[4096];
+    FILE *file;
+    size_t i;
+    size_t j;
+    int ok;
+
+    dir_ids = (unsigned *)malloc((builder->n_dirs + 1) * sizeof(unsigned));
+    blocks = (unsigned *)malloc((n_blocks + 1) * sizeof(unsigned));
+    names = (unsigned char *)malloc(builder->n_files * 15 + builder->strings_size + 1);
+    ok = dir_ids && blocks && names && intern_dirs(builder, &dirs, &n_dirs, &parts, &parts_size, dir_ids);
+
+    for (i = 0; ok && i < builder->n_files; i++) {
+        const struct BuildFile *build_file = &builder->files[i];
+        const char *name = builder->strings + build_file->name;
+        size_t shared = 0;
+
+        if (i % BLOCK_FILES == 0) {
+            blocks[i / BLOCK_FILES] = (unsigned)names_size;
+        }
+        else {
+            const struct BuildFile *previous = &builder->files[i - 1];
+
+            while (shared < build_file->name_len && shared < previous->name_len && name[shared] == builder->strings[previous->name + shared])
+                shared++;
+        }
+
+        names_size += put_number(names + names_size, (unsigned)shared);
+        names_size += put_number(names + names_size, (unsigned)(build_file->name_len - shared));
+        memcpy(names + names_size, name + shared, build_file->name_len - shared);
+        names_size += build_file->name_len - shared;
+        names_size += put_number(names + names_size, dir_ids[build_file->dir]);
+        n_pairs += build_file->stem_len >= 3 ? build_file->stem_len - 2 : 0;
+    }
+
+    if (ok) {
+        pairs = (unsigned long long *)malloc((n_pairs + 1) * sizeof(unsigned long long));
+        temp = (unsigned long long *)malloc((n_pairs + 1) * sizeof(unsigned long long));
+    }
+    if (pairs && temp) {
+        n_pairs = 0;
+        for (i = 0; i < builder->n_files; i++) {
+            const struct BuildFile *build_file = &builder->files[i];
+
+            fold_lower_copy(folded, builder->strings + build_file->name, build_file->stem_len);
+            for (j = 0; j + 3 <= build_file->stem_len; j++)
+                pairs[n_pairs++] = ((unsigned long long)trigram_key(folded + j) << 32) | i;
+        }
+        radix_sort(pairs, temp, n_pairs);
+
+        // The sort leaves an even number of passes' output in pairs; the
+        // postings, at most 5 bytes a file, are written over temp
+        postings = (unsigned char *)temp;
+        trigrams = (struct LocateTrigram *)malloc((n_pairs + 1) * sizeof(struct LocateTrigram));
+    }
+    if (!trigrams) {
+        free(dir_ids);
+        free(blocks);
+        free(names);
+        free(dirs);
+        free(parts);
+        free(pairs);
+        free(temp);
+        return 0;
+    }
+
+    for (i = 0; i < n_pairs; i++) {
+        unsigned key = (unsigned)(pairs[i] >> 32);
+        unsigned file_id = (unsigned)pairs[i];
+
+        if (i && pairs[i] == pairs[i - 1])
+            continue;
+        if (!n_trigrams || trigrams[n_trigrams - 1].key != key) {
+            trigrams[n_trigrams].key = key;
+            trigrams[n_trigrams].first = (unsigned)postings_size;
+            trigrams[n_trigrams++].count = 0;
+            last_file = NO_POSTING;
+        }
+        postings_size += put_number(postings + postings_size, file_id - last_file);
+        last_file = file_id;
+        trigrams[n_trigrams - 1].count++;
+    }
+
+    header.magic = LOCATE_MAGIC;
+    header.n_dirs = (unsigned)n_dirs;
+    header.n_files = (unsigned)builder->n_files;
+    header.n_trigrams = (unsigned)n_trigrams;
+    header.names_size = (unsigned)names_size;
+    header.postings_size = (unsigned)postings_size;
+    header.parts_size = (unsigned)parts_size;
+    header.source_size = source_size;
+    header.source_time = source_time;
+    header.types_hash = pathext_hash();
+
+    // Written to a file of its own first, so runs racing each other never see half an index
+#ifdef _WIN32
+    sprintf_s(temp_path, sizeof(temp_path), "%s.%lu", index_path, GetCurrentProcessId());
+#else
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld", index_path, (long)getpid());
+#endif
+    ok = names_size <= 0xFFFFFFFF && postings_size <= 0xFFFFFFFF;
+    file = ok ? fopen(temp_path, "wb") : NULL;
+    ok = file != NULL;
+    if (file) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(dirs, sizeof(struct LocateDir), n_dirs, file) == n_dirs &&
+            fwrite(blocks, sizeof(unsigned), n_blocks, file) == n_blocks &&
+            fwrite(trigrams, sizeof(struct LocateTrigram), n_trigrams, file) == n_trigrams &&
+            fwrite(names, 1, names_size, file) == names_size &&
+            fwrite(postings, 1, postings_size, file) == postings_size &&
+            fwrite(parts, 1, parts_size, file) == parts_size;
+        ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+        ok = ok && MoveFileExA(temp_path, index_path, MOVEFILE_REPLACE_EXISTING);
+        if (!ok)
+            DeleteFileA(temp_path);
+#else
+        ok = ok && rename(temp_path, index_path) == 0;
+        if (!ok)
+            remove(temp_path);
+#endif
+    }
+
+    free(trigrams);
+    free(pairs);
+    free(temp);
+    free(dir_ids);
+    free(blocks);
+    free(names);
+    free(dirs);
+    free(parts);
+    return ok;
+}
+
+static int compile(const char *db_path, const char *index_path, unsigned long long source_size, unsigned long long source_time)
+{
+    struct Builder builder = { 0 };
+    size_t view_size;
+    const char *view = (const char *)map_read(db_path, &view_size);
+    const char *data = view;
+    size_t size = view_size;
+    int ok;
+
+    if (!view)
+        return 0;
+
+    // Lists saved as UTF-8 may start with a byte order mark
+    builder.last_dir = -1;
+    if (size >= strlen(UTF8_BOM) && memcmp(data, UTF8_BOM, strlen(UTF8_BOM)) == 0) {
+        data += strlen(UTF8_BOM);
+        size -= strlen(UTF8_BOM);
+    }
+    if (size >= MLOCATE_HEADER_SIZE && memcmp(data, MLOCATE_MAGIC, sizeof(MLOCATE_MAGIC) - 1) == 0)
+        ok = read_mlocate(&builder, data, size);
+    else if (size >= strlen(EFU_HEADER) && memcmp(data, EFU_HEADER, strlen(EFU_HEADER)) == 0)
+        ok = read_efu(&builder, data, size);
+    else
+        ok = read_list(&builder, data, size);
+    unmap(view, view_size);
+
+    if (ok) {
+        s_sort_strings = builder.strings;
+        qsort(builder.files, builder.n_files, sizeof(struct BuildFile), compare_files);
+        ok = write_index(&builder, index_path, source_size, source_time);
+    }
+
+    free(builder.dirs);
+    free(builder.files);
+    free(builder.strings);
+    return ok;
+}
+
+// Maps the index if it is complete and was compiled from this database
+// Checks that what the tables point at is inside the index, so that a
+// damaged index is compiled again rather than read past its end. A folder's
+// parent comes before it.
+static int is_index_valid(const struct LocateHeader *header, size_t n_blocks)
+{
+    const struct LocateDir *dirs = (const struct LocateDir *)(header + 1);
+    const unsigned *blocks = (const unsigned *)(dirs + header->n_dirs);
+    const struct LocateTrigram *trigrams = (const struct LocateTrigram *)(blocks + n_blocks);
+    size_t i;
+
+    for (i = 0; i < header->n_dirs; i++) {
+        if ((dirs[i].parent != NO_PARENT && dirs[i].parent >= i) ||
+            dirs[i].part > header->parts_size || dirs[i].part_len > header->parts_size - dirs[i].part)
+            return 0;
+    }
+
+    for (i = 0; i < n_blocks; i++) {
+        if (blocks[i] >= header->names_size || (i > 0 && blocks[i] <= blocks[i - 1]))
+            return 0;
+    }
+
+    for (i = 0; i < header->n_trigrams; i++) {
+        if (trigrams[i].first > header->postings_size || trigrams[i].count > header->postings_size - trigrams[i].first)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int map_index(const char *index_path, unsigned long long source_size, unsigned long long source_time)
+{
+    const struct LocateHeader *header;
+    size_t size;
+    size_t n_blocks;
+    size_t expected;
+
+    header = (const struct LocateHeader *)map_read(index_path, &size);
+    if (!header)
+        return 0;
+
+    n_blocks = size < sizeof(*header) ? 0 : (header->n_files + BLOCK_FILES - 1) / BLOCK_FILES;
+    expected = size < sizeof(*header) ? 0 : sizeof(*header) + header->n_dirs * sizeof(struct LocateDir) +
+        n_blocks * sizeof(unsigned) + (size_t)header->n_trigrams * sizeof(struct LocateTrigram) +
+        (size_t)header->names_size + header->postings_size + header->parts_size;
+    if (expected != size || header->magic != LOCATE_MAGIC || header->source_size != source_size ||
+        header->source_time != source_time || header->types_hash != pathext_hash() || !is_index_valid(header, n_blocks)) {
+        unmap(header, size);
+        return 0;
+    }
+
+    s_header = header;
+    s_size = size;
+    s_dirs = (const struct LocateDir *)(header + 1);
+    s_blocks = (const unsigned *)(s_dirs + header->n_dirs);
+    s_trigrams = (const struct LocateTrigram *)(s_blocks + n_blocks);
+    s_names = (const unsigned char *)(s_trigrams + header->n_trigrams);
+    s_postings = s_names + header->names_size;
+    s_parts = (const char *)(s_postings + header->postings_size);
+    return 1;
+}
+
+int locate_open(const char *db_path, const char *index_path)
+{
+    unsigned long long source_size;
+    unsigned long long source_time;
+
+    if (s_header)
+        return 1;
+
+    if (!file_stamp(db_path, &source_size, &source_time))
+        return 0;
+
+    return map_index(index_path, source_size, source_time) ||
+        (compile(db_path, index_path, source_size, source_time) && map_index(index_path, source_size, source_time));
+}
+
+size_t locate_count(void)
+{
+    return s_header ? s_header->n_files : 0;
+}
+
+void locate_close(void)
+{
+    if (s_header)
+        unmap(s_header, s_size);
+
+    free(s_found);
+    free(s_found_matches);
+    s_header = NULL;
+    s_found = NULL;
+    s_found_alloc = 0;
+    s_found_matches = NULL;
+    s_found_matches_alloc = 0;
+}
+
+static void read_name(struct NameCursor *cursor)
+{
+    size_t shared = get_number(&cursor->pos, s_postings);
+    size_t rest = get_number(&cursor->pos, s_postings);
+    size_t kept;
+
+    // Only a damaged index has longer names, or names past the blocks
+    if (shared >= MAX_NAME_LEN)
+        shared = 0;
+    if (rest > (size_t)(s_postings - cursor->pos))
+        rest = s_postings - cursor->pos;
+    kept = rest;
+    if (kept >= MAX_NAME_LEN - shared)
+        kept = MAX_NAME_LEN - 1 - shared;
+
+    memcpy(cursor->name + shared, cursor->pos, kept);
+    cursor->pos += rest;
+    cursor->name_len = shared + kept;
+    cursor->name[cursor->name_len] = '\0';
+    cursor->dir = get_number(&cursor->pos, s_postings);
+    cursor->file++;
+}
+
+// Decodes the file's name, from the start of its block unless the cursor is
+// already in the block before it
+static void seek_name(struct NameCursor *cursor, size_t file)
+{
+    if (cursor->file == NO_FILE || file < cursor->file || file / BLOCK_FILES != cursor->file / BLOCK_FILES) {
+        cursor->pos = s_names + s_blocks[file / BLOCK_FILES];
+        cursor->file = file / BLOCK_FILES * BLOCK_FILES - 1;
+    }
+
+    while (cursor->file != file)
+        read_name(cursor);
+}
+
+// The folder's path, from its parts
+static size_t dir_path(unsigned dir, char *path, size_t path_size)
+{
+    unsigned chain[MAX_DIR_DEPTH];
+    size_t n = 0;
+    size_t len = 0;
+
+    for (; dir != NO_PARENT && dir < s_header->n_dirs && n < MAX_DIR_DEPTH; dir = s_dirs[dir].parent)
+        chain[n++] = dir;
+
+    while (n--) {
+        const struct LocateDir *part = &s_dirs[chain[n]];
+
+        if (len + part->part_len >= path_size)
+            break;
+        memcpy(path + len, s_parts + part->part, part->part_len);
+        len += part->part_len;
+    }
+    path[len] = '\0';
+
+    return len;
+}
+
+// A name given with its type is matched against the whole file name, any
+// other name against the file name without its type
+static int is_match(const struct Search *search, const struct NameCursor *cursor)
+{
+    size_t type = pathext_rank(cursor->name, cursor->name_len);
+    size_t len = cursor->name_len;
+
+    if (!search->is_typed && type < pathext_count())
+        len -= strlen(pathext_type(type));
+
+    switch (search->tier) {
+    case LOCATE_EXACT:
+        return len == search->name_len;
+
+    case LOCATE_PREFIX:
+        return len >= search->name_len;
+
+    default:
+        return fold_find(cursor->name, len, search->name, search->name_len) != FOLD_NOT_FOUND;
+    }
+}
+
+// Counts the name if it matches, and copies it and its folder's path if it
+// is past the offset and there is room for it among the matches
+static void check_name(struct Search *search, const struct NameCursor *cursor)
+{
+    struct Found *found;
+    char path[MAX_PATH_LEN];
+    size_t path_len;
+
+    if (!is_match(search, cursor))
+        return;
+
+    if (search->n_matches >= search->offset && search->n_filled < search->max_matches) {
+        path_len = dir_path(cursor->dir, path, sizeof(path));
+        if (!grow((void **)&s_found, &s_found_alloc, s_found_size + cursor->name_len + path_len + 2, 1) ||
+            !grow((void **)&s_found_matches, &s_found_matches_alloc, search->n_filled + 1, sizeof(struct Found))) {
+            search->is_failed = 1;
+            return;
+        }
+
+        found = &s_found_matches[search->n_filled];
+        found->name = s_found_size;
+        memcpy(s_found + s_found_size, cursor->name, cursor->name_len + 1);
+        s_found_size += cursor->name_len + 1;
+        found->path = s_found_size;
+        memcpy(s_found + s_found_size, path, path_len + 1);
+        s_found_size += path_len + 1;
+
+        search->matches[search->n_filled].file_name_len = cursor->name_len;
+        search->matches[search->n_filled].path_len = path_len;
+        search->n_filled++;
+    }
+    search->n_matches++;
+}
+
+static int next_posting(struct PostingCursor *cursor)
+{
+    if (cursor->left == 0)
+        return 0;
+
+    cursor->file += get_number(&cursor->pos, (const unsigned char *)s_parts);
+    cursor->left--;
+
+    // Only a damaged index has files past the last
+    if (cursor->file >= s_header->n_files) {
+        cursor->left = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// Moves the cursor to the first of its files not before file. Returns 0 if
+// there is none.
+static int skip_postings(struct PostingCursor *cursor, unsigned file)
+{
+    while (cursor->file == NO_POSTING || cursor->file < file) {
+        if (!next_posting(cursor))
+            return 0;
+    }
+
+    return 1;
+}
+
+static const struct LocateTrigram *find_trigram(unsigned key)
+{
+    size_t from = 0;
+    size_t to = s_header->n_trigrams;
+
+    while (from < to) {
+        size_t middle = from + (to - from) / 2;
+
+        if (s_trigrams[middle].key < key)
+            from = middle + 1;
+        else
+            to = middle;
+    }
+
+    return from < s_header->n_trigrams && s_trigrams[from].key == key ? &s_trigrams[from] : NULL;
+}
+
+// Goes through the files in the shortest of the trigram lists of the name's
+// first stem_len characters that are in all the others too
+static void find_substring(struct Search *search, size_t stem_len)
+{
+    struct PostingCursor lists[MAX_TRIGRAMS];
+    struct NameCursor cursor;
+    char folded[MAX_NAME_LEN];
+    size_t n_lists = 0;
+    size_t shortest = 0;
+    size_t i;
+
+    fold_lower_copy(folded, search->name, search->name_len);
+    for (i = 0; i + 3 <= stem_len && n_lists < MAX_TRIGRAMS; i++) {
+        const struct LocateTrigram *trigram = find_trigram(trigram_key(folded + i));
+
+        if (!trigram)
+            return;
+        lists[n_lists].pos = s_postings + trigram->first;
+        lists[n_lists].left = trigram->count;
+        lists[n_lists].file = NO_POSTING;
+        if (trigram->count < lists[shortest].left)
+            shortest = n_lists;
+        n_lists++;
+    }
+
+    cursor.file = NO_FILE;
+    while (next_posting(&lists[shortest]) && !search->is_failed) {
+        unsigned file = lists[shortest].file;
+
+        for (i = 0; i < n_lists; i++) {
+            if (i == shortest)
+                continue;
+            if (!skip_postings(&lists[i], file))
+                return;
+            if (lists[i].file != file)
+                break;
+        }
+
+        if (i == n_lists) {
+            seek_name(&cursor, file);
+            check_name(search, &cursor);
+        }
+    }
+}
+
+// The block holding the first name not before name
+static size_t first_block(const char *name, size_t name_len)
+{
+    size_t n_blocks = (s_header->n_files + BLOCK_FILES - 1) / BLOCK_FILES;
+    size_t from = 0;
+    size_t to = n_blocks;
+
+    // The first name of a block is not front coded
+    while (from < to) {
+        size_t middle = from + (to - from) / 2;
+        const unsigned char *pos = s_names + s_blocks[middle];
+        size_t len;
+
+        get_number(&pos, s_postings);
+        len = get_number(&pos, s_postings);
+        if (len > (size_t)(s_postings - pos))
+            len = s_postings - pos;
+        if (fold_compare((const char *)pos, len, name, name_len) < 0)
+            from = middle + 1;
+        else
+            to = middle;
+    }
+
+    return from ? from - 1 : 0;
+}
+
+size_t locate_find(int tier, const char *name, size_t name_len, size_t offset, struct LocateMatch *matches, size_t max_matches)
+{
+    struct Search search;
+    struct NameCursor cursor;
+    size_t type = pathext_rank(name, name_len);
+    size_t stem_len = type < pathext_count() ? name_len - strlen(pathext_type(type)) : name_len;
+    size_t file;
+    size_t i;
+
+    if (!s_header || name_len == 0 || name_len >= MAX_NAME_LEN)
+        return 0;
+
+    search.tier = tier;
+    search.name = name;
+    search.name_len = name_len;
+    search.is_typed = stem_len < name_len;
+    search.matches = matches;
+    search.offset = offset;
+    search.max_matches = max_matches;
+    search.n_matches = 0;
+    search.n_filled = 0;
+    search.is_failed = 0;
+    s_found_size = 0;
+
+    cursor.file = NO_FILE;
+    if (tier == LOCATE_SUBSTRING && stem_len >= 3) {
+        find_substring(&search, stem_len);
+    }
+    else if (tier == LOCATE_SUBSTRING) {
+        for (file = 0; file < s_header->n_files && !search.is_failed; file++) {
+            seek_name(&cursor, file);
+            check_name(&search, &cursor);
+        }
+    }
+    else {
+        // The names starting with name sort together, from the first not before it
+        for (file = first_block(name, name_len) * BLOCK_FILES; file < s_header->n_files && !search.is_failed; file++) {
+            seek_name(&cursor, file);
+            if (fold_compare(cursor.name, cursor.name_len, name, name_len) < 0)
+                continue;
+            if (!fold_starts_with(cursor.name, cursor.name_len, name, name_len))
+                break;
+            check_name(&search, &cursor);
+        }
+    }
+
+    // The strings were copied to a buffer that may have moved as it grew
+    if (search.is_failed)
+        search.n_matches = offset + search.n_filled;
+    for (i = 0; i < search.n_filled; i++) {
+        matches[i].file_name = s_found + s_found_matches[i].name;
+        matches[i].path = s_found + s_found_matches[i].path;
+    }
+
+    return search.n_matches;
+}
@@ -0,0 +1,69 @@
+// locatedb.h : searching a locate database when Everything is not running
+//
+// (MIT license - see run.c)
+//
+// The database is one written by mlocate's updatedb, a file list exported by
+// Everything (.efu), or a list of full paths, one per line, as "dir /s /b" or
+// find print them. It is compiled once into an index file, compiled again
+// when the database changes, and the index is mapped rather than read so that
+// a search only pages in what it touches. The index holds the files having a
+// program type (see pathext.h; all the files when there are no types), sorted
+// by name case-insensitively, so the exact and prefix tiers are a binary
+// search. For the substring tier it also holds, for each sequence of three
+// characters (a trigram), the sorted list of the files whose name has it. A
+// search goes through the shortest list of the name's trigrams, keeps the
+// files that are in the others too and only compares those with the name.
+//
+// Most of what the index holds is shared: sorted names start like the name
+// before them, and folders like their parent. So the names are kept in blocks
+// of 16, each but the first as the length of the start it shares with the
+// name before and the rest of it, and a binary search goes through the
+// blocks' first names. A folder is kept as its parent and its last part, and
+// the trigrams' lists as the differences between their files, a byte or two
+// each. The index comes to about a third of the size of the database's paths,
+// and to a ninth without the trigrams' lists.
+
+#ifndef RUN_LOCATEDB_H
+#define RUN_LOCATEDB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The search tiers of run, with the name...
+#define LOCATE_EXACT 1          // ...as the whole name, less its type
+#define LOCATE_PREFIX 2         // ...starting the name
+#define LOCATE_SUBSTRING 3      // ...anywhere before the type
+
+struct LocateMatch
+{
+    const char *file_name;      // '\0' terminated, as is the path
+    size_t file_name_len;
+    const char *path;           // The folder, with no separator at the end unless a root
+    size_t path_len;
+};
+
+// Maps the index of the database at db_path, compiling it to index_path
+// first if needed. Returns 0 if the database cannot be read or the index
+// cannot be written.
+int locate_open(const char *db_path, const char *index_path);
+
+// Fills matches with up to max_matches matches of name in the tier, in name
+// order, skipping the first offset of them. A name ending with a program type
+// only matches that type. The matches' strings stay until the next
+// locate_find or locate_close. Returns how many matches there are in all, or
+// just the ones up to those filled if memory ran out.
+size_t locate_find(int tier, const char *name, size_t name_len, size_t offset, struct LocateMatch *matches, size_t max_matches);
+
+// Files in the index
+size_t locate_count(void);
+
+void locate_close(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,198 @@
+// misscache.c : persistent cache of names run could not find
+//
+// (MIT license - see run.c)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "misscache.h"
+#include "journal.h"
+#include "pathext.h"
+#include "strfold.h"
+
+#define MISS_CACHE_MAGIC 0x32434d52     // "RMC2"
+#define MISS_CACHE_SLOTS 1024           // Fingerprints; the cache starts over once half are used
+#define SETTLE_MS 2000                  // Everything may not have indexed a file this new yet
+#define LOOKBACK_BYTES (1024 * 1024)    // How much of the journal is read to find such files
+#define JOURNAL_PAGE 4096               // Journal records never cross a page
+
+// The cache file is this structure as is
+struct MissCacheFile
+{
+    DWORD magic;
+    struct JournalStamp stamp;
+    DWORD n_keys;
+    unsigned long long keys[MISS_CACHE_SLOTS];    // Open addressing, 0 is an empty slot
+    ULONGLONG added[MISS_CACHE_SLOTS];            // When each key's miss was recorded, as a FILETIME
+};
+
+static struct MissCacheFile s_cache;
+static const char *s_path;
+static int s_state = MISS_CACHE_OFF;
+static int s_is_new_stamp;      // The stamp was taken now rather than loaded
+static ULONGLONG s_stamp_time;  // Also the time the cache was opened
+
+// Journal name callback: stops at a name that could match
+static int has_program_type(const WCHAR *name, size_t len, void *context)
+{
+    return pathext_contains_w(name, len);
+}
+
+// A miss only holds for the program types it was searched with
+static unsigned long long fingerprint(const char *name, size_t name_len, unsigned flags)
+{
+    unsigned long long hash = (fold_hash(name, name_len) ^ pathext_hash() ^ flags) * 1099511628211ULL;
+
+    return hash ? hash : 1;
+}
+
+static void start_over(const struct JournalStamp *stamp)
+{
+    memset(&s_cache, 0, sizeof(s_cache));
+    s_cache.magic = MISS_CACHE_MAGIC;
+    s_cache.stamp = *stamp;
+    s_is_new_stamp = TRUE;
+    s_state = MISS_CACHE_EMPTY;
+}
+
+static int load(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    size_t read_size;
+
+    if (!file)
+        return FALSE;
+
+    read_size = fread(&s_cache, 1, sizeof(s_cache), file);
+    fclose(file);
+
+    return read_size == sizeof(s_cache) && s_cache.magic == MISS_CACHE_MAGIC &&
+        s_cache.stamp.n_volumes <= JOURNAL_MAX_VOLUMES && s_cache.n_keys < MISS_CACHE_SLOTS;
+}
+
+// Written to a file of its own first, so runs racing each other never see half a cache
+static void save()
+{
+    char temp_path[MAX_PATH + 32];
+    FILE *file;
+    int ok;
+
+    sprintf_s(temp_path, sizeof(temp_path), "%s.%lu", s_path, GetCurrentProcessId());
+    file = fopen(temp_path, "wb");
+    if (!file)
+        return;
+
+    ok = fwrite(&s_cache, sizeof(s_cache), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || !MoveFileExA(temp_path, s_path, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileA(temp_path);
+}
+
+int miss_cache_open(const char *path)
+{
+    struct JournalStamp stamp;
+    FILETIME now;
+
+    s_path = path;
+    s_state = MISS_CACHE_OFF;
+    if (!journal_stamp(&stamp))
+        return s_state;
+
+    GetSystemTimeAsFileTime(&now);
+    s_stamp_time = ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    if (!load(path)) {
+        start_over(&stamp);
+        return s_state;
+    }
+
+    switch (journal_compare(&s_cache.stamp, &stamp)) {
+        case JOURNAL_RESET:
+            start_over(&stamp);
+            return s_state;
+
+        case JOURNAL_MOVED:
+            if (journal_scan_since(&s_cache.stamp, &stamp, has_program_type, NULL) != JOURNAL_SCAN_DONE) {
+                start_over(&stamp);
+                return s_state;
+            }
+
+            // Keep the next run from reading the same part of the journal again
+            s_cache.stamp = stamp;
+            if (s_cache.n_keys)
+                save();
+            break;
+    }
+
+    s_is_new_stamp = FALSE;
+    s_state = MISS_CACHE_VALID;
+    return s_state;
+}
+
+int miss_cache_contains(const char *name, size_t name_len, unsigned flags)
+{
+    unsigned long long key;
+    DWORD slot;
+
+    if (s_state != MISS_CACHE_VALID)
+        return FALSE;
+
+    key = fingerprint(name, name_len, flags);
+    for (slot = (DWORD)key % MISS_CACHE_SLOTS; s_cache.keys[slot]; slot = (slot + 1) % MISS_CACHE_SLOTS) {
+        if (s_cache.keys[slot] == key)
+            return s_stamp_time - s_cache.added[slot] < MISS_CACHE_MAX_AGE_MS * 10000ULL;
+    }
+
+    return FALSE;
+}
+
+void miss_cache_add(const char *name, size_t name_len, unsigned flags)
+{
+    unsigned long long key;
+    DWORD slot;
+    DWORD i;
+
+    if (s_state == MISS_CACHE_OFF)
+        return;
+
+    // A new stamp may be ahead of what Everything has seen. A file created
+    // just before it would stay hidden behind the miss, as the journal has
+    // nothing newer to give it away, so such a stamp is not used. Without
+    // read access to the journal this goes unchecked.
+    if (s_is_new_stamp) {
+        ULONGLONG not_before = s_stamp_time - SETTLE_MS * 10000ULL;
+
+        for (i = 0; i < s_cache.stamp.n_volumes; i++) {
+            const struct JournalVolume *volume = &s_cache.stamp.volumes[i];
+            USN from_usn = volume->next_usn > LOOKBACK_BYTES ? (volume->next_usn - LOOKBACK_BYTES) & ~(USN)(JOURNAL_PAGE - 1) : 0;
+
+            if (from_usn < volume->first_usn)
+                from_usn = volume->first_usn;
+            if (journal_scan(volume, from_usn, volume->next_usn, not_before, has_program_type, NULL) == JOURNAL_SCAN_STOPPED) {
+                s_state = MISS_CACHE_OFF;
+                return;
+            }
+        }
+        s_is_new_stamp = FALSE;
+    }
+
+    if (s_cache.n_keys >= MISS_CACHE_SLOTS / 2) {
+        memset(s_cache.keys, 0, sizeof(s_cache.keys));
+        s_cache.n_keys = 0;
+    }
+
+    // A miss that is too old to trust is recorded again
+    key = fingerprint(name, name_len, flags);
+    for (slot = (DWORD)key % MISS_CACHE_SLOTS; s_cache.keys[slot]; slot = (slot + 1) % MISS_CACHE_SLOTS) {
+        if (s_cache.keys[slot] == key)
+            break;
+    }
+
+    if (!s_cache.keys[slot]) {
+        s_cache.keys[slot] = key;
+        s_cache.n_keys++;
+    }
+    s_cache.added[slot] = s_stamp_time;
+    s_state = MISS_CACHE_VALID;
+    save();
+}
@@ -0,0 +1,45 @@
+// misscache.h : persistent cache of names run could not find
+//
+// (MIT license - see run.c)
+//
+// A miss is remembered as a 64 bit fingerprint of the (case folded) name and
+// the search flags, so asking for it again costs no Everything query. The
+// cache is stamped with the change journal position of every local volume.
+// Once any of them moves on, the journal is read back to see whether a name
+// that could now match (one containing a program type, see pathext.h) was
+// created, renamed or linked since. When the journal cannot be read (that
+// needs an elevated process) any change on the volume drops the cache. A
+// local volume without a journal turns the cache off. Everything can also
+// index network shares and folders that no journal covers, so each miss is
+// only trusted for MISS_CACHE_MAX_AGE_MS after it was recorded.
+
+#ifndef RUN_MISSCACHE_H
+#define RUN_MISSCACHE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MISS_CACHE_OFF      0   // Some local volume has no change journal
+#define MISS_CACHE_EMPTY    1   // No cache yet, or it was dropped as stale
+#define MISS_CACHE_VALID    2   // Nothing that could match has appeared since it was stamped
+
+#define MISS_CACHE_MAX_AGE_MS (10 * 60 * 1000)
+
+// Loads the cache and checks it against the volumes. Must be called before
+// searching, so that a file created during the search is seen by the next
+// check rather than hidden behind the miss.
+int miss_cache_open(const char *path);
+
+int miss_cache_contains(const char *name, size_t name_len, unsigned flags);
+
+// Records a miss and writes the cache back
+void miss_cache_add(const char *name, size_t name_len, unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
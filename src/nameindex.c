@@ -0,0 +1,400 @@
+// nameindex.c : program names for shell completion, kept in a mapped file
+//
+// (MIT license - see run.c)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nameindex.h"
+#include "strfold.h"
+
+#define NAME_INDEX_MAGIC 0x31494e52     // "RNI1"
+
+struct NameTrieNode
+{
+    DWORD first_name;           // Names with the node's prefix are [first_name, first_name + n_names)
+    DWORD n_names;
+    DWORD first_child;          // Children are consecutive, ordered by character
+    WORD n_children;
+    BYTE ch;                    // Folded
+    BYTE reserved;
+};
+
+// The file is this header followed by the name offsets, the trie nodes and
+// the names themselves (each terminated, in sorted order)
+struct NameIndexHeader
+{
+    DWORD magic;
+    DWORD n_names;
+    DWORD n_nodes;
+    DWORD strings_size;
+    struct NameIndexStamp stamp;
+};
+
+struct BuildName
+{
+    DWORD offset;
+    DWORD len;
+};
+
+// Being built
+static char *s_pool;
+static size_t s_pool_size;
+static size_t s_pool_capacity;
+static struct BuildName *s_names;
+static DWORD s_n_names;
+static DWORD s_names_capacity;
+
+// Open
+static BYTE *s_view;
+static const struct NameIndexHeader *s_header;
+static const DWORD *s_name_offsets;
+static const struct NameTrieNode *s_nodes;
+static const char *s_strings;
+
+void name_index_begin(void)
+{
+    s_pool_size = 0;
+    s_n_names = 0;
+}
+
+void name_index_add(const char *name, size_t name_len)
+{
+    if (name_len == 0)
+        return;
+
+    if (s_pool_size + name_len + 1 > s_pool_capacity) {
+        size_t capacity = s_pool_capacity ? s_pool_capacity * 2 : 64 * 1024;
+        char *pool;
+
+        while (capacity < s_pool_size + name_len + 1)
+            capacity *= 2;
+        pool = (char *)realloc(s_pool, capacity);
+        if (!pool)
+            return;
+        s_pool = pool;
+        s_pool_capacity = capacity;
+    }
+
+    if (s_n_names == s_names_capacity) {
+        DWORD capacity = s_names_capacity ? s_names_capacity * 2 : 4096;
+        struct BuildName *names = (struct BuildName *)realloc(s_names, capacity * sizeof(struct BuildName));
+
+        if (!names)
+            return;
+        s_names = names;
+        s_names_capacity = capacity;
+    }
+
+    memcpy(s_pool + s_pool_size, name, name_len);
+    s_pool[s_pool_size + name_len] = '\0';
+    s_names[s_n_names].offset = (DWORD)s_pool_size;
+    s_names[s_n_names].len = (DWORD)name_len;
+    s_n_names++;
+    s_pool_size += name_len + 1;
+}
+
+static int compare_build_names(const void *a, const void *b)
+{
+    const struct BuildName *name_a = (const struct BuildName *)a;
+    const struct BuildName *name_b = (const struct BuildName *)b;
+
+    return fold_compare(s_pool + name_a->offset, name_a->len, s_pool + name_b->offset, name_b->len);
+}
+
+// Breadth first, so each node's children are added together. A node's names
+// that are just its prefix come first in its range and go to no child.
+static struct NameTrieNode *build_trie(DWORD *n_nodes)
+{
+    DWORD capacity = 1024;
+    struct NameTrieNode *nodes = (struct NameTrieNode *)malloc(capacity * sizeof(struct NameTrieNode));
+    BYTE *depths = (BYTE *)malloc(capacity);
+    DWORD i;
+
+    if (!nodes || !depths) {
+        free(nodes);
+        free(depths);
+        return NULL;
+    }
+
+    memset(&nodes[0], 0, sizeof(nodes[0]));
+    nodes[0].n_names = s_n_names;
+    depths[0] = 0;
+    *n_nodes = 1;
+
+    for (i = 0; i < *n_nodes; i++) {
+        DWORD depth = depths[i];
+        DWORD name = nodes[i].first_name;
+        DWORD end = name + nodes[i].n_names;
+
+        nodes[i].first_child = *n_nodes;
+        if (depth == NAME_TRIE_DEPTH)
+            continue;
+
+        while (name < end && s_names[name].len <= depth)
+            name++;
+
+        while (name < end) {
+            BYTE ch = fold_char((unsigned char)s_pool[s_names[name].offset + depth]);
+            DWORD first = name;
+            struct NameTrieNode *child;
+
+            while (name < end && fold_char((unsigned char)s_pool[s_names[name].offset + depth]) == ch)
+                name++;
+
+            if (*n_nodes == capacity) {
+                struct NameTrieNode *more_nodes = (struct NameTrieNode *)realloc(nodes, capacity * 2 * sizeof(struct NameTrieNode));
+                BYTE *more_depths = (BYTE *)realloc(depths, capacity * 2);
+
+                if (more_nodes)
+                    nodes = more_nodes;
+                if (more_depths)
+                    depths = more_depths;
+                if (!more_nodes || !more_depths) {
+                    free(nodes);
+                    free(depths);
+                    return NULL;
+                }
+                capacity *= 2;
+            }
+
+            child = &nodes[*n_nodes];
+            memset(child, 0, sizeof(*child));
+            child->first_name = first;
+            child->n_names = name - first;
+            child->ch = ch;
+            depths[*n_nodes] = (BYTE)(depth + 1);
+            (*n_nodes)++;
+            nodes[i].n_children++;
+        }
+    }
+
+    free(depths);
+    return nodes;
+}
+
+// Written to a file of its own first and then moved over the index, so
+// completions running meanwhile see either the old index or the new one
+int name_index_write(const char *path, const struct NameIndexStamp *stamp)
+{
+    struct NameIndexHeader header = { 0 };
+    struct NameTrieNode *nodes;
+    DWORD *offsets;
+    char temp_path[MAX_PATH + 32];
+    FILE *file;
+    DWORD i;
+    DWORD n_unique = 0;
+    int ok;
+
+    qsort(s_names, s_n_names, sizeof(struct BuildName), compare_build_names);
+    for (i = 0; i < s_n_names; i++) {
+        if (n_unique == 0 || !fold_equals(s_pool + s_names[i].offset, s_names[i].len,
+                                          s_pool + s_names[n_unique - 1].offset, s_names[n_unique - 1].len))
+            s_names[n_unique++] = s_names[i];
+    }
+    s_n_names = n_unique;
+
+    nodes = build_trie(&header.n_nodes);
+    offsets = (DWORD *)malloc((s_n_names + 1) * sizeof(DWORD));
+    if (!nodes || !offsets) {
+        free(nodes);
+        free(offsets);
+        return FALSE;
+    }
+
+    // The names are written in sorted order, so a completion reads one run of them
+    for (i = 0; i < s_n_names; i++) {
+        offsets[i] = header.strings_size;
+        header.strings_size += s_names[i].len + 1;
+    }
+
+    header.magic = NAME_INDEX_MAGIC;
+    header.n_names = s_n_names;
+    header.stamp = *stamp;
+
+    sprintf_s(temp_path, sizeof(temp_path), "%s.%lu", path, GetCurrentProcessId());
+    file = fopen(temp_path, "wb");
+    ok = file != NULL;
+    if (ok) {
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            (s_n_names == 0 || fwrite(offsets, sizeof(DWORD), s_n_names, file) == s_n_names) &&
+            fwrite(nodes, sizeof(struct NameTrieNode), header.n_nodes, file) == header.n_nodes;
+        for (i = 0; ok && i < s_n_names; i++)
+            ok = fwrite(s_pool + s_names[i].offset, s_names[i].len + 1, 1, file) == 1;
+        ok = fclose(file) == 0 && ok;
+        if (!ok || !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING)) {
+            DeleteFileA(temp_path);
+            ok = FALSE;
+        }
+    }
+
+    free(nodes);
+    free(offsets);
+    return ok;
+}
+
+int name_index_open(const char *path)
+{
+    HANDLE file;
+    HANDLE mapping;
+    LARGE_INTEGER file_size;
+    const struct NameIndexHeader *header;
+    ULONGLONG needed;
+
+    name_index_close();
+
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return FALSE;
+
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG)sizeof(struct NameIndexHeader)) {
+        CloseHandle(file);
+        return FALSE;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return FALSE;
+
+    s_view = (BYTE *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!s_view)
+        return FALSE;
+
+    header = (const struct NameIndexHeader *)s_view;
+    needed = sizeof(struct NameIndexHeader) + (ULONGLONG)header->n_names * sizeof(DWORD) +
+        (ULONGLONG)header->n_nodes * sizeof(struct NameTrieNode) + header->strings_size;
+    if (header->magic != NAME_INDEX_MAGIC || header->n_nodes == 0 || needed != (ULONGLONG)file_size.QuadPart ||
+        header->stamp.journals.n_volumes > JOURNAL_MAX_VOLUMES) {
+        name_index_close();
+        return FALSE;
+    }
+
+    s_header = header;
+    s_name_offsets = (const DWORD *)(s_view + sizeof(struct NameIndexHeader));
+    s_nodes = (const struct NameTrieNode *)(s_name_offsets + header->n_names);
+    s_strings = (const char *)(s_nodes + header->n_nodes);
+    if (header->strings_size && s_strings[header->strings_size - 1] != '\0') {
+        name_index_close();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+const struct NameIndexStamp *name_index_stamp(void)
+{
+    return s_header ? &s_header->stamp : NULL;
+}
+
+void name_index_close(void)
+{
+    if (s_view)
+        UnmapViewOfFile(s_view);
+
+    s_view = NULL;
+    s_header = NULL;
+}
+
+static const char *index_name(DWORD i)
+{
+    DWORD offset = s_name_offsets[i];
+
+    return offset < s_header->strings_size ? s_strings + offset : "";
+}
+
+void name_index_add_all(void)
+{
+    DWORD i;
+
+    if (!s_header)
+        return;
+
+    for (i = 0; i < s_header->n_names; i++) {
+        const char *name = index_name(i);
+
+        name_index_add(name, strlen(name));
+    }
+}
+
+// Where prefix falls in the sorted names: names before it compare below 0,
+// names starting with it 0 and names after it above 0
+static int compare_prefix(const char *name, const char *prefix, size_t prefix_len)
+{
+    size_t name_len = strlen(name);
+
+    return fold_compare(name, name_len < prefix_len ? name_len : prefix_len, prefix, prefix_len);
+}
+
+// First name in [lo, hi) comparing above limit (-1 for the first starting with prefix, 0 for the first after them)
+static DWORD bound(DWORD lo, DWORD hi, const char *prefix, size_t prefix_len, int limit)
+{
+    while (lo < hi) {
+        DWORD mid = lo + (hi - lo) / 2;
+
+        if (compare_prefix(index_name(mid), prefix, prefix_len) > limit)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+static const struct NameTrieNode *find_child(const struct NameTrieNode *node, BYTE ch)
+{
+    DWORD lo = node->first_child;
+    DWORD hi = lo + node->n_children;
+
+    if (hi > s_header->n_nodes)
+        return NULL;
+
+    while (lo < hi) {
+        DWORD mid = lo + (hi - lo) / 2;
+
+        if (s_nodes[mid].ch == ch)
+            return &s_nodes[mid];
+        if (s_nodes[mid].ch < ch)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+size_t name_index_complete(const char *prefix, size_t prefix_len, NAME_INDEX_PROC name_proc, void *context)
+{
+    const struct NameTrieNode *node;
+    DWORD depth;
+    DWORD lo;
+    DWORD hi;
+    DWORD i;
+
+    if (!s_header)
+        return 0;
+
+    node = &s_nodes[0];
+    for (depth = 0; depth < prefix_len && depth < NAME_TRIE_DEPTH; depth++) {
+        node = find_child(node, fold_char((unsigned char)prefix[depth]));
+        if (!node)
+            return 0;
+    }
+
+    lo = node->first_name;
+    hi = lo + node->n_names;
+    if (lo > s_header->n_names || hi > s_header->n_names)
+        return 0;
+
+    if (prefix_len > NAME_TRIE_DEPTH) {
+        lo = bound(lo, hi, prefix, prefix_len, -1);
+        hi = bound(lo, hi, prefix, prefix_len, 0);
+    }
+
+    for (i = lo; i < hi; i++)
+        name_proc(index_name(i), context);
+
+    return hi - lo;
+}
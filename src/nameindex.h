@@ -0,0 +1,55 @@
+// nameindex.h : program names for shell completion, kept in a mapped file
+//
+// (MIT license - see run.c)
+//
+// The index holds the distinct base names (without their type, see
+// pathext.h) of the programs on the computer, sorted case-insensitively,
+// and a trie over their first few characters. Each trie node covers the
+// range of names starting with its prefix, so a completion walks at most
+// NAME_TRIE_DEPTH nodes, narrows the range by binary search for any longer
+// prefix and then just lists it. The file is mapped rather than read, so
+// only the parts a completion touches are paged in.
+
+#ifndef RUN_NAMEINDEX_H
+#define RUN_NAMEINDEX_H
+
+#include <stddef.h>
+#include "journal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NAME_TRIE_DEPTH 3
+
+struct NameIndexStamp
+{
+    ULONGLONG built_time;       // FILETIME of the last full build from Everything
+    ULONGLONG checked_time;     // FILETIME the journals were last caught up with
+    struct JournalStamp journals;
+};
+
+typedef void (*NAME_INDEX_PROC)(const char *name, void *context);
+
+// Building: names are collected, then sorted, deduplicated and written out
+void name_index_begin(void);
+void name_index_add(const char *name, size_t name_len);
+int name_index_write(const char *path, const struct NameIndexStamp *stamp);
+
+// Returns FALSE if there is no usable index at path
+int name_index_open(const char *path);
+const struct NameIndexStamp *name_index_stamp(void);
+void name_index_close(void);
+
+// Adds the open index's names to the ones being built, to refresh it
+void name_index_add_all(void);
+
+// Passes every indexed name starting with prefix to name_proc, in order.
+// Returns how many there were.
+size_t name_index_complete(const char *prefix, size_t prefix_len, NAME_INDEX_PROC name_proc, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+// pathext.c : the file types run treats as programs
+//
+// (MIT license - see run.c)
+//
+
+#include <string.h>
+#include "pathext.h"
+#include "strfold.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define DEFAULT_TYPES ".COM;.EXE;.BAT;.CMD"
+#else
+#include <stdlib.h>
+#define DEFAULT_TYPES ""                // Programs have no type there
+#endif
+#define ENV_SIZE 1024
+
+static char s_types[PATHEXT_MAX_TYPES][PATHEXT_MAX_LEN];
+static wchar_t s_types_w[PATHEXT_MAX_TYPES][PATHEXT_MAX_LEN];
+static size_t s_lens[PATHEXT_MAX_TYPES];
+static size_t s_count;
+static int s_is_loaded;
+
+// Returns 0 if the variable is not set or too long
+static int read_env(const char *variable, char *value, size_t value_size)
+{
+#ifdef _WIN32
+    DWORD len = GetEnvironmentVariableA(variable, value, (DWORD)value_size);
+
+    return len != 0 && len < value_size;
+#else
+    const char *env = getenv(variable);
+
+    if (!env || strlen(env) >= value_size)
+        return 0;
+
+    strcpy(value, env);
+    return 1;
+#endif
+}
+
+// Adds the types in a PATHEXT style list, skipping any that could not be
+// searched for as given (wildcards, spaces, Everything operators) or are
+// listed twice. Returns how many there are.
+static size_t add_types(const char *list)
+{
+    const char *type = list;
+
+    while (*type && s_count < PATHEXT_MAX_TYPES) {
+        size_t len = strcspn(type, ";");
+        size_t i;
+        int is_valid = len >= 2 && len < PATHEXT_MAX_LEN && type[0] == '.' &&
+            strcspn(type + 1, ".*?|<>\"\\/: ;") == len - 1;
+
+        for (i = 0; is_valid && i < s_count; i++) {
+            if (fold_equals(s_types[i], s_lens[i], type, len))
+                is_valid = 0;
+        }
+
+        if (is_valid) {
+            memcpy(s_types[s_count], type, len);
+            s_types[s_count][len] = '\0';
+            for (i = 0; i <= len; i++)
+                s_types_w[s_count][i] = (unsigned char)s_types[s_count][i];
+            s_lens[s_count++] = len;
+        }
+
+        type += len;
+        if (*type == ';')
+            type++;
+    }
+
+    return s_count;
+}
+
+void pathext_load(void)
+{
+    char list[ENV_SIZE];
+
+    s_count = 0;
+    s_is_loaded = 1;
+
+    if (!read_env("RUN_PATHEXT", list, sizeof(list)) || !add_types(list)) {
+        if (!read_env("PATHEXT", list, sizeof(list)) || !add_types(list))
+            add_types(DEFAULT_TYPES);
+    }
+}
+
+size_t pathext_count(void)
+{
+    if (!s_is_loaded)
+        pathext_load();
+
+    return s_count;
+}
+
+const char *pathext_type(size_t i)
+{
+    return i < pathext_count() ? s_types[i] : "";
+}
+
+size_t pathext_rank(const char *name, size_t name_len)
+{
+    size_t i;
+
+    for (i = 0; i < pathext_count(); i++) {
+        if (name_len > s_lens[i] && fold_ends_with(name, name_len, s_types[i], s_lens[i]))
+            break;
+    }
+
+    return i;
+}
+
+size_t pathext_rank_w(const wchar_t *name, size_t name_len)
+{
+    size_t i;
+
+    for (i = 0; i < pathext_count(); i++) {
+        if (name_len > s_lens[i] && fold_ends_with_w(name, name_len, s_types_w[i], s_lens[i]))
+            break;
+    }
+
+    return i;
+}
+
+int pathext_contains_w(const wchar_t *name, size_t name_len)
+{
+    size_t i;
+    size_t j;
+
+    pathext_count();
+    for (i = 0; i < name_len; i++) {
+        if (name[i] != L'.')
+            continue;
+
+        for (j = 0; j < s_count; j++) {
+            if (fold_starts_with_w(name + i, name_len - i, s_types_w[j], s_lens[j]))
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+unsigned long long pathext_hash(void)
+{
+    unsigned long long hash = 0;
+    size_t i;
+
+    for (i = 0; i < pathext_count(); i++)
+        hash = (hash ^ fold_hash(s_types[i], s_lens[i])) * 1099511628211ULL;
+
+    return hash;
+}
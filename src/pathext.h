@@ -0,0 +1,47 @@
+// pathext.h : the file types run treats as programs
+//
+// (MIT license - see run.c)
+//
+// The types are the ones the command prompt runs by name: RUN_PATHEXT if it
+// is set, otherwise PATHEXT, otherwise .COM;.EXE;.BAT;.CMD (or none on other
+// systems, whose programs have no type). Their order is their precedence, so
+// of "tool.cmd" and "tool.exe" the one whose type comes first is preferred,
+// as the command prompt would. Each type is also kept as a wide string for
+// checking the names in the change journals.
+
+#ifndef RUN_PATHEXT_H
+#define RUN_PATHEXT_H
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PATHEXT_MAX_TYPES 16
+#define PATHEXT_MAX_LEN 16          // Of a type, its dot included
+
+// Reads the types from the environment; the other calls load them if needed
+void pathext_load(void);
+
+size_t pathext_count(void);
+
+// The i'th type in precedence order, its dot included (".EXE")
+const char *pathext_type(size_t i);
+
+// The precedence of the type name ends with, pathext_count() if it is none
+size_t pathext_rank(const char *name, size_t name_len);
+size_t pathext_rank_w(const wchar_t *name, size_t name_len);
+
+// Whether one of the types follows some dot in name (as in "tool.exe.tmp")
+int pathext_contains_w(const wchar_t *name, size_t name_len);
+
+// Fingerprint of the types and their order
+unsigned long long pathext_hash(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,590 @@
+// pathindex.c : the programs in the PATH directories, kept in a file
+//
+// (MIT license - see run.c)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pathindex.h"
+#include "pathext.h"
+#include "strfold.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#define PATH_SEPARATOR ';'
+#define DIR_SEPARATOR '\\'
+#define TICKS_PER_MS 10000ULL           // FILETIME
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#define PATH_SEPARATOR ':'
+#define DIR_SEPARATOR '/'
+#define TICKS_PER_MS 1000000ULL         // Nanoseconds
+#endif
+
+#define PATH_INDEX_MAGIC 0x31495052     // "RPI1"
+#define SETTLE_MS 2000                  // A directory changed this recently may still be changing
+#define NOT_LISTED 0                    // A directory's time when it is to be listed again
+#define NO_DIRECTORY 1                  // Its time when there is no such directory
+
+// The index file is the header followed by the dirs, the programs, the hash
+// slots and the strings they point into
+struct PathIndexHeader
+{
+    unsigned magic;
+    unsigned n_dirs;
+    unsigned n_programs;
+    unsigned n_slots;                   // A power of two
+    unsigned strings_size;
+    unsigned reserved;
+    unsigned long long types_hash;      // Of the program types it was listed with
+};
+
+struct PathDir
+{
+    unsigned long long write_time;
+    unsigned path;                      // Offset in the strings
+    unsigned path_len;
+    unsigned first;                     // Its programs
+    unsigned n_programs;
+};
+
+struct PathProgram
+{
+    unsigned name;
+    unsigned short name_len;
+    unsigned short stem_len;            // Without its type
+    unsigned dir;
+    unsigned next;                      // The next in its slot's chain, plus one
+};
+
+struct PathIndex
+{
+    struct PathIndexHeader header;
+    struct PathDir *dirs;
+    struct PathProgram *programs;
+    unsigned *slots;                    // The first program in each chain, plus one
+    char *strings;                      // Each string is followed by a '\0'
+    void *file;                         // What a loaded index points into
+    size_t programs_alloc;              // Capacities of an index being built
+    size_t strings_alloc;
+};
+
+static int same_name(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+#ifdef _WIN32
+    return fold_equals(a, a_len, b, b_len);
+#else
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+#endif
+}
+
+static unsigned long long now_ticks()
+{
+#ifdef _WIN32
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+    return ((unsigned long long)now.dwHighDateTime << 32) | now.dwLowDateTime;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// NO_DIRECTORY if path is not a directory
+static unsigned long long dir_write_time(const char *path)
+{
+    unsigned long long time;
+
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || !(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        return NO_DIRECTORY;
+
+    time = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NO_DIRECTORY;
+
+    time = (unsigned long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+
+    return time > NO_DIRECTORY ? time : NO_DIRECTORY + 1;
+}
+
+static void free_index(struct PathIndex *index)
+{
+    if (index->file) {
+        free(index->file);
+    }
+    else {
+        free(index->dirs);
+        free(index->programs);
+        free(index->slots);
+        free(index->strings);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// Reads the whole file and checks that everything in it points inside it
+static int load(struct PathIndex *index, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    struct PathIndexHeader header;
+    size_t size;
+    char *data;
+    int is_sound;
+    unsigned i;
+
+    if (!file)
+        return 0;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != PATH_INDEX_MAGIC ||
+        header.n_dirs > PATH_INDEX_MAX_DIRS || header.types_hash != pathext_hash() ||
+        header.n_slots == 0 || (header.n_slots & (header.n_slots - 1)) != 0 || header.strings_size == 0) {
+        fclose(file);
+        return 0;
+    }
+
+    size = header.n_dirs * sizeof(struct PathDir) + (size_t)header.n_programs * sizeof(struct PathProgram) +
+        (size_t)header.n_slots * sizeof(unsigned) + header.strings_size;
+    data = (char *)malloc(size);
+    if (!data || fread(data, 1, size, file) != size || fgetc(file) != EOF) {
+        free(data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    index->header = header;
+    index->file = data;
+    index->dirs = (struct PathDir *)data;
+    index->programs = (struct PathProgram *)(index->dirs + header.n_dirs);
+    index->slots = (unsigned *)(index->programs + header.n_programs);
+    index->strings = (char *)(index->slots + header.n_slots);
+
+    is_sound = index->strings[header.strings_size - 1] == '\0';
+    for (i = 0; is_sound && i < header.n_dirs; i++) {
+        const struct PathDir *dir = &index->dirs[i];
+
+        is_sound = dir->path_len > 0 && dir->path < header.strings_size && dir->path_len < header.strings_size - dir->path &&
+            dir->first <= header.n_programs && dir->n_programs <= header.n_programs - dir->first;
+    }
+    for (i = 0; is_sound && i < header.n_programs; i++) {
+        const struct PathProgram *program = &index->programs[i];
+
+        is_sound = program->name < header.strings_size && program->name_len < header.strings_size - program->name &&
+            program->stem_len <= program->name_len && program->dir < header.n_dirs && program->next <= header.n_programs;
+    }
+    for (i = 0; is_sound && i < header.n_slots; i++)
+        is_sound = index->slots[i] <= header.n_programs;
+
+    if (!is_sound)
+        free_index(index);
+
+    return is_sound;
+}
+
+// Written to a file of its own first, so runs racing each other never see half an index
+static void save(const struct PathIndex *index, const char *path)
+{
+    char temp_path[4096];
+    FILE *file;
+    int ok;
+
+#ifdef _WIN32
+    sprintf_s(temp_path, sizeof(temp_path), "%s.%lu", path, GetCurrentProcessId());
+#else
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld", path, (long)getpid());
+#endif
+    file = fopen(temp_path, "wb");
+    if (!file)
+        return;
+
+    ok = fwrite(&index->header, sizeof(index->header), 1, file) == 1 &&
+        fwrite(index->dirs, sizeof(struct PathDir), index->header.n_dirs, file) == index->header.n_dirs &&
+        fwrite(index->programs, sizeof(struct PathProgram), index->header.n_programs, file) == index->header.n_programs &&
+        fwrite(index->slots, sizeof(unsigned), index->header.n_slots, file) == index->header.n_slots &&
+        fwrite(index->strings, 1, index->header.strings_size, file) == index->header.strings_size;
+    ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+    if (!ok || !MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileA(temp_path);
+#else
+    if (!ok || rename(temp_path, path) != 0)
+        remove(temp_path);
+#endif
+}
+
+// Returns the string's offset, or -1 when out of memory
+static long add_string(struct PathIndex *index, const char *str, size_t len)
+{
+    size_t offset = index->header.strings_size;
+
+    if (offset + len + 1 > index->strings_alloc) {
+        size_t alloc = index->strings_alloc ? index->strings_alloc * 2 : 65536;
+        char *strings;
+
+        while (alloc < offset + len + 1)
+            alloc *= 2;
+        strings = (char *)realloc(index->strings, alloc);
+        if (!strings)
+            return -1;
+        index->strings = strings;
+        index->strings_alloc = alloc;
+    }
+
+    memcpy(index->strings + offset, str, len);
+    index->strings[offset + len] = '\0';
+    index->header.strings_size += (unsigned)len + 1;
+    return (long)offset;
+}
+
+// Adds the file to the last directory if it is a program. Returns 0 when out of memory.
+static int add_program(struct PathIndex *index, const char *name, size_t name_len)
+{
+    struct PathProgram *program;
+    size_t n_types = pathext_count();
+    size_t type = pathext_rank(name, name_len);
+    long offset;
+
+    if ((n_types && type == n_types) || name_len > 0xFFFF)
+        return 1;
+
+    if (index->header.n_programs == index->programs_alloc) {
+        size_t alloc = index->programs_alloc ? index->programs_alloc * 2 : 4096;
+        struct PathProgram *programs = (struct PathProgram *)realloc(index->programs, alloc * sizeof(struct PathProgram));
+
+        if (!programs)
+            return 0;
+        index->programs = programs;
+        index->programs_alloc = alloc;
+    }
+
+    offset = add_string(index, name, name_len);
+    if (offset < 0)
+        return 0;
+
+    program = &index->programs[index->header.n_programs++];
+    program->name = (unsigned)offset;
+    program->name_len = (unsigned short)name_len;
+    program->stem_len = (unsigned short)(type < n_types ? name_len - strlen(pathext_type(type)) : name_len);
+    program->dir = index->header.n_dirs - 1;
+    program->next = 0;
+    index->dirs[program->dir].n_programs++;
+    return 1;
+}
+
+// Adds the programs in the last directory. Returns 0 when out of memory.
+static int list_dir(struct PathIndex *index, const char *path, size_t path_len)
+{
+#ifdef _WIN32
+    char pattern[MAX_PATH + 2];
+    WIN32_FIND_DATAA data;
+    HANDLE find;
+    int ok = 1;
+
+    if (path_len + 3 > sizeof(pattern))
+        return 1;
+
+    sprintf_s(pattern, sizeof(pattern), path[path_len - 1] == DIR_SEPARATOR ? "%s*" : "%s\\*", path);
+    find = FindFirstFileExA(pattern, FindExInfoBasic, &data, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+        return 1;
+
+    do {
+        // A name the code page cannot hold comes with '?' in it, and could not be run by it
+        if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && !strchr(data.cFileName, '?'))
+            ok = add_program(index, data.cFileName, strlen(data.cFileName));
+    } while (ok && FindNextFileA(find, &data));
+
+    FindClose(find);
+    return ok;
+#else
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    int ok = 1;
+
+    if (path_len >= PATH_MAX)
+        return 1;
+
+    dir = opendir(path);
+    if (!dir)
+        return 1;
+
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (entry->d_type == DT_DIR)
+            continue;
+        if (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111))
+            ok = add_program(index, entry->d_name, strlen(entry->d_name));
+    }
+
+    closedir(dir);
+    return ok;
+#endif
+}
+
+// Chains each program into the slot of its name without the type
+static int hash_programs(struct PathIndex *index)
+{
+    unsigned n_slots = 16;
+    unsigned i;
+
+    while (n_slots < 2 * index->header.n_programs)
+        n_slots *= 2;
+
+    index->slots = (unsigned *)calloc(n_slots, sizeof(unsigned));
+    if (!index->slots)
+        return 0;
+
+    index->header.n_slots = n_slots;
+    for (i = 0; i < index->header.n_programs; i++) {
+        struct PathProgram *program = &index->programs[i];
+        unsigned slot = (unsigned)fold_hash(index->strings + program->name, program->stem_len) & (n_slots - 1);
+
+        program->next = index->slots[slot];
+        index->slots[slot] = i + 1;
+    }
+
+    return 1;
+}
+
+// Splits the PATH value in place, leaving out empty and repeated directories
+static size_t split_path(char *list, char **dirs, size_t *lens)
+{
+    size_t n_dirs = 0;
+    char *dir = list;
+    size_t i;
+
+    while (*dir && n_dirs < PATH_INDEX_MAX_DIRS) {
+        char *end = strchr(dir, PATH_SEPARATOR);
+        char *next = end ? end + 1 : dir + strlen(dir);
+        size_t len;
+
+        if (end)
+            *end = '\0';
+#ifdef _WIN32
+        if (*dir == '"') {
+            dir++;
+            if (*dir && dir[strlen(dir) - 1] == '"')
+                dir[strlen(dir) - 1] = '\0';
+        }
+#endif
+        len = strlen(dir);
+        for (i = 0; len && i < n_dirs; i++) {
+            if (same_name(dirs[i], lens[i], dir, len))
+                len = 0;
+        }
+        if (len) {
+            dirs[n_dirs] = dir;
+            lens[n_dirs++] = len;
+        }
+
+        dir = next;
+    }
+
+    return n_dirs;
+}
+
+static char *read_path()
+{
+#ifdef _WIN32
+    DWORD size = GetEnvironmentVariableA("PATH", NULL, 0);
+    char *list;
+
+    if (size == 0)
+        return NULL;
+
+    list = (char *)malloc(size);
+    if (list && GetEnvironmentVariableA("PATH", list, size) >= size) {
+        free(list);
+        return NULL;
+    }
+
+    return list;
+#else
+    const char *env = getenv("PATH");
+    char *list = env ? (char *)malloc(strlen(env) + 1) : NULL;
+
+    if (list)
+        strcpy(list, env);
+
+    return list;
+#endif
+}
+
+static const struct PathDir *find_dir(const struct PathIndex *index, const char *path, size_t path_len)
+{
+    unsigned i;
+
+    for (i = 0; i < index->header.n_dirs; i++) {
+        const struct PathDir *dir = &index->dirs[i];
+
+        if (same_name(index->strings + dir->path, dir->path_len, path, path_len))
+            return dir;
+    }
+
+    return NULL;
+}
+
+// Builds the index for dirs, taking the programs of the directories that did
+// not change from the old index. Returns 0 when out of memory.
+static int build(struct PathIndex *index, const struct PathIndex *old, char **dirs, size_t *lens,
+    const unsigned long long *times, size_t n_dirs, size_t *n_listed)
+{
+    unsigned long long now = now_ticks();
+    size_t i;
+
+    index->header.magic = PATH_INDEX_MAGIC;
+    index->header.types_hash = pathext_hash();
+    index->dirs = (struct PathDir *)calloc(n_dirs + 1, sizeof(struct PathDir));
+    if (!index->dirs)
+        return 0;
+
+    *n_listed = 0;
+    for (i = 0; i < n_dirs; i++) {
+        const struct PathDir *old_dir = find_dir(old, dirs[i], lens[i]);
+        struct PathDir *dir = &index->dirs[index->header.n_dirs++];
+        long offset = add_string(index, dirs[i], lens[i]);
+        unsigned j;
+
+        if (offset < 0)
+            return 0;
+
+        dir->path = (unsigned)offset;
+        dir->path_len = (unsigned)lens[i];
+        dir->first = index->header.n_programs;
+        dir->write_time = times[i];
+
+        if (old_dir && old_dir->write_time == times[i] && times[i] != NOT_LISTED) {
+            for (j = 0; j < old_dir->n_programs; j++) {
+                const struct PathProgram *program = &old->programs[old_dir->first + j];
+
+                if (!add_program(index, old->strings + program->name, program->name_len))
+                    return 0;
+            }
+        }
+        else if (times[i] != NO_DIRECTORY) {
+            if (!list_dir(index, dirs[i], lens[i]))
+                return 0;
+            (*n_listed)++;
+
+            // A file added in the same tick as the listing may have been missed
+            if (times[i] + SETTLE_MS * TICKS_PER_MS > now)
+                dir->write_time = NOT_LISTED;
+        }
+    }
+
+    return hash_programs(index);
+}
+
+static int find_program(const struct PathIndex *index, const char *name, size_t name_len, char *full_path, size_t full_path_size)
+{
+    size_t n_types = pathext_count();
+    size_t given_type = pathext_rank(name, name_len);
+    size_t stem_len = given_type < n_types ? name_len - strlen(pathext_type(given_type)) : name_len;
+    const struct PathProgram *best = NULL;
+    size_t best_type = 0;
+    const struct PathDir *dir;
+    size_t dir_len;
+    unsigned next;
+
+    if (stem_len == 0)
+        return 0;
+
+    next = index->slots[(unsigned)fold_hash(name, stem_len) & (index->header.n_slots - 1)];
+    while (next) {
+        const struct PathProgram *program = &index->programs[next - 1];
+        const char *program_name = index->strings + program->name;
+
+        size_t type;
+
+        next = program->next;
+        if (!same_name(program_name, program->stem_len, name, stem_len))
+            continue;
+        if (given_type < n_types && !same_name(program_name, program->name_len, name, name_len))
+            continue;
+
+        // The first directory wins, then the first type
+        type = pathext_rank(program_name, program->name_len);
+        if (!best || program->dir < best->dir || (program->dir == best->dir && type < best_type)) {
+            best = program;
+            best_type = type;
+        }
+    }
+
+    if (!best)
+        return 0;
+
+    dir = &index->dirs[best->dir];
+    dir_len = dir->path_len;
+    if (dir_len + 1 + best->name_len >= full_path_size)
+        return 0;
+
+    memcpy(full_path, index->strings + dir->path, dir_len);
+    if (full_path[dir_len - 1] != DIR_SEPARATOR)
+        full_path[dir_len++] = DIR_SEPARATOR;
+    memcpy(full_path + dir_len, index->strings + best->name, best->name_len + 1);
+    return 1;
+}
+
+int path_index_lookup(const char *index_path, const char *name, size_t name_len, char *full_path, size_t full_path_size,
+    struct PathIndexStats *stats)
+{
+    struct PathIndex old = { 0 };
+    struct PathIndex built = { 0 };
+    const struct PathIndex *index = &old;
+    char *dirs[PATH_INDEX_MAX_DIRS];
+    size_t lens[PATH_INDEX_MAX_DIRS];
+    unsigned long long times[PATH_INDEX_MAX_DIRS];
+    char *list = read_path();
+    size_t n_dirs;
+    size_t i;
+    int is_valid;
+    int is_found = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!list)
+        return 0;
+
+    n_dirs = split_path(list, dirs, lens);
+    is_valid = load(&old, index_path) && old.header.n_dirs == n_dirs;
+    for (i = 0; i < n_dirs; i++) {
+        times[i] = dir_write_time(dirs[i]);
+        is_valid = is_valid && times[i] == old.dirs[i].write_time &&
+            same_name(old.strings + old.dirs[i].path, old.dirs[i].path_len, dirs[i], lens[i]);
+    }
+
+    if (!is_valid) {
+        if (!build(&built, &old, dirs, lens, times, n_dirs, &stats->n_listed)) {
+            free_index(&built);
+            free_index(&old);
+            free(list);
+            return 0;
+        }
+        save(&built, index_path);
+        index = &built;
+    }
+
+    stats->n_dirs = n_dirs;
+    stats->n_programs = index->header.n_programs;
+    is_found = find_program(index, name, name_len, full_path, full_path_size);
+
+    free_index(&built);
+    free_index(&old);
+    free(list);
+    return is_found;
+}
@@ -0,0 +1,46 @@
+// pathindex.h : the programs in the PATH directories, kept in a file
+//
+// (MIT license - see run.c)
+//
+// Most names typed to run are of programs in some PATH directory, and the
+// index answers those without asking Everything. It holds the programs of
+// each directory (the files with a type from pathext.h, or the executable
+// files on other systems), hashed by their name without the type, and the
+// modification time each directory had when it was listed. Creating,
+// deleting or renaming a file changes its directory's time, so a lookup just
+// compares the times and lists again only the directories that changed or
+// are new on PATH. A directory that changed too recently for its listing to
+// be trusted is listed again next time. Builds for Windows list directories
+// with FindFirstFileEx, others with readdir.
+
+#ifndef RUN_PATHINDEX_H
+#define RUN_PATHINDEX_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PATH_INDEX_MAX_DIRS 256
+
+struct PathIndexStats
+{
+    size_t n_dirs;              // On PATH
+    size_t n_listed;            // Of them, listed again by this lookup
+    size_t n_programs;          // In the index
+};
+
+// Finds name in the PATH directories the way the command prompt would: in
+// the first directory having it, the file whose type comes first in
+// PATHEXT. A name given with its type only finds that type. The index file
+// at index_path is brought up to date first. Returns 0 if no PATH directory
+// has the name.
+int path_index_lookup(const char *index_path, const char *name, size_t name_len, char *full_path, size_t full_path_size,
+    struct PathIndexStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,474 @@
+// picker.c : interactive choice among the programs matching a name
+//
+// (MIT license - see run.c)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "picker.h"
+#include "strfold.h"
+#include "fuzzy.h"
+
+#define PICK_ROWS 12            // Matches shown at a time, fewer in a smaller window
+#define PICK_LINE_SIZE 512      // Wider windows are drawn this wide
+
+// What was fetched: each item's full path, with where its file name starts
+static char *s_strings;
+static size_t s_strings_size;
+static size_t s_strings_capacity;
+static size_t *s_offsets;               // Into s_strings, as s_strings moves while fetching
+static struct FuzzyCandidate *s_items;
+static unsigned *s_char_masks;
+static DWORD s_n_items;
+static DWORD s_items_capacity;
+static int s_is_fetched;
+static int s_is_complete;               // Nothing was left out of the fetch
+static char s_fetched[PICK_TEXT_SIZE];  // The text it was for
+
+// What matches the text typed so far
+static int s_is_fuzzy;                  // The text's characters in order anywhere in the path, not just in a row in the name
+static unsigned *s_matches;
+static struct FuzzyMatch *s_order;      // As listed, best first
+static DWORD s_n_matches;
+static int s_is_filtered;               // s_matches is for s_filtered
+static char s_filtered[PICK_TEXT_SIZE];
+static struct FuzzyPattern s_pattern;
+
+// The console
+static HANDLE s_in;
+static HANDLE s_out;
+static SHORT s_origin;                  // Row of the text; the matches are below it
+static int s_width;
+static int s_rows;
+static DWORD s_first;                   // First match shown
+static DWORD s_selected;
+
+static void *grow(void *array, DWORD capacity, size_t item_size)
+{
+    return realloc(array, capacity * item_size);
+}
+
+void picker_add(const char *file_name, size_t file_name_len, const char *path, size_t path_len)
+{
+    size_t size = path_len + 1 + file_name_len + 1;
+    struct FuzzyCandidate *item;
+    char *full_path;
+
+    if (s_strings_size + size > s_strings_capacity) {
+        size_t capacity = s_strings_capacity ? s_strings_capacity * 2 : 256 * 1024;
+        char *strings;
+
+        while (capacity < s_strings_size + size)
+            capacity *= 2;
+        strings = (char *)realloc(s_strings, capacity);
+        if (!strings) {
+            s_is_complete = FALSE;
+            return;
+        }
+        s_strings = strings;
+        s_strings_capacity = capacity;
+    }
+
+    if (s_n_items == s_items_capacity) {
+        DWORD capacity = s_items_capacity ? s_items_capacity * 2 : 1024;
+        void *offsets = grow(s_offsets, capacity, sizeof(size_t));
+        void *items = offsets ? grow(s_items, capacity, sizeof(struct FuzzyCandidate)) : NULL;
+        void *char_masks = items ? grow(s_char_masks, capacity, sizeof(unsigned)) : NULL;
+        void *matches = char_masks ? grow(s_matches, capacity, sizeof(unsigned)) : NULL;
+        void *order = matches ? grow(s_order, capacity, sizeof(struct FuzzyMatch)) : NULL;
+
+        // What did grow is kept; it is only ever grown again
+        if (offsets)
+            s_offsets = (size_t *)offsets;
+        if (items)
+            s_items = (struct FuzzyCandidate *)items;
+        if (char_masks)
+            s_char_masks = (unsigned *)char_masks;
+        if (matches)
+            s_matches = (unsigned *)matches;
+        if (!order) {
+            s_is_complete = FALSE;
+            return;
+        }
+        s_order = (struct FuzzyMatch *)order;
+        s_items_capacity = capacity;
+    }
+
+    full_path = s_strings + s_strings_size;
+    memcpy(full_path, path, path_len);
+    full_path[path_len] = '\\';
+    memcpy(full_path + path_len + 1, file_name, file_name_len);
+    full_path[size - 1] = '\0';
+
+    item = &s_items[s_n_items];
+    item->len = (unsigned)(size - 1);
+    item->base = (unsigned)(path_len + 1);
+    s_char_masks[s_n_items] = fuzzy_char_mask(full_path, size - 1);
+    s_offsets[s_n_items++] = s_strings_size;
+    s_strings_size += size;
+}
+
+// The text is an optional folder, narrowed by Everything, and a name that
+// can also be narrowed here
+static size_t folder_len(const char *text)
+{
+    const char *last_backslash = strrchr(text, '\\');
+
+    return last_backslash ? last_backslash + 1 - text : 0;
+}
+
+static int has_wildcards(const char *name)
+{
+    return strpbrk(name, "*?") != NULL;
+}
+
+// Whether the characters of earlier are all in text, in order, leaving out
+// those the fuzzy search does
+static int is_subsequence(const char *earlier, const char *text)
+{
+    char earlier_chars[PICK_TEXT_SIZE];
+    char text_chars[PICK_TEXT_SIZE];
+    struct FuzzyCandidate candidate;
+    struct FuzzyPattern pattern;
+
+    candidate.str = text_chars;
+    candidate.len = (unsigned)fuzzy_strip(text_chars, sizeof(text_chars), text);
+    candidate.base = 0;
+    fuzzy_compile(&pattern, earlier_chars, fuzzy_strip(earlier_chars, sizeof(earlier_chars), earlier));
+
+    return fuzzy_score(&pattern, &candidate) != FUZZY_NO_MATCH;
+}
+
+// Whether every match of text is a match of earlier: same folder, and a name
+// containing the earlier one (or, when fuzzy, containing its characters in order)
+static int is_narrower(const char *text, const char *earlier)
+{
+    size_t text_folder_len = folder_len(text);
+    size_t earlier_folder_len = folder_len(earlier);
+    const char *name = text + text_folder_len;
+    const char *earlier_name = earlier + earlier_folder_len;
+
+    if (strcmp(text, earlier) == 0)
+        return TRUE;
+
+    if (s_is_fuzzy)
+        return is_subsequence(earlier, text);
+
+    return
+        fold_equals(text, text_folder_len, earlier, earlier_folder_len) &&
+        !has_wildcards(name) && !has_wildcards(earlier_name) &&
+        fold_find(name, strlen(name), earlier_name, strlen(earlier_name)) != FOLD_NOT_FOUND;
+}
+
+// Keeps the matches of text, from those of the text before it when it only
+// got longer, and ranks them by how closely they match
+static void filter(const char *text)
+{
+    const char *name = text + folder_len(text);
+    size_t name_len = strlen(name);
+    int is_from_matches = s_is_filtered && is_narrower(text, s_filtered);
+    DWORD n_candidates = is_from_matches ? s_n_matches : s_n_items;
+    DWORD n_matches = 0;
+    DWORD i;
+
+    if (s_is_fuzzy) {
+        char chars[PICK_TEXT_SIZE];
+
+        fuzzy_compile(&s_pattern, chars, fuzzy_strip(chars, sizeof(chars), text));
+        n_matches = (DWORD)fuzzy_rank(&s_pattern, s_items, s_char_masks, is_from_matches ? s_matches : NULL, n_candidates, s_order);
+        for (i = 0; i < n_matches; i++)
+            s_matches[i] = s_order[i].index;
+    }
+    else {
+        int is_wild = has_wildcards(name);
+
+        for (i = 0; i < n_candidates; i++) {
+            unsigned index = is_from_matches ? s_matches[i] : i;
+            const struct FuzzyCandidate *item = &s_items[index];
+
+            if (is_wild || fold_find(item->str + item->base, item->len - item->base, name, name_len) != FOLD_NOT_FOUND)
+                s_matches[n_matches++] = index;
+        }
+
+        // Everything matched a wildcard; the order it gave stands
+        fuzzy_compile(&s_pattern, name, is_wild ? 0 : name_len);
+        n_matches = (DWORD)fuzzy_rank(&s_pattern, s_items, s_char_masks, s_matches, n_matches, s_order);
+    }
+
+    s_n_matches = n_matches;
+    strcpy(s_filtered, text);
+    s_is_filtered = TRUE;
+}
+
+// Fetches again only when what was fetched does not cover text
+static int refine(const char *text, PICK_FETCH_PROC fetch_proc, void *context)
+{
+    DWORD i;
+
+    if (!s_is_fetched || !is_narrower(text, s_fetched) || (!s_is_complete && strcmp(text, s_fetched) != 0)) {
+        int status;
+
+        s_n_items = 0;
+        s_strings_size = 0;
+        s_n_matches = 0;
+        s_is_filtered = FALSE;
+        s_is_fetched = TRUE;
+        s_is_complete = TRUE;
+        strcpy(s_fetched, text);
+
+        status = fetch_proc(text, context);
+        if (status == PICK_FETCH_FAILED)
+            return FALSE;
+        if (status == PICK_FETCH_SOME)
+            s_is_complete = FALSE;
+
+        for (i = 0; i < s_n_items; i++)
+            s_items[i].str = s_strings + s_offsets[i];
+    }
+
+    filter(text);
+    return TRUE;
+}
+
+// Lists the matches of text from the top
+static int update(const char *text, PICK_FETCH_PROC fetch_proc, void *context)
+{
+    s_first = 0;
+    s_selected = 0;
+    return refine(text, fetch_proc, context);
+}
+
+static int is_edit_key(const KEY_EVENT_RECORD *key)
+{
+    return key->wVirtualKeyCode == VK_BACK || key->uChar.AsciiChar == 21 || (unsigned char)key->uChar.AsciiChar >= ' ';
+}
+
+static void draw_line(int row, const char *line, size_t line_len)
+{
+    char padded[PICK_LINE_SIZE];
+    COORD at;
+    DWORD written;
+
+    if (line_len > (size_t)s_width)
+        line_len = s_width;
+    memcpy(padded, line, line_len);
+    memset(padded + line_len, ' ', s_width - line_len);
+
+    at.X = 0;
+    at.Y = (SHORT)(s_origin + row);
+    WriteConsoleOutputCharacterA(s_out, padded, s_width, at, &written);
+}
+
+static void draw(const char *text)
+{
+    char line[PICK_LINE_SIZE];
+    COORD caret;
+    int len;
+    int row;
+
+    // Keep the selection in view
+    if (s_selected < s_first)
+        s_first = s_selected;
+    else if (s_selected >= s_first + s_rows)
+        s_first = s_selected - s_rows + 1;
+
+    len = snprintf(line, sizeof(line), "run> %s  [%lu/%lu%s]", text, (unsigned long)s_n_matches, (unsigned long)s_n_items, s_is_complete ? "" : "+");
+    if (len < 0 || len >= (int)sizeof(line))
+        len = sizeof(line) - 1;
+    draw_line(0, line, len);
+
+    for (row = 0; row < s_rows; row++) {
+        DWORD i = s_first + row;
+
+        if (i < s_n_matches) {
+            const struct FuzzyCandidate *item = &s_items[s_order[i].index];
+
+            len = snprintf(line, sizeof(line), "%c %s [%.*s]", i == s_selected ? '>' : ' ', item->str + item->base, (int)item->base - 1, item->str);
+            if (len < 0 || len >= (int)sizeof(line))
+                len = sizeof(line) - 1;
+            draw_line(row + 1, line, len);
+        }
+        else {
+            draw_line(row + 1, "", 0);
+        }
+    }
+
+    caret.X = (SHORT)(strlen("run> ") + strlen(text) < (size_t)s_width ? strlen("run> ") + strlen(text) : s_width - 1);
+    caret.Y = s_origin;
+    SetConsoleCursorPosition(s_out, caret);
+}
+
+// Makes room below the cursor for the text and the matches
+static void open_area()
+{
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    DWORD written;
+    int i;
+
+    GetConsoleScreenBufferInfo(s_out, &info);
+    s_width = info.srWindow.Right - info.srWindow.Left + 1;
+    if (s_width > PICK_LINE_SIZE)
+        s_width = PICK_LINE_SIZE;
+    s_rows = info.srWindow.Bottom - info.srWindow.Top;
+    if (s_rows > PICK_ROWS)
+        s_rows = PICK_ROWS;
+    if (s_rows < 1)
+        s_rows = 1;
+
+    for (i = 0; i < s_rows; i++)
+        WriteConsoleA(s_out, "\n", 1, &written, NULL);
+
+    GetConsoleScreenBufferInfo(s_out, &info);
+    s_origin = info.dwCursorPosition.Y - (SHORT)s_rows;
+    if (s_origin < 0)
+        s_origin = 0;
+}
+
+static void close_area()
+{
+    COORD home;
+    int row;
+
+    for (row = 0; row <= s_rows; row++)
+        draw_line(row, "", 0);
+
+    home.X = 0;
+    home.Y = s_origin;
+    SetConsoleCursorPosition(s_out, home);
+}
+
+int picker_run(const char *text, int is_fuzzy, PICK_FETCH_PROC fetch_proc, void *context, char *full_path, size_t full_path_size)
+{
+    char edit[PICK_TEXT_SIZE];
+    size_t edit_len;
+    DWORD in_mode;
+    int result = PICK_CANCELLED;
+    int is_done = FALSE;
+
+    s_in = CreateFileA("CONIN$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    s_out = CreateFileA("CONOUT$", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    if (s_in == INVALID_HANDLE_VALUE || s_out == INVALID_HANDLE_VALUE || !GetConsoleMode(s_in, &in_mode)) {
+        if (s_in != INVALID_HANDLE_VALUE)
+            CloseHandle(s_in);
+        if (s_out != INVALID_HANDLE_VALUE)
+            CloseHandle(s_out);
+        return PICK_NO_CONSOLE;
+    }
+
+    // Ctrl+C cancels like Esc rather than leaving the list on the screen
+    SetConsoleMode(s_in, in_mode & ~(ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT));
+
+    edit_len = strlen(text) < sizeof(edit) ? strlen(text) : sizeof(edit) - 1;
+    memcpy(edit, text, edit_len);
+    edit[edit_len] = '\0';
+
+    open_area();
+    s_is_fuzzy = is_fuzzy;
+    s_is_fetched = FALSE;
+    if (!update(edit, fetch_proc, context)) {
+        result = PICK_FAILED;
+        is_done = TRUE;
+    }
+
+    while (!is_done) {
+        int is_edited = FALSE;
+        DWORD n_pending = 0;
+
+        draw(edit);
+
+        // Everything already typed is taken in before the list is redrawn
+        do {
+            INPUT_RECORD input;
+            DWORD n_read;
+            const KEY_EVENT_RECORD *key = &input.Event.KeyEvent;
+
+            if (!ReadConsoleInputA(s_in, &input, 1, &n_read)) {
+                is_done = TRUE;
+                break;
+            }
+            if (n_read == 0 || input.EventType != KEY_EVENT || !key->bKeyDown)
+                continue;
+
+            // Moving and choosing act on the list for what was typed before them
+            if (is_edited && !is_edit_key(key)) {
+                is_edited = FALSE;
+                if (!update(edit, fetch_proc, context)) {
+                    result = PICK_FAILED;
+                    is_done = TRUE;
+                    break;
+                }
+            }
+
+            switch (key->wVirtualKeyCode) {
+                case VK_RETURN:
+                    if (s_n_matches) {
+                        snprintf(full_path, full_path_size, "%s", s_items[s_order[s_selected].index].str);
+                        result = PICK_CHOSEN;
+                        is_done = TRUE;
+                    }
+                    break;
+
+                case VK_ESCAPE:
+                    is_done = TRUE;
+                    break;
+
+                case VK_UP:
+                    if (s_selected > 0)
+                        s_selected--;
+                    break;
+
+                case VK_DOWN:
+                    if (s_selected + 1 < s_n_matches)
+                        s_selected++;
+                    break;
+
+                case VK_PRIOR:
+                    s_selected = s_selected > (DWORD)s_rows ? s_selected - s_rows : 0;
+                    break;
+
+                case VK_NEXT:
+                    s_selected = s_selected + s_rows < s_n_matches ? s_selected + s_rows : (s_n_matches ? s_n_matches - 1 : 0);
+                    break;
+
+                case VK_BACK:
+                    if (edit_len) {
+                        edit[--edit_len] = '\0';
+                        is_edited = TRUE;
+                    }
+                    break;
+
+                default:
+                    if (key->uChar.AsciiChar == 3) {            // Ctrl+C
+                        is_done = TRUE;
+                    }
+                    else if (key->uChar.AsciiChar == 21) {      // Ctrl+U
+                        edit_len = 0;
+                        edit[0] = '\0';
+                        is_edited = TRUE;
+                    }
+                    else if ((unsigned char)key->uChar.AsciiChar >= ' ' && edit_len + 1 < sizeof(edit)) {
+                        edit[edit_len++] = key->uChar.AsciiChar;
+                        edit[edit_len] = '\0';
+                        is_edited = TRUE;
+                    }
+                    break;
+            }
+        } while (!is_done && GetNumberOfConsoleInputEvents(s_in, &n_pending) && n_pending);
+
+        if (is_edited && !is_done) {
+            if (!update(edit, fetch_proc, context)) {
+                result = PICK_FAILED;
+                is_done = TRUE;
+            }
+        }
+    }
+
+    close_area();
+    SetConsoleMode(s_in, in_mode);
+    CloseHandle(s_in);
+    CloseHandle(s_out);
+
+    return result;
+}
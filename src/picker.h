@@ -0,0 +1,52 @@
+// picker.h : interactive choice among the programs matching a name
+//
+// (MIT license - see run.c)
+//
+// The picker asks for the matches of the text it starts with once, keeps
+// them in memory and narrows them locally as the user types, so a keystroke
+// costs a scan of what was fetched rather than a round trip to Everything.
+// It asks again only when the text stops being covered by what was fetched:
+// when a character of the fetched text is deleted, or when the fetch was cut
+// short at PICK_MAX_ITEMS. Keys that arrive together are handled as one
+// change. The matches are listed best first, as ranked by fuzzy.h. The list
+// is drawn on the console itself (CONOUT$) and keys are read from it
+// (CONIN$), so the standard handles stay free for -p.
+
+#ifndef RUN_PICKER_H
+#define RUN_PICKER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PICK_MAX_ITEMS 65536    // Matches fetched at a time
+#define PICK_TEXT_SIZE 256
+
+// What a fetch returns
+#define PICK_FETCH_ALL 0        // Every match was passed to picker_add
+#define PICK_FETCH_SOME 1       // There were more than PICK_MAX_ITEMS
+#define PICK_FETCH_FAILED 2
+
+// What picker_run returns
+#define PICK_CHOSEN 0
+#define PICK_CANCELLED 1
+#define PICK_NO_CONSOLE 2
+#define PICK_FAILED 3           // A fetch failed
+
+// Asked for the programs matching text, in the order they are to be listed
+typedef int (*PICK_FETCH_PROC)(const char *text, void *context);
+
+void picker_add(const char *file_name, size_t file_name_len, const char *path, size_t path_len);
+
+// Lets the user narrow the matches of text and choose one; its full path is
+// copied to full_path. With is_fuzzy, a path matches when it has the text's
+// characters in order anywhere (see fuzzy.h) rather than in a row in the name.
+int picker_run(const char *text, int is_fuzzy, PICK_FETCH_PROC fetch_proc, void *context, char *full_path, size_t full_path_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,7 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 #include <stdio.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <io.h>
 #include <limits.h>
@@ -31,32 +32,77 @@
 
 #define  EVERYTHINGUSERAPI
 #include "../include/Everything.h"
+#include "strfold.h"
+#include "misscache.h"
+#include "sharedcache.h"
+#include "nameindex.h"
+#include "picker.h"
+#include "fuzzy.h"
+#include "pathext.h"
+#include "pathindex.h"
+#include "locatedb.h"
+
+#define LIST_ROWS 64        // Rows in the first page of a -l listing
+#define MAX_PAGE_ROWS 1024  // Pages double in size up to this many rows
+#define SKIP_SLACK 8        // Extra rows fetched for -# in case some are skipped files
+#define MAX_TIERS 3
+#define FUZZY_ROWS 65536    // Matches ranked by -z
+#define LOCATE_ROWS 65536   // Matches read from a locate database at a time
+#define NAME_INDEX_REBUILD_MS (24 * 60 * 60 * 1000) // A full rebuild also drops the programs that are gone
+#define NAME_INDEX_REFRESH_MS (5 * 60 * 1000)       // How stale the index may get when the journals cannot tell
 
 struct Favorite
 {
     char *name;
+    size_t name_len;
     char *executable;
     struct Favorite *next;
 };
 static struct Favorite *s_Favorites;
 
+static DWORD s_timeout = INFINITE;  // -t<ms>: budget shared by all the search tiers
+static DWORD s_start_tick;
+static int s_verbose;       // -v: report the planner's decisions
+static DWORD s_shared_ms;   // -c<ms>: reuse what other runs resolved this recently
+
+// A search tier's first page; all the tiers are asked at once (see probe_tiers)
+struct TierProbe
+{
+    int tier;
+    char *name;
+    char pattern[4096];
+    int rows;
+    HANDLE thread;
+    EVERYTHING_SNAPSHOT snapshot;
+    DWORD error;
+    int total;
+    int qualifies;
+};
+static HANDLE s_probes_done;    // Set once a tier has won, cancelling the tiers still running
+
 static void help()
 {
     fprintf(stderr, "Usage: run [options] <program> <...program parameters...>\n");
-    fprintf(stderr, "\tprogram: (partial) name of program without .exe\n");
+    fprintf(stderr, "\tprogram: (partial) name of program without its type (any in PATHEXT, or in RUN_PATHEXT if set)\n");
     fprintf(stderr, "\t-#: Run the #'th program as listed by -l\n");
+    fprintf(stderr, "\t-c<ms>: Reuse the program another run found for the same name in the last <ms> milliseconds\n");
     fprintf(stderr, "\t-d: Remove the given program from the favorites list\n");
     fprintf(stderr, "\t-f: List favorites\n");
+    fprintf(stderr, "\t-i: Pick the program from the matching ones, narrowing them as you type\n");
     fprintf(stderr, "\t-k: Pause after run\n");
     fprintf(stderr, "\t-l: Just list matching names\n");
     fprintf(stderr, "\t-p: Print matching program path to the standard output (without running it)\n");
-    fprintf(stderr, "\t-s: With -#, save the #'th program as listed by -l as the favorite for the given program\n");
+    fprintf(stderr, "\t-s: With -# or -i, save the chosen program as the favorite for the given program\n");
+    fprintf(stderr, "\t-t<ms>: Wait up to <ms> milliseconds for Everything to be ready and answer\n");
+    fprintf(stderr, "\t-v: Show how the search was planned\n");
     fprintf(stderr, "\t-w: Use whole-word search\n");
+    fprintf(stderr, "\t-z: Match paths having the program's letters in order, best match first\n");
+    fprintf(stderr, "\t--complete <prefix>: List the program names starting with <prefix> (for shell completion)\n");
+    fprintf(stderr, "\tRUN_LOCATE_DB: When Everything is not running, search this file database (an Everything .efu file list, mlocate's database, or a list of full paths) instead\n");
 }
 
-static void print_error()
+static void print_error(int err)
 {
-    int err = Everything_GetLastError();
     char err_buff[256] = { 0 }, *err_str = err_buff;
 
     switch (err) {
@@ -66,21 +112,52 @@ static void print_error()
         case EVERYTHING_ERROR_IPC:              err_str = "Everything error: Is EverythingSearch running? (IPC)"; break;
         case EVERYTHING_ERROR_MEMORY:           err_str = "Everything error: MEMORY	"; break;
         case EVERYTHING_ERROR_INVALIDCALL:      err_str = "Everything error: INVALIDCALL"; break;
+        case EVERYTHING_ERROR_TIMEOUT:          err_str = "Everything error: Timed out"; break;
+        case EVERYTHING_ERROR_CANCELLED:        err_str = "Everything error: CANCELLED"; break;
         default:                                sprintf(err_buff, "Everything error: Unknown error code %d", err);
     }
 
     fprintf(stderr, "%s", err_str);
 }
 
-static void reset_search(char *pattern)
+static void verbose(const char *fmt, ...)
+{
+    va_list args;
+
+    if (!s_verbose)
+        return;
+
+    va_start(args, fmt);
+    fprintf(stderr, "run: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+static void exit_query_error(int err, int tier, const char *pattern)
 {
-    Everything_Reset();
-    Everything_SetMax(200);
-    Everything_SetSearch(pattern);
+    print_error(err);
+    if (err == EVERYTHING_ERROR_TIMEOUT)
+        fprintf(stderr, " in search tier %d of 3 (%s)", tier, pattern);
+    fprintf(stderr, "\n");
+    exit(5);
 }
 
-// Turn "c:\location\prog.exe" into "path:c:\location prog.exe" for Everything
-static void set_pattern_if_path(char *pattern, int pattern_size, char *input)
+// What is left of the -t budget, INFINITE without one
+static DWORD remaining_budget()
+{
+    DWORD elapsed;
+
+    if (s_timeout == INFINITE)
+        return INFINITE;
+
+    elapsed = GetTickCount() - s_start_tick;
+    return elapsed < s_timeout ? s_timeout - elapsed : 0;
+}
+
+// Turn "c:\location\prog.exe" into "path:c:\location prog.exe" for Everything.
+// Returns the length of the resulting pattern.
+static size_t set_pattern_if_path(char *pattern, int pattern_size, char *input)
 {
     char *path = strrchr(input, '\\');
 
@@ -90,62 +167,448 @@ static void set_pattern_if_path(char *pattern, int pattern_size, char *input)
     }
     else {
         strcpy_s(pattern, pattern_size, input);
-        return;
     }
+
+    return strlen(pattern);
 }
 
-static int ends_with(const char *str, const char *suffix)
+// Case-insensitive; str_len is the (already known) length of str
+static int ends_with(const char *str, size_t str_len, const char *suffix)
 {
-    size_t suffix_len = strlen(suffix);
-    size_t str_len = strlen(str);
+    return fold_ends_with(str, str_len, suffix, strlen(suffix));
+}
 
-    return str_len >= suffix_len && strcmp(suffix, str + str_len - suffix_len) == 0;
+static int starts_with(const char *str, size_t str_len, const char *prefix)
+{
+    return fold_starts_with(str, str_len, prefix, strlen(prefix));
 }
 
-static int starts_with(const char *str, const char *prefix)
+// Appends term with each program type, as <term.COM|term.EXE|...> so that
+// a single query finds them all, whatever their number
+static void append_types(char *pattern, size_t pattern_size, size_t pattern_len, const char *term, const char *wildcard)
 {
-    size_t prefix_len = strlen(prefix);
-    size_t str_len = strlen(str);
+    size_t n_types = pathext_count();
+    size_t i;
+
+    pattern[pattern_len] = '\0';
+    for (i = 0; i < n_types; i++) {
+        const char *type = pathext_type(i);
+
+        // Room for the term with its < or |, and for the closing >
+        if (pattern_len + strlen(term) + strlen(wildcard) + strlen(type) + 2 >= pattern_size) {
+            break;
+        }
+        pattern_len += sprintf(pattern + pattern_len, "%s%s%s%s", n_types == 1 ? "" : i == 0 ? "<" : "|", term, wildcard, type);
+    }
+
+    if (n_types > 1 && i > 0) {
+        strcpy(pattern + pattern_len, ">");
+    }
+}
+
+// Search tiers, each more relaxed than the one before:
+//   1: name.exe as a whole word
+//   2: name*.exe as a whole word
+//   3: name*.exe anywhere in the name
+// and the same for each of the other program types. A name already ending
+// with a type is searched for as is.
+static void tier_pattern(int tier, char *pattern, int pattern_size, char *name)
+{
+    size_t pattern_len = set_pattern_if_path(pattern, pattern_size, name);
+    char *base = strrchr(name, '\\');
+
+    if (pathext_rank(pattern, pattern_len) == pathext_count()) {
+        base = base ? base + 1 : name;
+        append_types(pattern, pattern_size, pattern_len - strlen(base), base, tier == 1 ? "" : "*");
+    }
+}
 
-    return str_len >= prefix_len && strncmp(prefix, str, prefix_len) == 0;
+// -z: the paths having the name's characters in order, as "path:*v*s*c*.exe"
+// (for each program type). Fills text with those characters, for ranking the
+// matches.
+static void fuzzy_pattern(char *pattern, size_t pattern_size, char *text, size_t text_size, const char *name)
+{
+    char term[2 * PICK_TEXT_SIZE + sizeof("path:*")];
+    size_t term_len = strlen("path:*");
+    size_t text_len = fuzzy_strip(text, text_size, name);
+    size_t i;
+
+    strcpy(term, "path:*");
+    for (i = 0; i < text_len && term_len + 2 < sizeof(term); i++) {
+        term[term_len++] = text[i];
+        term[term_len++] = '*';
+    }
+    term[term_len] = '\0';
+
+    append_types(pattern, pattern_size, 0, term, "");
 }
 
-static int skipped_file(const char *file_name, const char *path)
+// Fetches up to max_results of a tier's matches starting at offset. Each
+// query only gets what is left of the -t budget, which also bounds waiting
+// for Everything to start up and load its database.
+static DWORD query_tier(int tier, const char *pattern, int offset, int max_results, HANDLE cancel_event, EVERYTHING_SNAPSHOT *snapshot)
+{
+    EVERYTHING_QUERYEX query = { sizeof(EVERYTHING_QUERYEX) };
+
+    query.lpSearch = pattern;
+    query.bMatchWholeWord = tier != 3;
+    query.dwSort = EVERYTHING_SORT_NAME_ASCENDING;
+    query.dwRequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+    query.dwOffset = offset;
+    query.dwMax = max_results;
+    query.dwTimeout = remaining_budget();
+    query.hCancelEvent = cancel_event;
+
+    return Everything_QueryEx(&query, snapshot);
+}
+
+// Fetches a tier's first page. Tier 1 only qualifies when its first match
+// starts with the name; an exact name does not count when it is just the tail
+// of a longer one.
+static unsigned __stdcall probe_tier(void *param)
+{
+    struct TierProbe *probe = (struct TierProbe *)param;
+    EVERYTHING_STRINGVIEW first;
+
+    probe->error = query_tier(probe->tier, probe->pattern, 0, probe->rows, s_probes_done, &probe->snapshot);
+    if (probe->error == EVERYTHING_OK) {
+        probe->total = Everything_GetSnapshotTotResults(probe->snapshot);
+        probe->qualifies = probe->total > 0 &&
+            (probe->tier != 1 ||
+             (Everything_GetSnapshotFileNameView(probe->snapshot, 0, &first) && starts_with(first.ptr, first.len, probe->name)));
+    }
+
+    return 0;
+}
+
+// Asks all the tiers for their first page at once rather than one after the
+// other, so a miss in the stricter tiers costs no extra round trips. Returns
+// the first tier, in tier order, whose matches qualify (0 if none does) as
+// soon as it and the tiers before it have answered; the tiers after it are
+// cancelled, and waited for so their pages can be released, which the
+// cancel makes quick. The winner's page is left in its snapshot.
+static int probe_tiers(struct TierProbe *probes, int n_tiers, char *name, int rows)
+{
+    int tier;
+    int winner = 0;
+
+    s_probes_done = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    for (tier = 1; tier <= n_tiers; tier++) {
+        struct TierProbe *probe = &probes[tier - 1];
+
+        probe->tier = tier;
+        probe->name = name;
+        probe->rows = rows;
+        probe->snapshot = NULL;
+        probe->total = 0;
+        probe->qualifies = FALSE;
+        tier_pattern(tier, probe->pattern, sizeof(probe->pattern), name);
+
+        probe->thread = (HANDLE)_beginthreadex(NULL, 0, probe_tier, probe, 0, NULL);
+        if (!probe->thread)
+            probe_tier(probe);
+    }
+
+    for (tier = 1; tier <= n_tiers && !winner; tier++) {
+        struct TierProbe *probe = &probes[tier - 1];
+
+        if (probe->thread)
+            WaitForSingleObject(probe->thread, INFINITE);
+
+        if (probe->error != EVERYTHING_OK) {
+            SetEvent(s_probes_done);
+            exit_query_error(probe->error, tier, probe->pattern);
+        }
+
+        verbose("tier %d: '%s'%s has %d matches", tier, probe->pattern, tier == 3 ? "" : " (whole word)", probe->total);
+        if (probe->qualifies)
+            winner = tier;
+    }
+
+    SetEvent(s_probes_done);
+    for (tier = 1; tier <= n_tiers; tier++) {
+        struct TierProbe *probe = &probes[tier - 1];
+
+        if (probe->thread) {
+            if (winner && tier > winner)
+                WaitForSingleObject(probe->thread, INFINITE);
+            CloseHandle(probe->thread);
+        }
+
+        if (tier != winner && probe->snapshot)
+            Everything_ReleaseSnapshot(probe->snapshot);
+    }
+    CloseHandle(s_probes_done);
+
+    if (winner && winner < n_tiers)
+        verbose("tier %d: chosen, later tiers cancelled", winner);
+
+    return winner;
+}
+
+// Rows worth fetching in the first page: a screenful for a listing, otherwise
+// just enough to reach the chosen one past a few skipped files
+static int first_page_rows(int is_list, int chosen_option)
+{
+    return is_list ? LIST_ROWS : chosen_option + SKIP_SLACK;
+}
+
+// Each further page is twice the previous one, so a search whose rows are
+// mostly skipped files still takes only a few round trips
+static int next_page_rows(int rows, int remaining)
+{
+    rows = rows * 2 < MAX_PAGE_ROWS ? rows * 2 : MAX_PAGE_ROWS;
+
+    return rows < remaining ? rows : remaining;
+}
+
+static int skipped_name(const EVERYTHING_STRINGVIEW *file_name)
 {
     return
-        ends_with(file_name, ".pf")             ||
-        ends_with(file_name, ".mui")            ||
-        ends_with(file_name, ".res")            ||
-        ends_with(file_name, ".manifest")       ||
-        ends_with(file_name, ".config")         ||
-        strstr(path, "\\obj\\")                 ||
-        strstr(path, "Windows\\servicing\\")    ||
-        strstr(path, "Windows\\WinSxS\\")       ||
-        strstr(path, "\\$Recycle.Bin\\")        ||
-        ends_with(path, "\\Prefetch");
+        ends_with(file_name->ptr, file_name->len, ".pf")        ||
+        ends_with(file_name->ptr, file_name->len, ".mui")       ||
+        ends_with(file_name->ptr, file_name->len, ".res")       ||
+        ends_with(file_name->ptr, file_name->len, ".manifest")  ||
+        ends_with(file_name->ptr, file_name->len, ".config");
+}
+
+static int skipped_path(const EVERYTHING_STRINGVIEW *path)
+{
+    return
+        strstr(path->ptr, "\\obj\\")                            ||
+        strstr(path->ptr, "Windows\\servicing\\")               ||
+        strstr(path->ptr, "Windows\\WinSxS\\")                  ||
+        strstr(path->ptr, "\\$Recycle.Bin\\")                   ||
+        ends_with(path->ptr, path->len, "\\Prefetch");
+}
+
+static int skipped_file(const EVERYTHING_STRINGVIEW *file_name, const EVERYTHING_STRINGVIEW *path)
+{
+    return skipped_name(file_name) || skipped_path(path);
+}
+
+// The results of a snapshot in one folder share their path's text, so its
+// checks are remembered by where the text is. A memo is only good for the
+// records of one snapshot.
+#define PATH_MEMO_SLOTS 64
+
+struct PathMemo
+{
+    const char *path[PATH_MEMO_SLOTS];
+    char is_skipped[PATH_MEMO_SLOTS];
+};
+
+static int is_skipped_path(struct PathMemo *memo, const EVERYTHING_STRINGVIEW *path)
+{
+    size_t slot = ((size_t)path->ptr >> 3) % PATH_MEMO_SLOTS;
+
+    if (memo->path[slot] != path->ptr) {
+        memo->path[slot] = path->ptr;
+        memo->is_skipped[slot] = (char)(skipped_path(path) != 0);
+    }
+
+    return memo->is_skipped[slot];
+}
+
+// Whether a result is the favorite program; most differ in their name, so
+// that is compared first
+static int is_favorite(const char *favorite_exe, const EVERYTHING_RESULTRECORD *record)
+{
+    const char *name = strrchr(favorite_exe, '\\');
+
+    if (!name) {
+        return FALSE;
+    }
+
+    return fold_equals(name + 1, strlen(name + 1), record->file_name.ptr, record->file_name.len) &&
+        fold_equals(favorite_exe, name - favorite_exe, record->path.ptr, record->path.len);
+}
+
+// A name without its program type, if it has one
+static size_t stem_len(const EVERYTHING_STRINGVIEW *file_name)
+{
+    size_t type = pathext_rank(file_name->ptr, file_name->len);
+
+    return type < pathext_count() ? file_name->len - strlen(pathext_type(type)) : file_name->len;
+}
+
+// Orders a page of matches, which come sorted by name, the way they are
+// counted and listed: the files run would skip are left out, and names that
+// differ only in their type go in the order of their types in PATHEXT, as
+// the command prompt would prefer them. With is_partial more matches follow
+// the page, so its last name is left for the next page, which may hold more
+// of its types. Fills order with the indexes of the records to use and
+// n_ordered with their number; returns how many records were gone through.
+static DWORD order_records(const EVERYTHING_RESULTRECORD *records, DWORD n_records, int is_partial, DWORD *order, DWORD *n_ordered)
+{
+    struct PathMemo memo = { 0 };
+    DWORD n_used = n_records;
+    DWORD n = 0;
+    DWORD start;
+    DWORD i;
+
+    if (is_partial && n_records > 1) {
+        size_t len = stem_len(&records[n_records - 1].file_name);
+
+        for (i = n_records - 1; i > 0; i--) {
+            if (!fold_equals(records[i - 1].file_name.ptr, stem_len(&records[i - 1].file_name), records[i].file_name.ptr, len)) {
+                break;
+            }
+        }
+        if (i > 0) {
+            n_used = i;
+        }
+    }
+
+    for (start = 0; start < n_used; start = i) {
+        size_t len = stem_len(&records[start].file_name);
+        DWORD first = n;
+
+        for (i = start; i < n_used && fold_equals(records[i].file_name.ptr, stem_len(&records[i].file_name), records[start].file_name.ptr, len); i++) {
+            size_t type = pathext_rank(records[i].file_name.ptr, records[i].file_name.len);
+            DWORD j;
+
+            if (skipped_name(&records[i].file_name) || is_skipped_path(&memo, &records[i].path)) {
+                continue;
+            }
+
+            // Insertion keeps equal types in name order; a name has few types
+            for (j = n; j > first && pathext_rank(records[order[j - 1]].file_name.ptr, records[order[j - 1]].file_name.len) > type; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+            n++;
+        }
+    }
+
+    *n_ordered = n;
+    return n_used;
+}
+
+// Copies a result's folder and name into a fixed size buffer as its full
+// path, truncating if needed
+static size_t copy_full_path(char *dst, size_t dst_size, const EVERYTHING_RESULTRECORD *record)
+{
+    int len = snprintf(dst, dst_size, "%.*s%s%.*s", (int)record->path.len, record->path.ptr, record->path.len ? "\\" : "",
+        (int)record->file_name.len, record->file_name.ptr);
+
+    return len < 0 ? 0 : (size_t)len < dst_size ? (size_t)len : dst_size - 1;
+}
+
+// Copies a result string view into a fixed size buffer, truncating if needed
+static size_t copy_view(char *dst, size_t dst_size, const EVERYTHING_STRINGVIEW *view)
+{
+    size_t len = view->len < dst_size ? view->len : dst_size - 1;
+
+    memcpy(dst, view->ptr, len);
+    dst[len] = '\0';
+
+    return len;
+}
+
+// Run keeps its files next to its executable
+static char *get_module_file_path(char *path_buff, size_t path_size, const char *file_name)
+{
+    GetModuleFileName(NULL, path_buff, (DWORD)(path_size - strlen(file_name)));
+    if (GetLastError() == ERROR_SUCCESS) {
+        char *last_backslash = strrchr(path_buff, '\\');
+        if (last_backslash) {
+            strcpy(last_backslash + 1, file_name);
+            return path_buff;
+        }
+    }
+
+    return NULL;
 }
 
 static char *get_favorites_path()
 {
-    static char favorites_filename[] = "run.fav";
-    static char module_file_buff[MAX_PATH + sizeof(favorites_filename)] = { 0 };
+    static char module_file_buff[MAX_PATH + sizeof("run.fav")] = { 0 };
     static char *favorites_path = NULL;
-    DWORD hr;
 
     if (!favorites_path) {
-        hr = GetModuleFileName(NULL, module_file_buff, sizeof(module_file_buff) - sizeof(favorites_filename));
-        if (GetLastError() == ERROR_SUCCESS) {
-            char *last_backslash = strrchr(module_file_buff, '\\');
-            if (last_backslash) {
-                strcpy(last_backslash + 1, favorites_filename);
-                favorites_path = module_file_buff;
-            }
-        }
+        favorites_path = get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.fav");
     }
 
     return favorites_path;
 }
 
+static char *get_miss_cache_path()
+{
+    static char module_file_buff[MAX_PATH + sizeof("run.miss")] = { 0 };
+
+    return get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.miss");
+}
+
+static char *get_shared_cache_path()
+{
+    static char module_file_buff[MAX_PATH + sizeof("run.cache")] = { 0 };
+
+    return get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.cache");
+}
+
+static char *get_name_index_path()
+{
+    static char module_file_buff[MAX_PATH + sizeof("run.names")] = { 0 };
+
+    return get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.names");
+}
+
+static char *get_path_index_path()
+{
+    static char module_file_buff[MAX_PATH + sizeof("run.path")] = { 0 };
+
+    return get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.path");
+}
+
+static char *get_locate_index_path()
+{
+    static char module_file_buff[MAX_PATH + sizeof("run.locate")] = { 0 };
+
+    return get_module_file_path(module_file_buff, sizeof(module_file_buff), "run.locate");
+}
+
+// A program in a PATH directory is found there, as the command prompt would
+// find it, without asking Everything
+static int find_on_path(char *name, char *exe_path, size_t exe_path_size)
+{
+    char *index_path = get_path_index_path();
+    struct PathIndexStats stats;
+    int is_found;
+
+    if (!index_path) {
+        return FALSE;
+    }
+
+    is_found = path_index_lookup(index_path, name, strlen(name), exe_path, exe_path_size, &stats);
+    verbose("path: '%s' %s %lu PATH directories (%lu listed again, %lu programs)", name,
+        is_found ? "is in one of the" : "is in none of the", (unsigned long)stats.n_dirs,
+        (unsigned long)stats.n_listed, (unsigned long)stats.n_programs);
+
+    return is_found;
+}
+
+// Hashes an environment variable's value, or its absence, into a key
+static unsigned long long hash_env(unsigned long long hash, const char *name)
+{
+    const char *value = getenv(name);
+
+    return (hash ^ (value ? fold_hash(value, strlen(value)) : 0)) * 1099511628211ULL;
+}
+
+// Everything that decides which program a name resolves to goes into its key:
+// the search options and name, and the program types, PATH and locate
+// database it was resolved with. Returns the key's length, 0 if it is too
+// long to be cached.
+static size_t shared_cache_key(char *key, size_t key_size, char *name, int is_whole_word, int chosen_option)
+{
+    unsigned long long env_hash = hash_env(hash_env(pathext_hash(), "PATH"), "RUN_LOCATE_DB");
+    int key_len = snprintf(key, key_size, "%d %d %016llx %s", is_whole_word, chosen_option ? chosen_option : 1, env_hash, name);
+
+    return key_len > 0 && key_len < (int)key_size ? key_len : 0;
+}
+
 static void load_favorites()
 {
     FILE* file;
@@ -182,7 +645,8 @@ static void load_favorites()
             }
 
             favorite = (struct Favorite *)malloc(sizeof(struct Favorite));
-            favorite->name = (char *)malloc(strlen(line) + 1);
+            favorite->name_len = strlen(line);
+            favorite->name = (char *)malloc(favorite->name_len + 1);
             strcpy(favorite->name, line);
             favorite->executable = (char *)malloc(strlen(executable) + 1);
             strcpy(favorite->executable, executable);
@@ -204,9 +668,10 @@ static void load_favorites()
 static char *lookup_favorite(char *name)
 {
     struct Favorite *favorites = s_Favorites;
+    size_t name_len = strlen(name);
 
     while (favorites) {
-        if (_stricmp(name, favorites->name) == 0) {
+        if (fold_equals(name, name_len, favorites->name, favorites->name_len)) {
             return favorites->executable;
         }
 
@@ -235,6 +700,7 @@ static char *save_favorite(char *name, char *executable)
     int replaced = FALSE;
     FILE* file;
     char *favorites_filepath = get_favorites_path();
+    size_t name_len;
 
     if (!favorites_filepath) {
         fprintf(stderr, "Could not save favorite (cannot determine favorites file location)\n");
@@ -261,8 +727,9 @@ static char *save_favorite(char *name, char *executable)
         name = new_name;
     }
 
+    name_len = strlen(name);
     while (favorites) {
-        if (_stricmp(name, favorites->name) == 0) {
+        if (fold_equals(name, name_len, favorites->name, favorites->name_len)) {
             favorites->executable = (char *)malloc(strlen(executable) + 1);
             strcpy(favorites->executable, executable);
             replaced = TRUE;
@@ -274,7 +741,8 @@ static char *save_favorite(char *name, char *executable)
 
     if (!replaced) {
         struct Favorite *new_favorite = (struct Favorite *)malloc(sizeof(struct Favorite));
-        new_favorite->name = (char *)malloc(strlen(name) + 1);
+        new_favorite->name_len = name_len;
+        new_favorite->name = (char *)malloc(name_len + 1);
         strcpy(new_favorite->name, name);
         new_favorite->executable = (char *)malloc(strlen(executable) + 1);
         strcpy(new_favorite->executable, executable);
@@ -304,6 +772,7 @@ static void delete_favorite(char *name)
     struct Favorite *favorites = s_Favorites;
     FILE* file;
     char *favorites_filepath = get_favorites_path();
+    size_t name_len = strlen(name);
 
     if (!favorites_filepath) {
         fprintf(stderr, "Could not delete favorite (cannot determine favorites file location)\n");
@@ -323,7 +792,7 @@ static void delete_favorite(char *name)
 
     favorites = s_Favorites;
     while (favorites) {
-        if (_stricmp(name, favorites->name) == 0) {
+        if (fold_equals(name, name_len, favorites->name, favorites->name_len)) {
             fprintf(stderr, "Deleted favorite program '%s' (%s)\n", name, favorites->executable);
         }
         else {
@@ -336,30 +805,651 @@ static void delete_favorite(char *name)
     fclose(file);
 }
 
+static ULONGLONG filetime_now()
+{
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+    return ((ULONGLONG)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
+
+static int is_older_than(ULONGLONG time, ULONGLONG now, DWORD ms)
+{
+    return now < time || now - time > ms * 10000ULL;
+}
+
+// Journal name callback: a program that appeared since the name index was stamped
+static int add_journal_name(const WCHAR *name, size_t name_len, void *context)
+{
+    char name_buff[MAX_PATH];
+    BOOL is_lossy = FALSE;
+    size_t type = pathext_rank_w(name, name_len);
+    int len;
+
+    if (type == pathext_count()) {
+        return FALSE;
+    }
+
+    len = WideCharToMultiByte(CP_ACP, 0, name, (int)(name_len - strlen(pathext_type(type))), name_buff, sizeof(name_buff), NULL, &is_lossy);
+    if (len > 0 && !is_lossy) {
+        name_index_add(name_buff, len);
+        (*(int *)context)++;
+    }
+
+    return FALSE;
+}
+
+// Every program Everything knows of, less the files run would skip anyway
+static DWORD add_everything_names()
+{
+    EVERYTHING_QUERYEX query = { sizeof(EVERYTHING_QUERYEX) };
+    EVERYTHING_SNAPSHOT snapshot;
+    EVERYTHING_RESULTRECORD *records;
+    char pattern[PATHEXT_MAX_TYPES * (PATHEXT_MAX_LEN + 2) + 2];
+    DWORD n_results;
+    DWORD i;
+    DWORD err;
+
+    append_types(pattern, sizeof(pattern), 0, "*", "");
+    query.lpSearch = pattern;
+    query.dwSort = EVERYTHING_SORT_NAME_ASCENDING;
+    query.dwRequestFlags = EVERYTHING_REQUEST_PATH | EVERYTHING_REQUEST_FILE_NAME;
+    query.dwMax = 0xFFFFFFFF;   // All results
+    query.dwTimeout = remaining_budget();
+
+    err = Everything_QueryEx(&query, &snapshot);
+    if (err != EVERYTHING_OK) {
+        return err;
+    }
+
+    n_results = Everything_GetSnapshotNumResults(snapshot);
+    records = (EVERYTHING_RESULTRECORD *)malloc((n_results + 1) * sizeof(EVERYTHING_RESULTRECORD));
+    if (!records) {
+        fprintf(stderr, "Out of memory\n");
+        exit(5);
+    }
+
+    n_results = Everything_GetSnapshotRecords(snapshot, 0, n_results, records);
+    for (i = 0; i < n_results; i++) {
+        size_t len = stem_len(&records[i].file_name);
+
+        if (!skipped_file(&records[i].file_name, &records[i].path) && len < records[i].file_name.len) {
+            name_index_add(records[i].file_name.ptr, len);
+        }
+    }
+
+    free(records);
+    Everything_ReleaseSnapshot(snapshot);
+    return EVERYTHING_OK;
+}
+
+// The last fetch of a -i picker, for reporting its error
+struct PickFetch
+{
+    int is_fuzzy;
+    DWORD error;
+    char pattern[4096];
+};
+
+// Picker fetch callback: the usable matches of text in the most relaxed tier,
+// or for -z the paths with its characters in order
+static int fetch_matches(const char *text, void *context)
+{
+    struct PickFetch *fetch = (struct PickFetch *)context;
+    EVERYTHING_SNAPSHOT snapshot;
+    EVERYTHING_RESULTRECORD *records;
+    DWORD *order;
+    char fuzzy_text[PICK_TEXT_SIZE];
+    DWORD n_results;
+    DWORD n_total;
+    DWORD n_ordered;
+    DWORD i;
+
+    if (fetch->is_fuzzy) {
+        fuzzy_pattern(fetch->pattern, sizeof(fetch->pattern), fuzzy_text, sizeof(fuzzy_text), text);
+    }
+    else {
+        tier_pattern(MAX_TIERS, fetch->pattern, sizeof(fetch->pattern), (char *)text);
+    }
+    fetch->error = query_tier(MAX_TIERS, fetch->pattern, 0, PICK_MAX_ITEMS, NULL, &snapshot);
+    if (fetch->error != EVERYTHING_OK) {
+        return PICK_FETCH_FAILED;
+    }
+
+    n_total = Everything_GetSnapshotTotResults(snapshot);
+    n_results = Everything_GetSnapshotNumResults(snapshot);
+    records = (EVERYTHING_RESULTRECORD *)malloc((n_results + 1) * sizeof(EVERYTHING_RESULTRECORD));
+    order = (DWORD *)malloc((n_results + 1) * sizeof(DWORD));
+    if (!records || !order) {
+        free(order);
+        free(records);
+        Everything_ReleaseSnapshot(snapshot);
+        fetch->error = EVERYTHING_ERROR_MEMORY;
+        return PICK_FETCH_FAILED;
+    }
+
+    n_results = Everything_GetSnapshotRecords(snapshot, 0, n_results, records);
+    order_records(records, n_results, FALSE, order, &n_ordered);
+    for (i = 0; i < n_ordered; i++) {
+        const EVERYTHING_RESULTRECORD *record = &records[order[i]];
+
+        picker_add(record->file_name.ptr, record->file_name.len, record->path.ptr, record->path.len);
+    }
+
+    free(order);
+    free(records);
+    Everything_ReleaseSnapshot(snapshot);
+    return n_results < n_total ? PICK_FETCH_SOME : PICK_FETCH_ALL;
+}
+
+// -i: Everything is asked for the matches of name once; typing narrows them
+// without asking again, unless it takes away part of what was asked for
+static void pick_program(char *name, int is_fuzzy, char *path, size_t path_size)
+{
+    struct PickFetch fetch = { 0 };
+
+    if (s_timeout != INFINITE) {
+        Everything_SetWaitForReady(TRUE);
+    }
+
+    fetch.is_fuzzy = is_fuzzy;
+    switch (picker_run(name, is_fuzzy, fetch_matches, &fetch, path, path_size)) {
+    case PICK_NO_CONSOLE:
+        fprintf(stderr, "Cannot pick a program without a console\n");
+        exit(2);
+
+    case PICK_CANCELLED:
+        exit(1);
+
+    case PICK_FAILED:
+        exit_query_error(fetch.error, MAX_TIERS, fetch.pattern);
+    }
+}
+
+// -z: one query for the paths having the name's characters in order, ranked
+// here by how closely they match. Lists them, or copies the chosen one's path.
+static void fuzzy_search(char *name, int is_list, int chosen_option, char *favorite_exe, char *exe_path, size_t exe_path_size)
+{
+    char pattern[4096];
+    char text[FUZZY_MAX_PATTERN + 1];
+    struct FuzzyPattern fuzzy;
+    EVERYTHING_SNAPSHOT snapshot;
+    EVERYTHING_RESULTRECORD *records;
+    DWORD *order;
+    struct FuzzyCandidate *candidates;
+    unsigned *char_masks;
+    struct FuzzyMatch *matches;
+    char *paths;
+    size_t paths_size = 0;
+    DWORD n_results;
+    DWORD n_total;
+    DWORD n_candidates = 0;
+    DWORD n_ordered = 0;
+    DWORD n_matches;
+    DWORD i;
+    DWORD err;
+
+    if (s_timeout != INFINITE) {
+        Everything_SetWaitForReady(TRUE);
+    }
+
+    fuzzy_pattern(pattern, sizeof(pattern), text, sizeof(text), name);
+    err = query_tier(MAX_TIERS, pattern, 0, FUZZY_ROWS, NULL, &snapshot);
+    if (err != EVERYTHING_OK) {
+        exit_query_error(err, MAX_TIERS, pattern);
+    }
+
+    n_total = Everything_GetSnapshotTotResults(snapshot);
+    n_results = Everything_GetSnapshotNumResults(snapshot);
+    verbose("fuzzy: '%s' has %lu matches%s", pattern, n_total, n_total > n_results ? ", ranking the first ones" : "");
+
+    records = (EVERYTHING_RESULTRECORD *)malloc((n_results + 1) * sizeof(EVERYTHING_RESULTRECORD));
+    order = (DWORD *)malloc((n_results + 1) * sizeof(DWORD));
+    candidates = (struct FuzzyCandidate *)malloc((n_results + 1) * sizeof(struct FuzzyCandidate));
+    char_masks = (unsigned *)malloc((n_results + 1) * sizeof(unsigned));
+    matches = (struct FuzzyMatch *)malloc((n_results + 1) * sizeof(struct FuzzyMatch));
+    if (records && order) {
+        n_results = Everything_GetSnapshotRecords(snapshot, 0, n_results, records);
+        order_records(records, n_results, FALSE, order, &n_ordered);
+        for (i = 0; i < n_ordered; i++) {
+            paths_size += records[order[i]].path.len + 1 + records[order[i]].file_name.len + 1;
+        }
+    }
+    paths = (char *)malloc(paths_size + 1);
+    if (!records || !order || !candidates || !char_masks || !matches || !paths) {
+        fprintf(stderr, "Out of memory\n");
+        exit(5);
+    }
+
+    // Each candidate is the full path, so the folder counts too. Equal scores
+    // keep this order, so a program's preferred type still comes first.
+    paths_size = 0;
+    for (i = 0; i < n_ordered; i++) {
+        const EVERYTHING_RESULTRECORD *record = &records[order[i]];
+        struct FuzzyCandidate *candidate = &candidates[n_candidates];
+        char *path = paths + paths_size;
+
+        memcpy(path, record->path.ptr, record->path.len);
+        path[record->path.len] = '\\';
+        memcpy(path + record->path.len + 1, record->file_name.ptr, record->file_name.len);
+        path[record->path.len + 1 + record->file_name.len] = '\0';
+
+        candidate->str = path;
+        candidate->base = (unsigned)record->path.len + 1;
+        candidate->len = candidate->base + (unsigned)record->file_name.len;
+        char_masks[n_candidates++] = fuzzy_char_mask(path, candidate->len);
+        paths_size += candidate->len + 1;
+    }
+
+    free(order);
+    free(records);
+    Everything_ReleaseSnapshot(snapshot);
+
+    fuzzy_compile(&fuzzy, text, strlen(text));
+    n_matches = (DWORD)fuzzy_rank(&fuzzy, candidates, char_masks, NULL, n_candidates, matches);
+    if (n_matches == 0) {
+        fprintf(stderr, "%s not found\n", pattern);
+        exit(3);
+    }
+
+    if (is_list) {
+        for (i = 0; i < n_matches; i++) {
+            const struct FuzzyCandidate *candidate = &candidates[matches[i].index];
+            int is_default = favorite_exe && fold_equals(favorite_exe, strlen(favorite_exe), candidate->str, candidate->len);
+
+            printf("%lu) %s%s [%.*s]%s\n", (unsigned long)i + 1,
+                (int)i + 1 == chosen_option ? "CHOSEN: " : "",
+                candidate->str + candidate->base, (int)candidate->base - 1, candidate->str,
+                is_default ? " (default)" : "");
+        }
+        exit(0);
+    }
+
+    if (chosen_option >= 1 && (DWORD)chosen_option <= n_matches) {
+        verbose("fuzzy: choosing the match scoring %d", matches[chosen_option - 1].score);
+        strcpy_s(exe_path, exe_path_size, candidates[matches[chosen_option - 1].index].str);
+    }
+    else {
+        *exe_path = '\0';
+    }
+
+    free(paths);
+    free(matches);
+    free(char_masks);
+    free(candidates);
+}
+
+// Everything not running, the database RUN_LOCATE_DB names (a file list
+// Everything exported, one updatedb wrote, or a list of full paths) is
+// searched instead
+static int open_locate_db(char *name)
+{
+    char *db_path = getenv("RUN_LOCATE_DB");
+    char *index_path;
+
+    if (!db_path || !*db_path || strpbrk(name, "\\*?")) {
+        return FALSE;
+    }
+
+    if (Everything_GetMajorVersion() != 0 || Everything_GetLastError() != EVERYTHING_ERROR_IPC) {
+        return FALSE;
+    }
+
+    index_path = get_locate_index_path();
+    if (!index_path || !locate_open(db_path, index_path)) {
+        verbose("locate: cannot read %s, or write its index", db_path);
+        return FALSE;
+    }
+
+    verbose("locate: Everything is not running, searching the %lu programs in %s", (unsigned long)locate_count(), db_path);
+    return TRUE;
+}
+
+// The first tier with matches in the locate database is gone through as
+// Everything's would be, a page at a time. Reading a page goes through the
+// matches before it again, so the pages are big. Lists its matches, or
+// copies the chosen one's path.
+static void locate_search(char *name, int n_tiers, int is_list, int chosen_option, char *favorite_exe, char *exe_path, size_t exe_path_size)
+{
+    size_t n_rows = LOCATE_ROWS;
+    struct LocateMatch *matches = (struct LocateMatch *)malloc(n_rows * sizeof(struct LocateMatch));
+    size_t n_total = 0;
+    size_t n_found;             // Up to the last match read, fewer than n_total if memory ran out
+    size_t n_offset = 0;
+    int cur_option = 0;
+    int tier;
+
+    if (!matches) {
+        fprintf(stderr, "Out of memory\n");
+        exit(5);
+    }
+
+    for (tier = 1; tier <= n_tiers && n_total == 0; tier++) {
+        n_total = locate_find(tier, name, strlen(name), 0, matches, n_rows);
+        verbose("locate: tier %d has %lu matches", tier, (unsigned long)n_total);
+    }
+    tier--;
+    n_found = n_total;
+
+    *exe_path = '\0';
+    while (n_offset < n_found) {
+        DWORD n_results = (DWORD)(n_found - n_offset < n_rows ? n_found - n_offset : n_rows);
+        EVERYTHING_RESULTRECORD *records = (EVERYTHING_RESULTRECORD *)malloc(n_results * sizeof(EVERYTHING_RESULTRECORD));
+        DWORD *order = (DWORD *)malloc(n_results * sizeof(DWORD));
+        DWORD n_ordered;
+        DWORD n_used;
+        DWORD i;
+
+        if (!records || !order) {
+            fprintf(stderr, "Out of memory\n");
+            exit(5);
+        }
+
+        memset(records, 0, n_results * sizeof(EVERYTHING_RESULTRECORD));
+        for (i = 0; i < n_results; i++) {
+            records[i].file_name.ptr = matches[i].file_name;
+            records[i].file_name.len = (DWORD)matches[i].file_name_len;
+            records[i].path.ptr = matches[i].path;
+            records[i].path.len = (DWORD)matches[i].path_len;
+        }
+        n_used = order_records(records, n_results, n_offset + n_results < n_total, order, &n_ordered);
+
+        for (i = 0; i < n_ordered; i++) {
+            const EVERYTHING_RESULTRECORD *record = &records[order[i]];
+            char full_path[4096];
+            int is_root = record->path.len && strchr("\\/", record->path.ptr[record->path.len - 1]);
+
+            cur_option++;
+            snprintf(full_path, sizeof(full_path), "%s%s%s", record->path.ptr, is_root ? "" : "\\", record->file_name.ptr);
+            if (is_list) {
+                int is_default = favorite_exe && fold_equals(favorite_exe, strlen(favorite_exe), full_path, strlen(full_path));
+
+                printf("%d) %s%s [%s]%s\n", cur_option,
+                    cur_option == chosen_option ? "CHOSEN: " : "",
+                    record->file_name.ptr, record->path.ptr,
+                    is_default ? " (default)" : "");
+            }
+            else if (cur_option == chosen_option) {
+                strcpy_s(exe_path, exe_path_size, full_path);
+                break;
+            }
+        }
+
+        free(order);
+        free(records);
+
+        n_offset += n_used;
+        if (*exe_path || n_results == 0 || n_offset >= n_total) {
+            break;
+        }
+
+        verbose("locate: %d usable in the first %lu matches, reading more", cur_option, (unsigned long)n_offset);
+        n_found = locate_find(tier, name, strlen(name), n_offset, matches, n_rows);
+    }
+
+    free(matches);
+
+    if (cur_option == 0) {
+        fprintf(stderr, "%s not found\n", name);
+        exit(3);
+    }
+
+    if (is_list) {
+        exit(0);
+    }
+}
+
+static void print_name(const char *name, void *context)
+{
+    struct Favorite *favorites = s_Favorites;
+    size_t name_len = strlen(name);
+
+    // Favorites were listed first
+    while (favorites) {
+        if (fold_equals(name, name_len, favorites->name, favorites->name_len)) {
+            return;
+        }
+
+        favorites = favorites->next;
+    }
+
+    printf("%s\n", name);
+}
+
+// Lists the favorites and the program names starting with prefix from the
+// name index. The index is brought up to date first: with what the change
+// journals say appeared since it was stamped, or with a full rebuild from
+// Everything once a day, or every few minutes when the journals cannot tell.
+static void complete_names(char *prefix)
+{
+    char *index_path = get_name_index_path();
+    struct NameIndexStamp stamp = { 0 };
+    const struct NameIndexStamp *indexed = NULL;
+    struct Favorite *favorites = s_Favorites;
+    size_t prefix_len = strlen(prefix);
+    ULONGLONG now = filetime_now();
+    int change = JOURNAL_RESET;
+    int is_rebuild = FALSE;
+    int n_new = 0;
+    size_t n_names;
+    DWORD err;
+
+    if (!index_path) {
+        fprintf(stderr, "Could not complete (cannot determine the name index location)\n");
+        exit(5);
+    }
+
+    if (name_index_open(index_path)) {
+        indexed = name_index_stamp();
+    }
+    if (journal_stamp(&stamp.journals) && indexed) {
+        change = journal_compare(&indexed->journals, &stamp.journals);
+    }
+
+    if (!indexed || is_older_than(indexed->built_time, now, NAME_INDEX_REBUILD_MS)) {
+        is_rebuild = TRUE;
+    }
+    else if (change == JOURNAL_RESET) {
+        is_rebuild = is_older_than(indexed->checked_time, now, NAME_INDEX_REFRESH_MS);
+    }
+    else if (change == JOURNAL_MOVED) {
+        name_index_begin();
+        if (journal_scan_since(&indexed->journals, &stamp.journals, add_journal_name, &n_new) != JOURNAL_SCAN_DONE) {
+            is_rebuild = is_older_than(indexed->checked_time, now, NAME_INDEX_REFRESH_MS);
+        }
+        else {
+            // Stamped even when nothing appeared, so the next completion
+            // reads the journals from here rather than over again
+            verbose("name index: %d programs appeared, refreshing", n_new);
+            name_index_add_all();
+            stamp.built_time = indexed->built_time;
+            stamp.checked_time = now;
+            name_index_close();
+            if (name_index_write(index_path, &stamp)) {
+                name_index_open(index_path);
+            }
+        }
+    }
+
+    if (is_rebuild) {
+        verbose("name index: %s, rebuilding from Everything", indexed ? "out of date" : "missing");
+        name_index_begin();
+        err = add_everything_names();
+        if (err != EVERYTHING_OK) {
+            if (!indexed) {
+                print_error(err);
+                fprintf(stderr, "\n");
+                exit(5);
+            }
+            verbose("name index: rebuild failed, using the old one");
+        }
+        else {
+            stamp.built_time = now;
+            stamp.checked_time = now;
+            name_index_close();
+            if (!name_index_write(index_path, &stamp) || !name_index_open(index_path)) {
+                fprintf(stderr, "Could not write the name index '%s'\n", index_path);
+                exit(5);
+            }
+        }
+    }
+
+    while (favorites) {
+        if (fold_starts_with(favorites->name, favorites->name_len, prefix, prefix_len)) {
+            printf("%s\n", favorites->name);
+        }
+
+        favorites = favorites->next;
+    }
+
+    n_names = name_index_complete(prefix, prefix_len, print_name, NULL);
+    verbose("name index: %lu names start with '%s'", (unsigned long)n_names, prefix);
+    name_index_close();
+}
+
+// Appends a parameter to a command line for cmd so that the program gets
+// it as it was given. It is quoted the way programs split their command
+// line if it is empty or has spaces or quotes, and cmd's special characters
+// are escaped with ^ so that cmd passes them on instead of acting on them.
+// The quotes are escaped too, so cmd never takes the rest as quoted, where
+// ^ does not escape. Takes up to 3 characters for each of the parameter's,
+// and 6 more.
+static char *append_shell_param(char *dst, const char *param)
+{
+    int is_quoted = !*param || strpbrk(param, " \t\"") != NULL;
+    size_t n_backslashes = 0;
+
+    *dst++ = ' ';
+    if (is_quoted) {
+        *dst++ = '^';
+        *dst++ = '"';
+    }
+
+    for (; *param; param++) {
+        if (*param == '\\') {
+            n_backslashes++;
+            *dst++ = '\\';
+            continue;
+        }
+
+        // Backslashes before a quote are doubled, and the quote escaped
+        if (*param == '"') {
+            memset(dst, '\\', n_backslashes + 1);
+            dst += n_backslashes + 1;
+        }
+        n_backslashes = 0;
+
+        if (strchr("()%!^\"<>&|", *param)) {
+            *dst++ = '^';
+        }
+        *dst++ = *param;
+    }
+
+    // As are backslashes before the closing quote
+    if (is_quoted) {
+        memset(dst, '\\', n_backslashes);
+        dst += n_backslashes;
+        *dst++ = '^';
+        *dst++ = '"';
+    }
+
+    *dst = '\0';
+    return dst;
+}
+
+// The other program types (batch files, and scripts run by their file
+// association) are run the way the command prompt runs them, through it:
+// cmd /s /c ""path" parameters", /s taking off just the outer quotes. A %
+// in the path is left out of its quotes to be escaped.
+static intptr_t spawn_with_shell(const char *path, char **params, char **envv)
+{
+    char *comspec = getenv("COMSPEC");
+    char *shell_argv[5];
+    char *command;
+    char *end;
+    size_t command_size = 4 * strlen(path) + sizeof("\"\"\"\"");
+    intptr_t status;
+    int i;
+
+    for (i = 0; params[i]; i++) {
+        command_size += 3 * strlen(params[i]) + 6;
+    }
+
+    command = (char *)malloc(command_size);
+    if (!command) {
+        fprintf(stderr, "Out of memory\n");
+        exit(5);
+    }
+
+    end = command;
+    *end++ = '"';
+    *end++ = '"';
+    for (; *path; path++) {
+        if (*path == '%') {
+            memcpy(end, "\"^%\"", 4);
+            end += 4;
+        }
+        else {
+            *end++ = *path;
+        }
+    }
+    *end++ = '"';
+
+    for (i = 0; params[i]; i++) {
+        end = append_shell_param(end, params[i]);
+    }
+    strcpy(end, "\"");
+
+    shell_argv[0] = comspec ? comspec : "cmd.exe";
+    shell_argv[1] = "/s";
+    shell_argv[2] = "/c";
+    shell_argv[3] = command;
+    shell_argv[4] = NULL;
+    status = _spawnvpe(_P_WAIT, shell_argv[0], shell_argv, envv);
+
+    free(command);
+    return status;
+}
+
 int main(int argc, char *argv[], char *envv[])
 {
     int i;
     intptr_t status;
     char exe_pattern[4096];
     char *favorite_exe;
-    const char *exe_name;
-    const char *exe_path;
     int is_list = FALSE;
     int is_whole_word = FALSE;
     int is_pause = FALSE;
     int is_path_only = FALSE;
     int is_save = FALSE;
     int is_delete = FALSE;
+    int is_complete = FALSE;
+    int is_pick = FALSE;
+    int is_fuzzy = FALSE;
     int chosen_option = 0;
     int prm_no = 1;
     int n_results;
-    int ok;
+    int n_total = 0;
+    int n_rows = 0;
+    int n_offset = 0;
+    int cur_option = 0;
+    int chosen_index = -1;
+    struct TierProbe probes[MAX_TIERS];
+    EVERYTHING_SNAPSHOT snapshot;
+    DWORD err;
+    int n_tiers;
+    int tier;
+    char *miss_cache_path = NULL;
+    char *shared_cache_path = NULL;
+    char shared_key[SHARED_CACHE_KEY_SIZE + 1];
+    size_t shared_key_len = 0;
 
     if (argc < 2) {
         help();
         exit(1);
     }
 
+    s_start_tick = GetTickCount();
     load_favorites();
 
     while (prm_no < argc && argv[prm_no][0] == '-') {
@@ -372,6 +1462,18 @@ int main(int argc, char *argv[], char *envv[])
             is_whole_word = TRUE;
             break;
 
+        case 'v':
+            s_verbose = TRUE;
+            break;
+
+        case 'i':
+            is_pick = TRUE;
+            break;
+
+        case 'z':
+            is_fuzzy = TRUE;
+            break;
+
         case 'k':
             is_pause = TRUE;
             break;
@@ -400,10 +1502,37 @@ int main(int argc, char *argv[], char *envv[])
             chosen_option = atoi(&argv[prm_no][1]);
             break;
 
+        case 't':
+            s_timeout = strtoul(&argv[prm_no][2], NULL, 10);
+            if (s_timeout == 0 || s_timeout == INFINITE) {
+                fprintf(stderr, "Invalid timeout '%s'\n\n", argv[prm_no]);
+                help();
+                exit(2);
+            }
+            break;
+
+        case 'c':
+            s_shared_ms = strtoul(&argv[prm_no][2], NULL, 10);
+            if (s_shared_ms == 0 || s_shared_ms == INFINITE) {
+                fprintf(stderr, "Invalid cache age '%s'\n\n", argv[prm_no]);
+                help();
+                exit(2);
+            }
+            break;
+
         case 'f':
             list_favorites();
             exit(0);
 
+        case '-':
+            if (strcmp(argv[prm_no], "--complete") == 0) {
+                is_complete = TRUE;
+                break;
+            }
+            fprintf(stderr, "Unrecognized option '%s'\n\n", argv[prm_no]);
+            help();
+            exit(2);
+
         default:
             fprintf(stderr, "Unrecognized option '%s'\n\n", argv[prm_no]);
             help();
@@ -413,6 +1542,11 @@ int main(int argc, char *argv[], char *envv[])
         prm_no++;
     }
 
+    if (is_complete) {
+        complete_names(argv[prm_no] ? argv[prm_no] : "");
+        exit(0);
+    }
+
     if (!argv[prm_no] || !*argv[prm_no]) {
         fprintf(stderr, "Missing program to %s\n", is_delete ? "delete" : "run");
         help();
@@ -422,106 +1556,171 @@ int main(int argc, char *argv[], char *envv[])
         delete_favorite(argv[prm_no]);
         exit(0);
     }
-    else if (is_save && chosen_option == 0) {
+    else if (is_pick && (is_list || chosen_option != 0)) {
+        fprintf(stderr, "Cannot pick a program when listing or selecting one\n");
+        help();
+        exit(2);
+    }
+    else if (is_save && chosen_option == 0 && !is_pick) {
         fprintf(stderr, "Cannot save a favorite program without selecting one\n");
         help();
         exit(2);
     }
 
+    // Runs started together on a build agent mostly look for the same few
+    // programs; the first to find one saves the others the search
+    if (s_shared_ms && !is_list && !is_pick && !is_fuzzy) {
+        shared_cache_path = get_shared_cache_path();
+        if (shared_cache_path && shared_cache_open(shared_cache_path)) {
+            shared_key_len = shared_cache_key(shared_key, sizeof(shared_key), argv[prm_no], is_whole_word, chosen_option);
+        }
+    }
+
     favorite_exe = lookup_favorite(argv[prm_no]);
-    if (favorite_exe && !(is_list || chosen_option != 0)) {
+    if (is_pick) {
+        pick_program(argv[prm_no], is_fuzzy, exe_pattern, sizeof(exe_pattern));
+    }
+    else if (favorite_exe && !(is_list || chosen_option != 0)) {
         strcpy_s(exe_pattern, sizeof(exe_pattern), favorite_exe);
     }
+    else if (!is_list && chosen_option == 0 && !is_fuzzy && !strpbrk(argv[prm_no], "\\*?") &&
+             find_on_path(argv[prm_no], exe_pattern, sizeof(exe_pattern))) {
+        verbose("path: using %s", exe_pattern);
+    }
+    // Only what was not found on PATH is shared, so PATH still comes first
+    else if (shared_key_len && shared_cache_lookup(shared_key, shared_key_len, s_shared_ms, exe_pattern, sizeof(exe_pattern))) {
+        verbose("shared cache: '%s' was found by another run in the last %lu ms", argv[prm_no], s_shared_ms);
+    }
+    else if (!is_fuzzy && open_locate_db(argv[prm_no])) {
+        locate_search(argv[prm_no], is_whole_word ? 2 : 3, is_list, chosen_option ? chosen_option : 1, favorite_exe, exe_pattern, sizeof(exe_pattern));
+    }
+    else if (is_fuzzy) {
+        fuzzy_search(argv[prm_no], is_list, chosen_option ? chosen_option : 1, favorite_exe, exe_pattern, sizeof(exe_pattern));
+    }
     else {
         if (chosen_option == 0) {
             chosen_option = 1;
         }
 
-        // First try: just with .exe
-        set_pattern_if_path(exe_pattern, sizeof(exe_pattern) - sizeof(".exe"), argv[prm_no]);
-        if (!ends_with(exe_pattern, ".exe"))
-            strcat(exe_pattern, ".exe");
-
-        reset_search(exe_pattern);
-        Everything_SetMatchWholeWord(TRUE);
-
-        ok = Everything_Query(TRUE);
-
-        // No results? Relax
-        if (ok && (Everything_GetNumResults() == 0 || !starts_with(Everything_GetResultFileName(0), argv[prm_no]))) {
-            set_pattern_if_path(exe_pattern, sizeof(exe_pattern) - sizeof("*.exe"), argv[prm_no]);
-            if (!ends_with(exe_pattern, ".exe"))
-                strcat(exe_pattern, "*.exe");
-            reset_search(exe_pattern);
-            Everything_SetMatchWholeWord(TRUE);
-
-            ok = Everything_Query(TRUE);
+        if (s_timeout != INFINITE) {
+            Everything_SetWaitForReady(TRUE);
+        }
 
-            if (ok && Everything_GetNumResults() == 0 && !is_whole_word) {
-                set_pattern_if_path(exe_pattern, sizeof(exe_pattern) - sizeof("*.exe"), argv[prm_no]);
-                if (!ends_with(exe_pattern, ".exe"))
-                    strcat(exe_pattern, "*.exe");
-                reset_search(exe_pattern);
-                Everything_SetMatchWholeWord(FALSE);
+        n_tiers = is_whole_word ? 2 : 3;
 
-                ok = Everything_Query(TRUE);
-            }
+        // Names that were not found before are answered without searching, as
+        // long as nothing that could match them has appeared since. Paths are
+        // left out, as renaming a folder can make them match.
+        if (!strchr(argv[prm_no], '\\')) {
+            miss_cache_path = get_miss_cache_path();
         }
-
-        if (!ok) {
-            print_error();
-            exit(5);
+        if (miss_cache_path) {
+            switch (miss_cache_open(miss_cache_path)) {
+            case MISS_CACHE_OFF:
+                verbose("miss cache: off, a local volume has no change journal to check it by");
+                break;
+
+            case MISS_CACHE_VALID:
+                if (miss_cache_contains(argv[prm_no], strlen(argv[prm_no]), is_whole_word)) {
+                    verbose("miss cache: '%s' was not found before and nothing that could match has appeared since", argv[prm_no]);
+                    tier_pattern(n_tiers, exe_pattern, sizeof(exe_pattern), argv[prm_no]);
+                    fprintf(stderr, "%s not found\n", exe_pattern);
+                    exit(3);
+                }
+                break;
+            }
         }
 
-        n_results = Everything_GetNumResults();
-        if (!n_results) {
-            fprintf(stderr, "%s not found\n", exe_pattern);
+        n_rows = first_page_rows(is_list, chosen_option);
+        tier = probe_tiers(probes, n_tiers, argv[prm_no], n_rows);
+        if (!tier) {
+            // A database still loading may not have the program yet
+            if (miss_cache_path && Everything_IsDBLoaded()) {
+                miss_cache_add(argv[prm_no], strlen(argv[prm_no]), is_whole_word);
+            }
+            fprintf(stderr, "%s not found\n", probes[n_tiers - 1].pattern);
             exit(3);
         }
 
-        if (is_list || chosen_option) {
-            int cur_option = 0;
-            for (i = 0; i < n_results; i++)
-            {
-                if (skipped_file(Everything_GetResultFileName(i), Everything_GetResultPath(i))) {
-                    continue;
-                }
+        snapshot = probes[tier - 1].snapshot;
+        n_total = probes[tier - 1].total;
+        n_results = Everything_GetSnapshotNumResults(snapshot);
+
+        // Walk the matches a page at a time; a page too small to get past the
+        // skipped files is followed by a bigger one
+        for (;;) {
+            EVERYTHING_RESULTRECORD *records = (EVERYTHING_RESULTRECORD *)malloc(n_results * sizeof(EVERYTHING_RESULTRECORD));
+            DWORD *order = (DWORD *)malloc(n_results * sizeof(DWORD));
+            DWORD n_ordered;
+            DWORD n_used;
+            DWORD j;
+
+            if (!records || !order) {
+                fprintf(stderr, "Out of memory\n");
+                exit(5);
+            }
 
+            n_results = Everything_GetSnapshotRecords(snapshot, 0, n_results, records);
+            n_used = order_records(records, n_results, n_offset + n_results < n_total, order, &n_ordered);
+            for (j = 0; j < n_ordered; j++)
+            {
+                i = order[j];
                 cur_option++;
 
-                exe_name = Everything_GetResultFileName(i);
-                exe_path = Everything_GetResultPath(i);
-                sprintf(exe_pattern, "%s\\%s", exe_path, exe_name);
-
                 if (is_list) {
-                    int is_default = favorite_exe && _stricmp(favorite_exe, exe_pattern) == 0;
+                    int is_default = favorite_exe && is_favorite(favorite_exe, &records[i]);
 
                     printf("%d) %s%s [%s]%s\n", cur_option,
                         cur_option == chosen_option ? "CHOSEN: " : "",
-                        Everything_GetResultFileName(i), Everything_GetResultPath(i),
+                        records[i].file_name.ptr, records[i].path.ptr,
                         is_default ? " (default)" : "");
                 }
                 else {
                     if (cur_option == chosen_option) {
-                        chosen_option = i + 1;
+                        copy_full_path(exe_pattern, sizeof(exe_pattern), &records[i]);
+                        chosen_index = n_offset + i;
                         break;
                     }
                 }
             }
 
-            if (is_list) {
-                return 0;
+            free(order);
+            free(records);
+
+            if (chosen_index >= 0) {
+                break;
+            }
+
+            n_offset += n_used;
+            if (n_results == 0 || n_offset >= n_total) {
+                break;
+            }
+
+            n_rows = next_page_rows(n_rows, n_total - n_offset);
+            verbose("tier %d: %d usable in the first %d rows, fetching %d more", tier, cur_option, n_offset, n_rows);
+            Everything_ReleaseSnapshot(snapshot);
+            err = query_tier(tier, probes[tier - 1].pattern, n_offset, n_rows, NULL, &snapshot);
+            if (err != EVERYTHING_OK) {
+                exit_query_error(err, tier, probes[tier - 1].pattern);
             }
+
+            n_results = Everything_GetSnapshotNumResults(snapshot);
         }
 
-        exe_name = Everything_GetResultFileName(chosen_option - 1);
-        exe_path = Everything_GetResultPath(chosen_option - 1);
-        if (exe_name && exe_pattern) {
-            sprintf(exe_pattern, "%s\\%s", exe_path, exe_name);
+        if (is_list) {
+            Everything_ReleaseSnapshot(snapshot);
+            return 0;
+        }
+
+        if (chosen_index >= 0) {
+            if (shared_key_len) {
+                shared_cache_store(shared_key, shared_key_len, exe_pattern);
+            }
         }
         else {
             *exe_pattern = '\0';
         }
+        Everything_ReleaseSnapshot(snapshot);
     }
 
     if (is_save) {
@@ -538,17 +1737,26 @@ int main(int argc, char *argv[], char *envv[])
     else if (is_path_only) {
         fprintf(stdout, "%s", exe_pattern);
     }
+    else if (!*exe_pattern) {
+        fprintf(stderr, "%s not found, or option %d is not a valid choice\n", argv[prm_no], chosen_option ? chosen_option : 1);
+        exit(3);
+    }
     else {
         fprintf(stderr, "Running: %s:\n", exe_pattern);
 
-        // Make sure empty parameters do not vanish by replacing them with explicit quotes
-        for (i = prm_no; argv[i]; i++) {
-            if (argv[i][0] == '\0') {
-                argv[i] = "\"\"";
+        if (ends_with(exe_pattern, strlen(exe_pattern), ".exe") || ends_with(exe_pattern, strlen(exe_pattern), ".com")) {
+            // Make sure empty parameters do not vanish by replacing them with explicit quotes
+            for (i = prm_no; argv[i]; i++) {
+                if (argv[i][0] == '\0') {
+                    argv[i] = "\"\"";
+                }
             }
-        }
 
-        status = _spawnvpe(_P_WAIT, exe_pattern, argv + prm_no, envv);
+            status = _spawnvpe(_P_WAIT, exe_pattern, argv + prm_no, envv);
+        }
+        else {
+            status = spawn_with_shell(exe_pattern, argv + prm_no + 1, envv);
+        }
     }
 
     if (is_pause) {
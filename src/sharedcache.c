@@ -0,0 +1,235 @@
+// sharedcache.c : paths resolved by one run, shared with the runs after it
+//
+// (MIT license - see run.c)
+//
+
+#include <string.h>
+#include "sharedcache.h"
+#include "strfold.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define SHARED_CACHE_MAGIC 0x31435352   // "RSC1"
+#define SHARED_CACHE_ENTRIES 128
+#define PROBE_ENTRIES 8                 // A key lives in one of the 8 entries from its hash on
+#define READ_RETRIES 16
+
+#ifdef _WIN32
+#define load_acquire(p)         InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#define load_relaxed(p)         (*(p))
+#define store_release(p, v)     InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+#define compare_exchange(p, old_value, new_value) \
+    (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(new_value), (LONG)(old_value)) == (LONG)(old_value))
+#define read_fence()            MemoryBarrier()
+#define write_fence()           MemoryBarrier()
+#else
+#define load_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define load_relaxed(p)         __atomic_load_n(p, __ATOMIC_RELAXED)
+#define store_release(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define compare_exchange(p, old_value, new_value) \
+    __extension__ ({ int expected_ = (old_value); __atomic_compare_exchange_n(p, &expected_, new_value, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED); })
+#define read_fence()            __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define write_fence()           __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+struct SharedEntry
+{
+    volatile int seq;           // Odd while the entry is being written
+    unsigned key_len;           // 0 for an unused entry
+    unsigned long long hash;
+    unsigned long long stored_ms;
+    char key[SHARED_CACHE_KEY_SIZE];
+    char path[SHARED_CACHE_PATH_SIZE];
+};
+
+// The cache file is this structure as is; a new file is all zeros
+struct SharedCacheFile
+{
+    volatile int magic;
+    struct SharedEntry entries[SHARED_CACHE_ENTRIES];
+};
+
+static struct SharedCacheFile *s_cache;
+
+// Wall clock, so an entry does not look fresh after a restart
+static unsigned long long now_ms()
+{
+#ifdef _WIN32
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+    return (((unsigned long long)now.dwHighDateTime << 32) | now.dwLowDateTime) / 10000;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (unsigned long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static int file_exists(const char *path)
+{
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+
+    return attributes != INVALID_FILE_ATTRIBUTES && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat st;
+
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+#endif
+}
+
+static void *map_file(const char *path, size_t size)
+{
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+    void *view;
+
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    // Grows a shorter file to size, zero filled
+    mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, (DWORD)size, NULL);
+    CloseHandle(file);
+    if (!mapping)
+        return NULL;
+
+    view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, size);
+    CloseHandle(mapping);
+    return view;
+#else
+    struct stat st;
+    void *view;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (st.st_size < (off_t)size && ftruncate(fd, (off_t)size) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    view = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return view == MAP_FAILED ? NULL : view;
+#endif
+}
+
+int shared_cache_open(const char *path)
+{
+    struct SharedCacheFile *cache;
+
+    if (s_cache)
+        return 1;
+
+    cache = (struct SharedCacheFile *)map_file(path, sizeof(struct SharedCacheFile));
+    if (!cache)
+        return 0;
+
+    // Whichever run gets here first on a new file stamps it
+    compare_exchange(&cache->magic, 0, SHARED_CACHE_MAGIC);
+    if (load_acquire(&cache->magic) != SHARED_CACHE_MAGIC) {
+#ifdef _WIN32
+        UnmapViewOfFile(cache);
+#else
+        munmap(cache, sizeof(struct SharedCacheFile));
+#endif
+        return 0;
+    }
+
+    s_cache = cache;
+    return 1;
+}
+
+int shared_cache_lookup(const char *key, size_t key_len, unsigned max_age_ms, char *path, size_t path_size)
+{
+    unsigned long long hash = fold_hash(key, key_len);
+    unsigned long long now = now_ms();
+    int i;
+
+    if (!s_cache || key_len == 0 || key_len > SHARED_CACHE_KEY_SIZE || path_size < SHARED_CACHE_PATH_SIZE)
+        return 0;
+
+    for (i = 0; i < PROBE_ENTRIES; i++) {
+        struct SharedEntry *entry = &s_cache->entries[(hash + i) % SHARED_CACHE_ENTRIES];
+        int attempt;
+
+        for (attempt = 0; attempt < READ_RETRIES; attempt++) {
+            int seq = load_acquire(&entry->seq);
+            unsigned long long stored_ms;
+            int is_match;
+
+            if (seq & 1)
+                continue;
+
+            is_match = entry->hash == hash && entry->key_len == key_len && fold_equals(entry->key, key_len, key, key_len);
+            stored_ms = entry->stored_ms;
+            if (is_match)
+                memcpy(path, entry->path, SHARED_CACHE_PATH_SIZE);
+
+            // Anything read while a writer was at it is thrown away
+            read_fence();
+            if (load_relaxed(&entry->seq) != seq)
+                continue;
+
+            if (is_match && now >= stored_ms && now - stored_ms <= max_age_ms) {
+                path[SHARED_CACHE_PATH_SIZE - 1] = '\0';
+                if (file_exists(path))
+                    return 1;
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void shared_cache_store(const char *key, size_t key_len, const char *path)
+{
+    unsigned long long hash = fold_hash(key, key_len);
+    size_t path_len = strlen(path);
+    struct SharedEntry *target = NULL;
+    int i;
+    int seq;
+
+    if (!s_cache || key_len == 0 || key_len > SHARED_CACHE_KEY_SIZE || path_len >= SHARED_CACHE_PATH_SIZE)
+        return;
+
+    // The entry already holding the key, else an unused one, else the oldest.
+    // These are only hints, taken without the sequence numbers.
+    for (i = 0; i < PROBE_ENTRIES; i++) {
+        struct SharedEntry *entry = &s_cache->entries[(hash + i) % SHARED_CACHE_ENTRIES];
+
+        if (entry->hash == hash && entry->key_len == key_len) {
+            target = entry;
+            break;
+        }
+        if (!target || (target->key_len && (!entry->key_len || entry->stored_ms < target->stored_ms)))
+            target = entry;
+    }
+
+    seq = load_acquire(&target->seq);
+    if ((seq & 1) || !compare_exchange(&target->seq, seq, seq + 1))
+        return;
+
+    write_fence();
+    target->hash = hash;
+    target->key_len = (unsigned)key_len;
+    memcpy(target->key, key, key_len);
+    memcpy(target->path, path, path_len + 1);
+    target->stored_ms = now_ms();
+    write_fence();
+    store_release(&target->seq, seq + 2);
+}
@@ -0,0 +1,39 @@
+// sharedcache.h : paths resolved by one run, shared with the runs after it
+//
+// (MIT license - see run.c)
+//
+// The cache is a file mapped into every run that uses it, holding a fixed
+// open addressing table of key -> path entries. Readers never lock: each
+// entry carries a sequence number that is odd while it is being written, and
+// a read that saw it change is retried. Writers claim an entry by moving its
+// sequence number from even to odd, so two writers never share one, and
+// publish it by moving it on to the next even number. A writer that finds its
+// entries busy just does not cache. Builds for Windows map the file with
+// CreateFileMapping, others with POSIX mmap.
+
+#ifndef RUN_SHAREDCACHE_H
+#define RUN_SHAREDCACHE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHARED_CACHE_KEY_SIZE 128
+#define SHARED_CACHE_PATH_SIZE 520
+
+// Maps the cache file, creating it if needed. Returns 0 if it cannot.
+int shared_cache_open(const char *path);
+
+// Copies the path stored for key within the last max_age_ms milliseconds,
+// if that file still exists. Returns 0 if there is none.
+int shared_cache_lookup(const char *key, size_t key_len, unsigned max_age_ms, char *path, size_t path_size);
+
+void shared_cache_store(const char *key, size_t key_len, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,315 @@
+// strfold.c : case-insensitive string kernels for run and the Everything client
+//
+// (MIT license - see run.c)
+//
+
+#include "strfold.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRFOLD_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define STRFOLD_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The wide kernels work on 16 bit units, as wchar_t is on Windows
+#define STRFOLD_WIDE_SIMD (sizeof(wchar_t) == 2)
+
+static unsigned first_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+unsigned char fold_char(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+static wchar_t fold_wchar(wchar_t c)
+{
+    return c >= L'A' && c <= L'Z' ? (wchar_t)(c + (L'a' - L'A')) : c;
+}
+
+#ifdef STRFOLD_SSE2
+// Lower-case the ASCII letters of 16 bytes. Shifting 'A' to -128 turns the
+// range check into a single signed compare (bytes >= 0x80 never match).
+static __m128i fold_16(__m128i v)
+{
+    __m128i is_upper = _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(0x80 - 'A'))), _mm_set1_epi8(-128 + 26));
+    return _mm_add_epi8(v, _mm_and_si128(is_upper, _mm_set1_epi8('a' - 'A')));
+}
+
+static __m128i fold_8w(__m128i v)
+{
+    __m128i is_upper = _mm_cmplt_epi16(_mm_add_epi16(v, _mm_set1_epi16((short)(0x8000 - 'A'))), _mm_set1_epi16(-32768 + 26));
+    return _mm_add_epi16(v, _mm_and_si128(is_upper, _mm_set1_epi16('a' - 'A')));
+}
+#endif
+
+#ifdef STRFOLD_AVX2
+static __m256i fold_32(__m256i v)
+{
+    __m256i is_upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), _mm256_add_epi8(v, _mm256_set1_epi8((char)(0x80 - 'A'))));
+    return _mm256_add_epi8(v, _mm256_and_si256(is_upper, _mm256_set1_epi8('a' - 'A')));
+}
+
+static __m256i fold_16w(__m256i v)
+{
+    __m256i is_upper = _mm256_cmpgt_epi16(_mm256_set1_epi16(-32768 + 26), _mm256_add_epi16(v, _mm256_set1_epi16((short)(0x8000 - 'A'))));
+    return _mm256_add_epi16(v, _mm256_and_si256(is_upper, _mm256_set1_epi16('a' - 'A')));
+}
+#endif
+
+// Number of leading characters of a and b that are equal when folded (n is the common length)
+static size_t fold_common_prefix(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+
+#ifdef STRFOLD_AVX2
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = fold_32(_mm256_loadu_si256((const __m256i *)(a + i)));
+        __m256i vb = fold_32(_mm256_loadu_si256((const __m256i *)(b + i)));
+        unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (diff) {
+            return i + first_set_bit(diff);
+        }
+    }
+#endif
+#ifdef STRFOLD_SSE2
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = fold_16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m128i vb = fold_16(_mm_loadu_si128((const __m128i *)(b + i)));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        if (diff) {
+            return i + first_set_bit(diff);
+        }
+    }
+    if (i < n && n >= 16) {
+        // Finish with one block overlapping the part already known to match
+        size_t last = n - 16;
+        __m128i va = fold_16(_mm_loadu_si128((const __m128i *)(a + last)));
+        __m128i vb = fold_16(_mm_loadu_si128((const __m128i *)(b + last)));
+        unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        return diff ? last + first_set_bit(diff) : n;
+    }
+#endif
+    for (; i < n; i++) {
+        if (fold_char((unsigned char)a[i]) != fold_char((unsigned char)b[i])) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+static size_t fold_common_prefix_w(const wchar_t *a, const wchar_t *b, size_t n)
+{
+    size_t i = 0;
+
+    if (STRFOLD_WIDE_SIMD) {
+#ifdef STRFOLD_AVX2
+        for (; i + 16 <= n; i += 16) {
+            __m256i va = fold_16w(_mm256_loadu_si256((const __m256i *)(a + i)));
+            __m256i vb = fold_16w(_mm256_loadu_si256((const __m256i *)(b + i)));
+            unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb));
+            if (diff) {
+                return i + first_set_bit(diff) / 2;
+            }
+        }
+#endif
+#ifdef STRFOLD_SSE2
+        for (; i + 8 <= n; i += 8) {
+            __m128i va = fold_8w(_mm_loadu_si128((const __m128i *)(a + i)));
+            __m128i vb = fold_8w(_mm_loadu_si128((const __m128i *)(b + i)));
+            unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) & 0xffff;
+            if (diff) {
+                return i + first_set_bit(diff) / 2;
+            }
+        }
+        if (i < n && n >= 8) {
+            size_t last = n - 8;
+            __m128i va = fold_8w(_mm_loadu_si128((const __m128i *)(a + last)));
+            __m128i vb = fold_8w(_mm_loadu_si128((const __m128i *)(b + last)));
+            unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) & 0xffff;
+            return diff ? last + first_set_bit(diff) / 2 : n;
+        }
+#endif
+    }
+    for (; i < n; i++) {
+        if (fold_wchar(a[i]) != fold_wchar(b[i])) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+int fold_equals(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    return a_len == b_len && fold_common_prefix(a, b, a_len) == a_len;
+}
+
+int fold_compare(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    size_t n = a_len < b_len ? a_len : b_len;
+    size_t i = fold_common_prefix(a, b, n);
+
+    if (i < n) {
+        return (int)fold_char((unsigned char)a[i]) - (int)fold_char((unsigned char)b[i]);
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+int fold_starts_with(const char *str, size_t str_len, const char *prefix, size_t prefix_len)
+{
+    return str_len >= prefix_len && fold_common_prefix(str, prefix, prefix_len) == prefix_len;
+}
+
+int fold_ends_with(const char *str, size_t str_len, const char *suffix, size_t suffix_len)
+{
+    return str_len >= suffix_len && fold_common_prefix(str + str_len - suffix_len, suffix, suffix_len) == suffix_len;
+}
+
+void fold_lower_copy(char *dst, const char *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef STRFOLD_AVX2
+    for (; i + 32 <= len; i += 32) {
+        _mm256_storeu_si256((__m256i *)(dst + i), fold_32(_mm256_loadu_si256((const __m256i *)(src + i))));
+    }
+#endif
+#ifdef STRFOLD_SSE2
+    for (; i + 16 <= len; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i), fold_16(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = (char)fold_char((unsigned char)src[i]);
+    }
+}
+
+// Offset of the first occurrence of sub in str, FOLD_NOT_FOUND if there is
+// none. Sixteen starting offsets at a time are screened by comparing sub's
+// first and last characters; only the offsets passing both are compared in full.
+size_t fold_find(const char *str, size_t str_len, const char *sub, size_t sub_len)
+{
+    size_t i = 0;
+    unsigned char first;
+    unsigned char last;
+
+    if (sub_len == 0) {
+        return 0;
+    }
+    if (sub_len > str_len) {
+        return FOLD_NOT_FOUND;
+    }
+
+    first = fold_char((unsigned char)sub[0]);
+    last = fold_char((unsigned char)sub[sub_len - 1]);
+
+#ifdef STRFOLD_SSE2
+    {
+        __m128i firsts = _mm_set1_epi8((char)first);
+        __m128i lasts = _mm_set1_epi8((char)last);
+
+        for (; i + sub_len - 1 + 16 <= str_len; i += 16) {
+            __m128i at_first = fold_16(_mm_loadu_si128((const __m128i *)(str + i)));
+            __m128i at_last = fold_16(_mm_loadu_si128((const __m128i *)(str + i + sub_len - 1)));
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_first, firsts), _mm_cmpeq_epi8(at_last, lasts)));
+
+            while (mask) {
+                size_t at = i + first_set_bit(mask);
+
+                if (fold_common_prefix(str + at, sub, sub_len) == sub_len) {
+                    return at;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for (; i + sub_len <= str_len; i++) {
+        if (fold_char((unsigned char)str[i]) == first && fold_char((unsigned char)str[i + sub_len - 1]) == last &&
+            fold_common_prefix(str + i, sub, sub_len) == sub_len) {
+            return i;
+        }
+    }
+
+    return FOLD_NOT_FOUND;
+}
+
+// 64 bit FNV-1a; names differing only in case hash the same
+unsigned long long fold_hash(const char *s, size_t len)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ fold_char((unsigned char)s[i])) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+int fold_equals_w(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len)
+{
+    return a_len == b_len && fold_common_prefix_w(a, b, a_len) == a_len;
+}
+
+int fold_compare_w(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len)
+{
+    size_t n = a_len < b_len ? a_len : b_len;
+    size_t i = fold_common_prefix_w(a, b, n);
+
+    if (i < n) {
+        return fold_wchar(a[i]) < fold_wchar(b[i]) ? -1 : 1;
+    }
+
+    return a_len < b_len ? -1 : a_len > b_len ? 1 : 0;
+}
+
+int fold_starts_with_w(const wchar_t *str, size_t str_len, const wchar_t *prefix, size_t prefix_len)
+{
+    return str_len >= prefix_len && fold_common_prefix_w(str, prefix, prefix_len) == prefix_len;
+}
+
+int fold_ends_with_w(const wchar_t *str, size_t str_len, const wchar_t *suffix, size_t suffix_len)
+{
+    return str_len >= suffix_len && fold_common_prefix_w(str + str_len - suffix_len, suffix, suffix_len) == suffix_len;
+}
+
+void fold_lower_copy_w(wchar_t *dst, const wchar_t *src, size_t len)
+{
+    size_t i = 0;
+
+    if (STRFOLD_WIDE_SIMD) {
+#ifdef STRFOLD_AVX2
+        for (; i + 16 <= len; i += 16) {
+            _mm256_storeu_si256((__m256i *)(dst + i), fold_16w(_mm256_loadu_si256((const __m256i *)(src + i))));
+        }
+#endif
+#ifdef STRFOLD_SSE2
+        for (; i + 8 <= len; i += 8) {
+            _mm_storeu_si128((__m128i *)(dst + i), fold_8w(_mm_loadu_si128((const __m128i *)(src + i))));
+        }
+#endif
+    }
+    for (; i < len; i++) {
+        dst[i] = fold_wchar(src[i]);
+    }
+}
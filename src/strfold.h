@@ -0,0 +1,43 @@
+// strfold.h : case-insensitive string kernels for run and the Everything client
+//
+// (MIT license - see run.c)
+//
+// All kernels take explicit lengths (in characters) so callers that already
+// know them never rescan a string. Only ASCII letters are folded, matching
+// _stricmp/_wcsicmp in the "C" locale. SSE2 (and AVX2 when compiled with
+// /arch:AVX2) is used when available, with a scalar fallback otherwise.
+
+#ifndef RUN_STRFOLD_H
+#define RUN_STRFOLD_H
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FOLD_NOT_FOUND ((size_t)-1)
+
+// The folding the kernels do, for one character
+unsigned char fold_char(unsigned char c);
+
+int fold_equals(const char *a, size_t a_len, const char *b, size_t b_len);
+int fold_compare(const char *a, size_t a_len, const char *b, size_t b_len);
+int fold_starts_with(const char *str, size_t str_len, const char *prefix, size_t prefix_len);
+int fold_ends_with(const char *str, size_t str_len, const char *suffix, size_t suffix_len);
+void fold_lower_copy(char *dst, const char *src, size_t len);
+size_t fold_find(const char *str, size_t str_len, const char *sub, size_t sub_len);
+unsigned long long fold_hash(const char *s, size_t len);
+
+int fold_equals_w(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len);
+int fold_compare_w(const wchar_t *a, size_t a_len, const wchar_t *b, size_t b_len);
+int fold_starts_with_w(const wchar_t *str, size_t str_len, const wchar_t *prefix, size_t prefix_len);
+int fold_ends_with_w(const wchar_t *str, size_t str_len, const wchar_t *suffix, size_t suffix_len);
+void fold_lower_copy_w(wchar_t *dst, const wchar_t *src, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
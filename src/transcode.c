@@ -0,0 +1,326 @@
+// transcode.c : string length and ANSI/UTF-16/UTF-8 conversion kernels
+//
+// (MIT license - see run.c)
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "transcode.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSCODE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// The wide kernels work on 16 bit units, as wchar_t is on Windows
+#define TRANSCODE_WIDE_SIMD (sizeof(wchar_t) == 2)
+
+#define REPLACEMENT_CHAR 0xfffd
+
+#ifdef TRANSCODE_SSE2
+static unsigned first_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+// Reads are done in aligned 16 byte blocks, so they never cross into a page
+// the string does not touch, even when they start before it.
+size_t transcode_strlen(const char *s)
+{
+#ifdef TRANSCODE_SSE2
+    const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+    __m128i zero = _mm_setzero_si128();
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero)) >> (s - p);
+
+    if (mask) {
+        return first_set_bit(mask);
+    }
+
+    for (;;) {
+        p += 16;
+        mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)p), zero));
+        if (mask) {
+            return (size_t)(p - s) + first_set_bit(mask);
+        }
+    }
+#else
+    return strlen(s);
+#endif
+}
+
+size_t transcode_wcslen(const wchar_t *s)
+{
+#ifdef TRANSCODE_SSE2
+    if (TRANSCODE_WIDE_SIMD && ((uintptr_t)s & 1) == 0) {
+        const char *p = (const char *)((uintptr_t)s & ~(uintptr_t)15);
+        __m128i zero = _mm_setzero_si128();
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128((const __m128i *)p), zero)) >> ((const char *)s - p);
+
+        if (mask) {
+            return first_set_bit(mask) / 2;
+        }
+
+        for (;;) {
+            p += 16;
+            mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_load_si128((const __m128i *)p), zero));
+            if (mask) {
+                return ((size_t)(p - (const char *)s) + first_set_bit(mask)) / 2;
+            }
+        }
+    }
+#endif
+    return wcslen(s);
+}
+
+size_t transcode_ascii_prefix(const char *s, size_t len)
+{
+    size_t i = 0;
+
+#ifdef TRANSCODE_SSE2
+    for (; i + 16 <= len; i += 16) {
+        unsigned high = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+        if (high) {
+            return i + first_set_bit(high);
+        }
+    }
+#endif
+    while (i < len && (unsigned char)s[i] < 0x80) {
+        i++;
+    }
+
+    return i;
+}
+
+size_t transcode_ascii_prefix_w(const wchar_t *s, size_t len)
+{
+    size_t i = 0;
+
+#ifdef TRANSCODE_SSE2
+    if (TRANSCODE_WIDE_SIMD) {
+        __m128i high_bits = _mm_set1_epi16((short)0xff80);
+        __m128i zero = _mm_setzero_si128();
+
+        for (; i + 8 <= len; i += 8) {
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + i)), high_bits);
+            unsigned non_ascii = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) & 0xffff;
+            if (non_ascii) {
+                return i + first_set_bit(non_ascii) / 2;
+            }
+        }
+    }
+#endif
+    while (i < len && (unsigned)s[i] < 0x80) {
+        i++;
+    }
+
+    return i;
+}
+
+void transcode_widen_ascii(wchar_t *dst, const char *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef TRANSCODE_SSE2
+    if (TRANSCODE_WIDE_SIMD) {
+        __m128i zero = _mm_setzero_si128();
+
+        for (; i + 16 <= len; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = (wchar_t)(unsigned char)src[i];
+    }
+}
+
+void transcode_narrow_ascii(char *dst, const wchar_t *src, size_t len)
+{
+    size_t i = 0;
+
+#ifdef TRANSCODE_SSE2
+    if (TRANSCODE_WIDE_SIMD) {
+        for (; i + 16 <= len; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(src + i + 8));
+            _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        dst[i] = (char)src[i];
+    }
+}
+
+size_t transcode_utf16_to_utf8(char *dst, size_t dst_max, const wchar_t *src, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        unsigned long c;
+        size_t n;
+
+        // Copy runs of ASCII straight through
+        n = transcode_ascii_prefix_w(src + in, len - in);
+        if (n) {
+            if (dst) {
+                if (n > dst_max - out) {
+                    n = dst_max - out;
+                }
+                transcode_narrow_ascii(dst + out, src + in, n);
+                if (in + n < len && out + n == dst_max) {
+                    return out + n;
+                }
+            }
+            in += n;
+            out += n;
+            continue;
+        }
+
+        c = (unsigned long)src[in++];
+        if (c >= 0xd800 && c <= 0xdbff && in < len && (unsigned long)src[in] >= 0xdc00 && (unsigned long)src[in] <= 0xdfff) {
+            c = 0x10000 + ((c - 0xd800) << 10) + ((unsigned long)src[in++] - 0xdc00);
+        }
+        else if (c >= 0xd800 && c <= 0xdfff) {
+            c = REPLACEMENT_CHAR;
+        }
+
+        n = c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (dst) {
+            if (n > dst_max - out) {
+                return out;
+            }
+            switch (n) {
+            case 2:
+                dst[out]     = (char)(0xc0 | (c >> 6));
+                dst[out + 1] = (char)(0x80 | (c & 0x3f));
+                break;
+            case 3:
+                dst[out]     = (char)(0xe0 | (c >> 12));
+                dst[out + 1] = (char)(0x80 | ((c >> 6) & 0x3f));
+                dst[out + 2] = (char)(0x80 | (c & 0x3f));
+                break;
+            default:
+                dst[out]     = (char)(0xf0 | (c >> 18));
+                dst[out + 1] = (char)(0x80 | ((c >> 12) & 0x3f));
+                dst[out + 2] = (char)(0x80 | ((c >> 6) & 0x3f));
+                dst[out + 3] = (char)(0x80 | (c & 0x3f));
+            }
+        }
+        out += n;
+    }
+
+    return out;
+}
+
+// Length of the UTF-8 sequence starting at s[0] with its code point in *c,
+// or 0 when it is malformed (overlong, surrogate, out of range or truncated).
+static size_t decode_utf8(const unsigned char *s, size_t len, unsigned long *c)
+{
+    size_t n;
+    size_t i;
+
+    if (s[0] < 0xc2) {
+        return 0;
+    }
+    else if (s[0] < 0xe0) {
+        n = 2;
+        *c = s[0] & 0x1f;
+    }
+    else if (s[0] < 0xf0) {
+        n = 3;
+        *c = s[0] & 0x0f;
+    }
+    else if (s[0] < 0xf5) {
+        n = 4;
+        *c = s[0] & 0x07;
+    }
+    else {
+        return 0;
+    }
+
+    if (n > len) {
+        return 0;
+    }
+
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        *c = (*c << 6) | (s[i] & 0x3f);
+    }
+
+    if ((n == 3 && *c < 0x800) || (n == 4 && (*c < 0x10000 || *c > 0x10ffff)) || (*c >= 0xd800 && *c <= 0xdfff)) {
+        return 0;
+    }
+
+    return n;
+}
+
+size_t transcode_utf8_to_utf16(wchar_t *dst, size_t dst_max, const char *src, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        unsigned long c;
+        size_t n;
+
+        n = transcode_ascii_prefix(src + in, len - in);
+        if (n) {
+            if (dst) {
+                if (n > dst_max - out) {
+                    n = dst_max - out;
+                }
+                transcode_widen_ascii(dst + out, src + in, n);
+                if (in + n < len && out + n == dst_max) {
+                    return out + n;
+                }
+            }
+            in += n;
+            out += n;
+            continue;
+        }
+
+        n = decode_utf8((const unsigned char *)src + in, len - in, &c);
+        if (n) {
+            in += n;
+        }
+        else {
+            // Skip one byte of a malformed sequence
+            c = REPLACEMENT_CHAR;
+            in++;
+        }
+
+        n = c >= 0x10000 ? 2 : 1;
+        if (dst) {
+            if (n > dst_max - out) {
+                return out;
+            }
+            if (n == 2) {
+                dst[out]     = (wchar_t)(0xd800 + ((c - 0x10000) >> 10));
+                dst[out + 1] = (wchar_t)(0xdc00 + ((c - 0x10000) & 0x3ff));
+            }
+            else {
+                dst[out] = (wchar_t)c;
+            }
+        }
+        out += n;
+    }
+
+    return out;
+}
@@ -0,0 +1,42 @@
+// transcode.h : string length and ANSI/UTF-16/UTF-8 conversion kernels
+//
+// (MIT license - see run.c)
+//
+// Lengths are in characters of the source/destination type. The ASCII parts
+// of a string are handled 8-16 characters at a time with SSE2; anything else
+// goes through a scalar UTF-8/UTF-16 codec (invalid UTF-16 surrogates become
+// U+FFFD). ANSI code page conversion of non-ASCII text is left to the caller
+// (MultiByteToWideChar/WideCharToMultiByte), only the ASCII fast path is here.
+
+#ifndef RUN_TRANSCODE_H
+#define RUN_TRANSCODE_H
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t transcode_strlen(const char *s);
+size_t transcode_wcslen(const wchar_t *s);
+
+// Number of leading characters below 0x80
+size_t transcode_ascii_prefix(const char *s, size_t len);
+size_t transcode_ascii_prefix_w(const wchar_t *s, size_t len);
+
+// Copy len ASCII characters between narrow and wide buffers
+void transcode_widen_ascii(wchar_t *dst, const char *src, size_t len);
+void transcode_narrow_ascii(char *dst, const wchar_t *src, size_t len);
+
+// Convert len characters. At most dst_max characters are written, never
+// splitting a sequence, and nothing is terminated. Returns the number of
+// characters written, or the number needed when dst is NULL.
+size_t transcode_utf16_to_utf8(char *dst, size_t dst_max, const wchar_t *src, size_t len);
+size_t transcode_utf8_to_utf16(wchar_t *dst, size_t dst_max, const char *src, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif